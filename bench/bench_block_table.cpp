@@ -0,0 +1,107 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <unistd.h>
+
+#include "block_table.h"
+
+using namespace reven::block::detail;
+
+namespace {
+
+void show_help_and_exit(const char* prog_name) {
+	std::cerr << "Usage:\n";
+	std::cerr << prog_name << " [block_count...]\n\n";
+	std::cerr << "Measures the resident memory and the lookup rate of the block deduplication table of the Writer\n";
+	std::cerr << "\t- block_count: number of distinct blocks in the table, defaults to 10000000 50000000 100000000"
+	          << std::endl;
+	std::exit(1);
+}
+
+//! Resident memory of the process, in bytes
+std::uint64_t resident_memory() {
+	std::ifstream statm("/proc/self/statm");
+	std::uint64_t size = 0;
+	std::uint64_t resident = 0;
+	statm >> size >> resident;
+	return resident * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+//! Synthetic fingerprint of the index-th block, uniformly distributed like an actual fingerprint (splitmix64)
+Fingerprint make_fingerprint(std::uint64_t index) {
+	auto mix = [](std::uint64_t z) {
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	};
+	return Fingerprint{mix(index * 0x9e3779b97f4a7c15ULL), mix(~index * 0x9e3779b97f4a7c15ULL)};
+}
+
+void run(std::uint64_t block_count) {
+	const auto rss_before = resident_memory();
+
+	BlockTable table;
+
+	const auto insert_start = std::chrono::steady_clock::now();
+	for (std::uint64_t i = 0; i < block_count; ++i) {
+		table.insert(make_fingerprint(i), static_cast<std::uint32_t>(i + 1)).executed_instructions = 1;
+	}
+	const std::chrono::duration<double> insert_elapsed = std::chrono::steady_clock::now() - insert_start;
+
+	const auto rss = resident_memory() - rss_before;
+
+	// Lookups of known blocks in a scattered order, as when a trace re-executes its blocks
+	const auto hit_start = std::chrono::steady_clock::now();
+	std::uint64_t found = 0;
+	for (std::uint64_t i = 0; i < block_count; ++i) {
+		found += table.find(make_fingerprint((i * 7919) % block_count)) != nullptr;
+	}
+	const std::chrono::duration<double> hit_elapsed = std::chrono::steady_clock::now() - hit_start;
+
+	// Lookups of new blocks
+	const auto miss_start = std::chrono::steady_clock::now();
+	std::uint64_t missed = 0;
+	for (std::uint64_t i = 0; i < block_count; ++i) {
+		missed += table.find(make_fingerprint(block_count + i)) == nullptr;
+	}
+	const std::chrono::duration<double> miss_elapsed = std::chrono::steady_clock::now() - miss_start;
+
+	if (found != block_count or missed != block_count) {
+		std::cerr << "Inconsistent lookups: " << found << " found, " << missed << " missed" << std::endl;
+		std::exit(1);
+	}
+
+	std::cout << block_count << " blocks: " << rss << " bytes resident ("
+	          << static_cast<double>(rss) / block_count << " bytes/block), "
+	          << table.memory_usage() << " bytes allocated, "
+	          << block_count / insert_elapsed.count() << " inserts/s, "
+	          << block_count / hit_elapsed.count() << " hits/s, "
+	          << block_count / miss_elapsed.count() << " misses/s" << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+	std::vector<std::uint64_t> block_counts;
+	for (int i = 1; i < argc; ++i) {
+		const auto block_count = std::strtoull(argv[i], nullptr, 10);
+		if (block_count == 0 or block_count >= UINT32_MAX) {
+			show_help_and_exit(argv[0]);
+		}
+		block_counts.push_back(block_count);
+	}
+	if (block_counts.empty()) {
+		block_counts = {10000000, 50000000, 100000000};
+	}
+
+	for (auto block_count : block_counts) {
+		run(block_count);
+	}
+
+	return 0;
+}
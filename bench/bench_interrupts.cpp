@@ -0,0 +1,149 @@
+#include <block_reader.h>
+#include <block_writer.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "workload.h"
+
+using namespace reven::block;
+using namespace reven::block::bench;
+
+namespace {
+
+void show_help_and_exit(const char* prog_name) {
+	std::cerr << "Usage:\n";
+	std::cerr << prog_name << " [directory] [block_count] [fault_period]\n\n";
+	std::cerr << "Records a trace where blocks are often interrupted by page faults and hardware interrupts, then\n";
+	std::cerr << "measures the latency of Reader::interrupt_at and Reader::related_instruction_data on every\n";
+	std::cerr << "interrupt, and the time taken by Reader::query_interrupts to read all the interrupts and the page\n";
+	std::cerr << "faults of a tenth of the trace\n";
+	std::cerr << "\t- directory: where to write the database, defaults to the current directory\n";
+	std::cerr << "\t- block_count: number of calls to add_block, defaults to 2000000\n";
+	std::cerr << "\t- fault_period: one block out of fault_period faults, defaults to 4" << std::endl;
+	std::exit(1);
+}
+
+void remove_database(const std::string& filename) {
+	std::remove(filename.c_str());
+	std::remove((filename + "-journal").c_str());
+}
+
+//! Record the workload, interrupting one block out of fault_period on one of its instructions: by a page fault one time
+//! out of four, by a hardware interrupt otherwise
+std::uint64_t record(const std::string& filename, const Workload& workload, std::uint64_t fault_period) {
+	writer::Writer writer(filename.c_str(), "bench_interrupts", "1.0.0", "benchmark",
+	                      writer::WriterOptions::max_throughput());
+	std::uint64_t transition = 0;
+	std::uint64_t faults = 0;
+	for (std::uint64_t i = 0; i < workload.sequence.size(); ++i) {
+		const auto& block = workload.blocks[workload.sequence[i]];
+		const auto& data = workload.data[workload.sequence[i]];
+		const auto instruction_size = data.size() / block.block_instruction_count;
+		writer.add_block(transition, block, Span{data.size(), data.data()});
+
+		// the faulting instruction is executed, but does not complete
+		const bool fault = i % fault_period == 0;
+		const std::uint64_t executed = fault ? i / fault_period % block.block_instruction_count :
+		                                       block.block_instruction_count - 1;
+		for (std::uint64_t instruction = 0; instruction <= executed; ++instruction) {
+			writer.add_block_instruction(block.pc + instruction * instruction_size);
+		}
+		if (not fault) {
+			transition += block.block_instruction_count;
+			continue;
+		}
+
+		writer::Interrupt interrupt;
+		interrupt.pc = block.pc + executed * instruction_size;
+		interrupt.number = faults % 4 == 0 ? 14 : 0x20 + faults % 16;
+		interrupt.is_hw = interrupt.number != 14;
+		interrupt.has_related_instruction = true;
+		writer.add_interrupt(transition + executed, interrupt);
+		transition += executed + 1;
+		++faults;
+	}
+	writer.finalize_execution(transition);
+	writer.close();
+	return faults;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+	if (argc > 4) {
+		show_help_and_exit(argv[0]);
+	}
+
+	std::string directory = ".";
+	std::uint64_t block_count = 2000000;
+	std::uint64_t fault_period = 4;
+	if (argc > 1) {
+		directory = argv[1];
+	}
+	if (argc > 2) {
+		block_count = std::strtoull(argv[2], nullptr, 10);
+	}
+	if (argc > 3) {
+		fault_period = std::strtoull(argv[3], nullptr, 10);
+	}
+	if (block_count == 0 or fault_period == 0) {
+		show_help_and_exit(argv[0]);
+	}
+
+	const auto workload = make_workload(block_count, 4096);
+	const auto filename = directory + "/bench_interrupts.sqlite";
+	remove_database(filename);
+	const auto record_start = std::chrono::steady_clock::now();
+	const auto faults = record(filename, workload, fault_period);
+	const std::chrono::duration<double> record_elapsed = std::chrono::steady_clock::now() - record_start;
+
+	reader::Reader reader(filename.c_str());
+	const auto end_transition_id = reader.refresh();
+
+	std::vector<reader::Interrupt> interrupts;
+	const auto start = std::chrono::steady_clock::now();
+	for (auto transition : reader.query_non_instructions()) {
+		interrupts.push_back(reader.interrupt_at(transition).value());
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::uint64_t bytes = 0;
+	const auto data_start = std::chrono::steady_clock::now();
+	for (const auto& interrupt : interrupts) {
+		bytes += reader.related_instruction_data(interrupt).value().size;
+	}
+	const std::chrono::duration<double> data_elapsed = std::chrono::steady_clock::now() - data_start;
+
+	const auto query_start = std::chrono::steady_clock::now();
+	for (const auto& interrupt : reader.query_interrupts(0, end_transition_id)) {
+		bytes += interrupt.interrupt.pc;
+	}
+	const std::chrono::duration<double> query_elapsed = std::chrono::steady_clock::now() - query_start;
+
+	reader::InterruptFilter page_faults;
+	page_faults.number = 14;
+	std::uint64_t window_faults = 0;
+	const auto window_start = std::chrono::steady_clock::now();
+	for (const auto& interrupt : reader.query_interrupts(end_transition_id / 2, end_transition_id / 2 +
+	                                                     end_transition_id / 10, page_faults)) {
+		bytes += interrupt.interrupt.pc;
+		++window_faults;
+	}
+	const std::chrono::duration<double> window_elapsed = std::chrono::steady_clock::now() - window_start;
+
+	std::cout << "record " << record_elapsed.count() << " s" << std::endl;
+	std::cout << interrupts.size() << " interrupts (" << faults << " recorded): query_non_instructions and interrupt_at "
+	          << elapsed.count() / interrupts.size() * 1e9 << " ns/interrupt, related_instruction_data "
+	          << data_elapsed.count() / interrupts.size() * 1e9 << " ns/interrupt, query_interrupts "
+	          << query_elapsed.count() / interrupts.size() * 1e9 << " ns/interrupt" << std::endl;
+	std::cout << window_faults << " page faults in a tenth of the trace: query_interrupts "
+	          << window_elapsed.count() * 1e3 << " ms (" << bytes % 2 << ")" << std::endl;
+
+	remove_database(filename);
+	return 0;
+}
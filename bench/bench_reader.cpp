@@ -0,0 +1,291 @@
+#include <block_reader.h>
+#include <block_writer.h>
+#include <concurrent_reader.h>
+
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "transition_index.h"
+#include "workload.h"
+
+using namespace reven::block;
+using namespace reven::block::bench;
+
+namespace {
+
+void show_help_and_exit(const char* prog_name) {
+	std::cerr << "Usage:\n";
+	std::cerr << prog_name << " [directory] [block_count] [lookups]\n\n";
+	std::cerr << "Measures the latency of Reader::event_at with and without the in-memory transition index, and the\n";
+	std::cerr << "memory taken by the index, and over a flat trace exported with export_flat_trace, the latency of a\n";
+	std::cerr << "sorted batch resolved with events_at, the time to load the execution index and the latency of\n";
+	std::cerr << "next_execution and prev_execution on the pcs of the instructions, the\n";
+	std::cerr << "throughput of query_instructions over the whole trace, the hit ratio of the cache when replaying\n";
+	std::cerr << "the events with block_with_instructions, with and without query_events_prefetched, then the\n";
+	std::cerr << "throughput of ConcurrentReader::event_at and block with 1 to 32 threads\n";
+	std::cerr << "\t- directory: where to write the databases, defaults to the current directory\n";
+	std::cerr << "\t- block_count: number of calls to add_block, defaults to 10000000\n";
+	std::cerr << "\t- lookups: number of calls to event_at, defaults to 1000000" << std::endl;
+	std::exit(1);
+}
+
+void remove_database(const std::string& filename) {
+	std::remove(filename.c_str());
+	std::remove((filename + "-journal").c_str());
+}
+
+std::uint64_t record(const std::string& filename, const writer::WriterOptions& options, const Workload& workload) {
+	writer::Writer writer(filename.c_str(), "bench_reader", "1.0.0", "benchmark", options);
+	std::uint64_t transition = 0;
+	for (auto index : workload.sequence) {
+		const auto& block = workload.blocks[index];
+		const auto& data = workload.data[index];
+		writer.add_block(transition, block, Span{data.size(), data.data()});
+		const auto instruction_size = data.size() / block.block_instruction_count;
+		for (std::uint64_t i = 1; i < block.block_instruction_count; ++i) {
+			writer.add_block_instruction(block.pc + i * instruction_size);
+		}
+		transition += block.block_instruction_count;
+	}
+	writer.finalize_execution(transition);
+	writer.close();
+	return transition;
+}
+
+//! Build the index of the rows of the execution table outside of a Reader, to measure its memory
+void index_memory(const std::string& filename, std::uint64_t events) {
+	auto db = reven::sqlite::ResourceDatabase::open(filename.c_str(), true);
+	reven::sqlite::Statement stmt(db, "SELECT transition_id, block_id FROM execution ORDER BY transition_id ASC;");
+	detail::TransitionIndex index;
+	while (stmt.step() == reven::sqlite::Statement::StepResult::Row) {
+		index.push(stmt.column_u64(0), stmt.column_i32(1));
+	}
+	index.shrink_to_fit();
+
+	std::cout << "  index: " << index.size() << " rows, " << index.memory_usage() << " bytes, "
+	          << static_cast<double>(index.memory_usage()) / index.size() << " bytes/row, "
+	          << static_cast<double>(index.memory_usage()) / events << " bytes/event" << std::endl;
+}
+
+void lookups(const char* name, const std::string& filename, reader::ReaderOptions options,
+             std::uint64_t transition_count, std::uint64_t lookup_count) {
+	const auto open_start = std::chrono::steady_clock::now();
+	reader::Reader reader(filename.c_str(), options);
+	const std::chrono::duration<double> open_elapsed = std::chrono::steady_clock::now() - open_start;
+
+	std::mt19937_64 rng(42);
+	std::uint64_t sink = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for (std::uint64_t i = 0; i < lookup_count; ++i) {
+		sink += reader.event_at(rng() % transition_count).value().end_transition_id;
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::vector<std::uint64_t> batch;
+	for (std::uint64_t i = 0; i < lookup_count; ++i) {
+		batch.push_back(rng() % transition_count);
+	}
+	std::sort(batch.begin(), batch.end());
+	std::vector<reader::BlockExecutionEvent> events;
+	const auto batch_start = std::chrono::steady_clock::now();
+	reader.events_at(batch.data(), batch.size(), events);
+	const std::chrono::duration<double> batch_elapsed = std::chrono::steady_clock::now() - batch_start;
+
+	// the blocks are cached after the first pass
+	double instructions_per_second[2];
+	for (auto& rate : instructions_per_second) {
+		const auto instructions_start = std::chrono::steady_clock::now();
+		for (const auto& transition : reader.query_instructions(0, transition_count)) {
+			sink += transition.instruction.pc;
+		}
+		const std::chrono::duration<double> instructions_elapsed = std::chrono::steady_clock::now() -
+		                                                           instructions_start;
+		rate = transition_count / instructions_elapsed.count();
+	}
+
+	std::cout << "  " << name << ": open " << open_elapsed.count() << " s, event_at "
+	          << elapsed.count() / lookup_count * 1e9 << " ns/lookup, events_at "
+	          << batch_elapsed.count() / lookup_count * 1e9 << " ns/lookup, query_instructions "
+	          << instructions_per_second[0] << " then " << instructions_per_second[1] << " transitions/s ("
+	          << (sink + events.size()) % 2 << ")" << std::endl;
+}
+
+//! Lookups of the executions of the instructions of the workload, with the execution index loaded at open
+void execution_lookups(const char* name, const std::string& filename, const Workload& workload,
+                       std::uint64_t transition_count, std::uint64_t lookup_count) {
+	reader::ReaderOptions options;
+	options.execution_index = true;
+	const auto open_start = std::chrono::steady_clock::now();
+	reader::Reader reader(filename.c_str(), options);
+	const std::chrono::duration<double> open_elapsed = std::chrono::steady_clock::now() - open_start;
+
+	// the pc of a random instruction of a random block
+	std::mt19937_64 rng(42);
+	auto random_pc = [&]() {
+		const auto index = rng() % workload.blocks.size();
+		const auto& block = workload.blocks[index];
+		const auto instruction_size = workload.data[index].size() / block.block_instruction_count;
+		return block.pc + rng() % block.block_instruction_count * instruction_size;
+	};
+
+	std::uint64_t sink = 0;
+	const auto next_start = std::chrono::steady_clock::now();
+	for (std::uint64_t i = 0; i < lookup_count; ++i) {
+		sink += reader.next_execution(random_pc(), rng() % transition_count).value_or(0);
+	}
+	const std::chrono::duration<double> next_elapsed = std::chrono::steady_clock::now() - next_start;
+
+	const auto prev_start = std::chrono::steady_clock::now();
+	for (std::uint64_t i = 0; i < lookup_count; ++i) {
+		sink += reader.prev_execution(random_pc(), rng() % transition_count).value_or(0);
+	}
+	const std::chrono::duration<double> prev_elapsed = std::chrono::steady_clock::now() - prev_start;
+
+	std::cout << "  " << name << ": open with the execution index " << open_elapsed.count() << " s, next_execution "
+	          << next_elapsed.count() / lookup_count * 1e9 << " ns/lookup, prev_execution "
+	          << prev_elapsed.count() / lookup_count * 1e9 << " ns/lookup (" << sink % 2 << ")" << std::endl;
+}
+
+//! Replay the events of the trace like a consumer of the instructions, reporting the hit ratio of the block cache.
+//!
+//! With a prefetch_window, the events come from query_events_prefetched rather than query_events.
+void replay(const std::string& filename, std::size_t cache_bytes, std::size_t prefetch_window) {
+	reader::ReaderOptions options;
+	options.cache_bytes = cache_bytes;
+	reader::Reader reader(filename.c_str(), options);
+
+	std::uint64_t events = 0;
+	std::uint64_t sink = 0;
+	std::vector<std::uint32_t> instruction_indexes;
+	auto consume = [&](const reader::BlockExecutionEvent& event) {
+		auto instructions = reader.block_with_instructions(event.block_handle, std::move(instruction_indexes));
+		sink += instructions.instruction_count();
+		instruction_indexes = std::move(instructions).take_instruction_indexes();
+		++events;
+	};
+	const auto start = std::chrono::steady_clock::now();
+	if (prefetch_window == 0) {
+		for (const auto& event : reader.query_events()) {
+			consume(event);
+		}
+	} else {
+		for (const auto& event : reader.query_events_prefetched(prefetch_window)) {
+			consume(event);
+		}
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	const auto stats = reader.cache_stats();
+	std::cout << "  replay, cache of " << cache_bytes << " bytes, prefetch window of " << prefetch_window
+	          << " events: " << elapsed.count() / events * 1e9
+	          << " ns/event, blocks hit ratio " << static_cast<double>(stats.hits) / (stats.hits + stats.misses)
+	          << ", offsets hit ratio "
+	          << static_cast<double>(stats.offsets_hits) / (stats.offsets_hits + stats.offsets_misses) << " ("
+	          << sink % 2 << ")" << std::endl;
+}
+
+//! Lookups of an event and its block, spread over thread_count threads sharing a ConcurrentReader
+void concurrent_lookups(const std::string& filename, reader::ReaderOptions options, std::uint64_t transition_count,
+                        std::uint64_t lookup_count, std::size_t thread_count) {
+	reader::ConcurrentReader reader(filename.c_str(), options);
+
+	std::vector<std::uint64_t> sinks(thread_count, 0);
+	std::vector<std::thread> threads;
+	const auto start = std::chrono::steady_clock::now();
+	for (std::size_t t = 0; t < thread_count; ++t) {
+		threads.emplace_back([&, t]() {
+			std::mt19937_64 rng(42 + t);
+			for (std::uint64_t i = 0; i < lookup_count / thread_count; ++i) {
+				const auto event = reader.event_at(rng() % transition_count).value();
+				sinks[t] += event.end_transition_id + reader.block(event.block_handle)->first_pc;
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::uint64_t sink = 0;
+	for (auto value : sinks) {
+		sink += value;
+	}
+	std::cout << "  " << thread_count << " threads: " << lookup_count / elapsed.count() << " lookups/s, "
+	          << reader.connection_count() << " connections (" << sink % 2 << ")" << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+	if (argc > 4) {
+		show_help_and_exit(argv[0]);
+	}
+
+	std::string directory = ".";
+	std::uint64_t block_count = 10000000;
+	std::uint64_t lookup_count = 1000000;
+	if (argc > 1) {
+		directory = argv[1];
+	}
+	if (argc > 2) {
+		block_count = std::strtoull(argv[2], nullptr, 10);
+	}
+	if (argc > 3) {
+		lookup_count = std::strtoull(argv[3], nullptr, 10);
+	}
+	if (block_count == 0 or lookup_count == 0) {
+		show_help_and_exit(argv[0]);
+	}
+
+	const auto workload = make_workload(block_count, 4096);
+	const auto filename = directory + "/bench_reader.sqlite";
+	const auto flat_filename = directory + "/bench_reader.flat";
+
+	for (bool chunked : {false, true}) {
+		auto options = writer::WriterOptions::max_throughput();
+		options.chunked_execution = chunked;
+		remove_database(filename);
+		const auto transition_count = record(filename, options, workload);
+
+		std::cout << (chunked ? "chunked" : "execution table") << ":" << std::endl;
+		if (not chunked) {
+			index_memory(filename, block_count);
+		}
+		lookups("sql", filename, reader::ReaderOptions{}, transition_count, lookup_count);
+		reader::ReaderOptions indexed;
+		indexed.transition_index = true;
+		lookups("index", filename, indexed, transition_count, lookup_count);
+		{
+			const auto export_start = std::chrono::steady_clock::now();
+			reader::Reader(filename.c_str()).export_flat_trace(flat_filename.c_str());
+			const std::chrono::duration<double> export_elapsed = std::chrono::steady_clock::now() - export_start;
+			std::cout << "  export_flat_trace: " << export_elapsed.count() << " s" << std::endl;
+			lookups("flat", flat_filename, reader::ReaderOptions{}, transition_count, lookup_count);
+			execution_lookups("sql", filename, workload, transition_count, lookup_count);
+			execution_lookups("flat", flat_filename, workload, transition_count, lookup_count);
+		}
+		for (std::size_t cache_bytes : {std::size_t(0), std::size_t(256 * 1024)}) {
+			for (std::size_t prefetch_window : {std::size_t(0), std::size_t(64), reader::Reader::DEFAULT_PREFETCH_WINDOW}) {
+				replay(filename, cache_bytes, prefetch_window);
+			}
+		}
+
+		for (const auto& options : {reader::ReaderOptions{}, indexed}) {
+			std::cout << " concurrent, " << (options.transition_index ? "index" : "sql") << ":" << std::endl;
+			for (std::size_t thread_count = 1; thread_count <= 32; thread_count *= 2) {
+				concurrent_lookups(filename, options, transition_count, lookup_count, thread_count);
+			}
+		}
+	}
+	remove_database(filename);
+	std::remove(flat_filename.c_str());
+
+	return 0;
+}
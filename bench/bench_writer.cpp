@@ -0,0 +1,115 @@
+#include <block_writer.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "fingerprint.h"
+#include "workload.h"
+
+using namespace reven::block;
+using namespace reven::block::writer;
+using namespace reven::block::bench;
+
+namespace {
+
+// prevents the fingerprint computations from being optimized out
+volatile std::uint64_t fingerprint_sink;
+
+void show_help_and_exit(const char* prog_name) {
+	std::cerr << "Usage:\n";
+	std::cerr << prog_name << " [block_count] [distinct_blocks]\n\n";
+	std::cerr << "Measures the rate at which blocks can be added to a Writer\n";
+	std::cerr << "\t- block_count: number of calls to add_block, defaults to 10000000\n";
+	std::cerr << "\t- distinct_blocks: number of distinct blocks in the workload, defaults to 4096" << std::endl;
+	std::exit(1);
+}
+
+template <typename F>
+double blocks_per_second(const Workload& workload, F&& fingerprint) {
+	const auto start = std::chrono::steady_clock::now();
+	std::uint64_t sink = 0;
+	for (auto index : workload.sequence) {
+		const auto& data = workload.data[index];
+		sink ^= fingerprint(workload.blocks[index], Span{data.size(), data.data()}).low;
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	fingerprint_sink = sink;
+	return workload.sequence.size() / elapsed.count();
+}
+
+double writer_blocks_per_second(const Workload& workload) {
+	Writer writer(":memory:", "bench_writer", "1.0.0", "benchmark");
+
+	const auto start = std::chrono::steady_clock::now();
+	std::uint64_t transition = 0;
+	for (auto index : workload.sequence) {
+		const auto& data = workload.data[index];
+		writer.add_block(transition, workload.blocks[index], Span{data.size(), data.data()});
+		transition += workload.blocks[index].block_instruction_count;
+	}
+	writer.finalize_execution(transition);
+	std::move(writer).take();
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return workload.sequence.size() / elapsed.count();
+}
+
+double writer_batch_blocks_per_second(const Workload& workload) {
+	constexpr std::size_t BATCH_SIZE = 4096;
+
+	Writer writer(":memory:", "bench_writer", "1.0.0", "benchmark");
+	std::vector<Event> events;
+	events.reserve(BATCH_SIZE);
+
+	const auto start = std::chrono::steady_clock::now();
+	std::uint64_t transition = 0;
+	for (auto index : workload.sequence) {
+		const auto& data = workload.data[index];
+		events.push_back(Event::executed_block(transition, workload.blocks[index], Span{data.size(), data.data()}));
+		transition += workload.blocks[index].block_instruction_count;
+		if (events.size() == BATCH_SIZE) {
+			writer.add_events(events.data(), events.size());
+			events.clear();
+		}
+	}
+	writer.add_events(events.data(), events.size());
+	writer.finalize_execution(transition);
+	std::move(writer).take();
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return workload.sequence.size() / elapsed.count();
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+	if (argc > 3) {
+		show_help_and_exit(argv[0]);
+	}
+
+	std::uint64_t block_count = 10000000;
+	std::uint32_t distinct_blocks = 4096;
+	if (argc > 1) {
+		block_count = std::strtoull(argv[1], nullptr, 10);
+	}
+	if (argc > 2) {
+		distinct_blocks = std::strtoul(argv[2], nullptr, 10);
+	}
+	if (block_count == 0 or distinct_blocks == 0) {
+		show_help_and_exit(argv[0]);
+	}
+
+	const auto workload = make_workload(block_count, distinct_blocks);
+
+	std::cout << "fingerprint sha1:    " << blocks_per_second(workload, detail::sha1_fingerprint) << " blocks/s\n";
+	std::cout << "fingerprint murmur3: " << blocks_per_second(workload, detail::murmur_fingerprint) << " blocks/s\n";
+#ifdef RVNBLOCK_SHA1_FINGERPRINT
+	std::cout << "writer (sha1):       ";
+#else
+	std::cout << "writer (murmur3):    ";
+#endif
+	std::cout << writer_blocks_per_second(workload) << " blocks/s\n";
+	std::cout << "writer add_events:   " << writer_batch_blocks_per_second(workload) << " blocks/s" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include <block_reader.h>
+#include <block_writer.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "workload.h"
+
+using namespace reven::block;
+using namespace reven::block::writer;
+using namespace reven::block::bench;
+
+namespace {
+
+void show_help_and_exit(const char* prog_name) {
+	std::cerr << "Usage:\n";
+	std::cerr << prog_name << " [directory] [block_count]\n\n";
+	std::cerr << "Compares the recording rate of the WriterOptions presets and of the chunked execution table on actual\n";
+	std::cerr << "storage, and the rate of a full scan of the events of the recorded database\n";
+	std::cerr << "\t- directory: where to write the databases, defaults to the current directory\n";
+	std::cerr << "\t- block_count: number of calls to add_block, defaults to 10000000" << std::endl;
+	std::exit(1);
+}
+
+void remove_database(const std::string& filename) {
+	std::remove(filename.c_str());
+	std::remove((filename + "-wal").c_str());
+	std::remove((filename + "-shm").c_str());
+	std::remove((filename + "-journal").c_str());
+}
+
+std::uint64_t file_size(const std::string& filename) {
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	return file ? static_cast<std::uint64_t>(file.tellg()) : 0;
+}
+
+void run(const char* name, const WriterOptions& options, const std::string& directory, const Workload& workload) {
+	const auto filename = directory + "/bench_writer_" + name + ".sqlite";
+	remove_database(filename);
+
+	const auto start = std::chrono::steady_clock::now();
+	{
+		Writer writer(filename.c_str(), "bench_writer_options", "1.0.0", "benchmark", options);
+		std::uint64_t transition = 0;
+		for (auto index : workload.sequence) {
+			const auto& block = workload.blocks[index];
+			const auto& data = workload.data[index];
+			writer.add_block(transition, block, Span{data.size(), data.data()});
+			for (std::uint16_t i = 0; i < block.block_instruction_count; ++i) {
+				writer.add_block_instruction(block.pc + i * (data.size() / block.block_instruction_count));
+			}
+			transition += block.block_instruction_count;
+		}
+		writer.finalize_execution(transition);
+		writer.close();
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	const auto scan_start = std::chrono::steady_clock::now();
+	std::uint64_t events = 0;
+	{
+		reader::Reader reader(filename.c_str());
+		for (const auto& event : reader.query_events()) {
+			static_cast<void>(event);
+			++events;
+		}
+	}
+	const std::chrono::duration<double> scan_elapsed = std::chrono::steady_clock::now() - scan_start;
+
+	std::cout << name << ": " << workload.sequence.size() / elapsed.count() << " blocks/s, "
+	          << elapsed.count() << " s, " << file_size(filename) << " bytes, scan "
+	          << events / scan_elapsed.count() << " events/s" << std::endl;
+	remove_database(filename);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+	if (argc > 3) {
+		show_help_and_exit(argv[0]);
+	}
+
+	std::string directory = ".";
+	std::uint64_t block_count = 10000000;
+	if (argc > 1) {
+		directory = argv[1];
+	}
+	if (argc > 2) {
+		block_count = std::strtoull(argv[2], nullptr, 10);
+	}
+	if (block_count == 0) {
+		show_help_and_exit(argv[0]);
+	}
+
+	const auto workload = make_workload(block_count, 4096);
+
+	run("default", WriterOptions{}, directory, workload);
+	run("max_throughput", WriterOptions::max_throughput(), directory, workload);
+	run("crash_safe", WriterOptions::crash_safe(), directory, workload);
+
+	auto chunked = WriterOptions::max_throughput();
+	chunked.chunked_execution = true;
+	run("max_throughput_chunked", chunked, directory, workload);
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <block_writer.h>
+
+namespace reven {
+namespace block {
+namespace bench {
+
+//! Synthetic recording: a set of distinct blocks, and the sequence in which they are executed
+struct Workload {
+	std::vector<writer::ExecutedBlock> blocks;
+	std::vector<std::vector<std::uint8_t>> data;
+	std::vector<std::uint32_t> sequence;
+};
+
+inline Workload make_workload(std::uint64_t block_count, std::uint32_t distinct_blocks) {
+	std::mt19937_64 rng(42);
+	Workload workload;
+	for (std::uint32_t i = 0; i < distinct_blocks; ++i) {
+		const std::uint16_t instruction_count = 1 + rng() % 16;
+		std::vector<std::uint8_t> data(instruction_count * (1 + rng() % 6));
+		for (auto& byte : data) {
+			byte = rng();
+		}
+		workload.blocks.push_back(writer::ExecutedBlock{0x400000 + i * 64ULL, instruction_count, ExecutionMode::x86_64_bits});
+		workload.data.push_back(std::move(data));
+	}
+
+	// Mostly executing a hot subset, like real code does
+	for (std::uint64_t i = 0; i < block_count; ++i) {
+		const auto hot = rng() % 8 != 0;
+		workload.sequence.push_back(hot ? rng() % std::max(1u, distinct_blocks / 16) : rng() % distinct_blocks);
+	}
+	return workload;
+}
+
+}}} // namespace reven::block::bench
@@ -3,6 +3,7 @@ include(CMakeFindDependencyMacro)
 
 find_dependency(rvnbinresource REQUIRED)
 find_dependency(rvnmetadata REQUIRED)
+find_dependency(Threads REQUIRED)
 
 if(NOT TARGET rvnblock)
 	include("${RVNBLOCK_CMAKE_DIR}/rvnblock-targets.cmake")
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "block_writer.h"
+
+namespace reven {
+namespace block {
+namespace writer {
+
+//! Write the trace of executed blocks like Writer, but perform all the database work on a dedicated thread.
+//!
+//! The reporting methods only copy the event into a bounded lock-free ring. A background thread consumes the ring,
+//! and fingerprints, deduplicates and inserts the blocks in the database exactly like Writer would.
+//!
+//! When the ring is full, the reporting methods block until the background thread catches up.
+//!
+//! Errors that occur on the background thread are rethrown by the next call to any method.
+//!
+//! All methods must be called from the same thread.
+class AsyncWriter {
+public:
+	//! Default size of the ring in bytes
+	static constexpr std::size_t DEFAULT_RING_SIZE = 16 * 1024 * 1024;
+
+	//! Create a new database from the specified filename, tool_name, tool_version and tool_info
+	//!
+	//! - options: commit and durability policy of the database, see WriterOptions
+	//! - ring_size: capacity in bytes of the ring between the reporting thread and the background thread.
+	AsyncWriter(const char* filename, const char* tool_name, const char* tool_version, const char* tool_info,
+	            WriterOptions options = {}, std::size_t ring_size = DEFAULT_RING_SIZE);
+
+	// Rule of five
+	~AsyncWriter();
+	AsyncWriter(const AsyncWriter&) = delete;
+	AsyncWriter(AsyncWriter&&);
+	AsyncWriter& operator=(const AsyncWriter&) = delete;
+	AsyncWriter& operator=(AsyncWriter&&);
+
+	//! See Writer::add_block
+	//!
+	//! instruction_data is copied and does not need to outlive this call.
+	void add_block(std::uint64_t current_transition, ExecutedBlock block, Span instruction_data);
+
+	//! See Writer::add_block_instruction
+	void add_block_instruction(std::uint64_t rip);
+
+	//! See Writer::add_interrupt
+	void add_interrupt(std::uint64_t current_transition, Interrupt interrupt);
+
+	//! See Writer::finalize_execution
+	void finalize_execution(std::uint64_t last_transition_id);
+
+	//! Wait until all the events reported so far have been processed, then commit the running transaction.
+	void flush();
+
+	//! Process all the events reported so far, stop the background thread and close the Writer.
+	//!
+	//! See Writer::close
+	void close();
+
+	//! Process all the events reported so far, stop the background thread and recover the underlying resource
+	//! database.
+	//!
+	//! See Writer::take
+	sqlite::ResourceDatabase take() &&;
+private:
+	struct State;
+	std::unique_ptr<State> state_;
+};
+
+}}} // namespace reven::block::writer
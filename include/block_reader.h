@@ -2,6 +2,11 @@
 
 #include <cstdint>
 #include <experimental/optional>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -12,8 +17,18 @@
 
 namespace reven {
 namespace block {
+
+namespace detail {
+class BlockCache;
+class ExecutionIndex;
+class FlatTrace;
+class TransitionIndex;
+} // namespace detail
+
 namespace reader {
 
+class ConcurrentReader;
+
 //! A block of instructions as stored in the database
 struct InstructionBlock {
 	//! Data of the instructions executed in this block
@@ -38,11 +53,30 @@ struct Instruction {
 //! Provides methods to access the individual instructions of the block.
 class BlockInstructions {
 public:
+	//! The block must outlive this instance
 	BlockInstructions(const InstructionBlock& block, std::vector<std::uint32_t> instruction_indexes) :
-	    block_(&block),
+	    // a pointer to the block that does not own it
+	    block_(std::shared_ptr<const InstructionBlock>(), &block),
 	    instruction_indexes_(std::move(instruction_indexes))
 	{}
 
+	//! Keeps the block alive as long as this instance
+	BlockInstructions(std::shared_ptr<const InstructionBlock> block, std::vector<std::uint32_t> instruction_indexes) :
+	    block_(std::move(block)),
+	    instruction_indexes_(std::move(instruction_indexes))
+	{}
+
+	//! Keeps the block and the shared indexes alive as long as this instance.
+	//!
+	//! spare_indexes is not used by this instance, and is returned by take_instruction_indexes.
+	BlockInstructions(std::shared_ptr<const InstructionBlock> block,
+	                  std::shared_ptr<const std::vector<std::uint32_t>> instruction_indexes,
+	                  std::vector<std::uint32_t> spare_indexes) :
+	    block_(std::move(block)),
+	    shared_indexes_(std::move(instruction_indexes)),
+	    instruction_indexes_(std::move(spare_indexes))
+	{}
+
 	//! The underlying block
 	const InstructionBlock& block() const { return *block_; }
 
@@ -52,14 +86,15 @@ public:
 		if (instruction_index >= instruction_count()) {
 			return {};
 		}
+		const auto& indexes = this->indexes();
 		std::uint32_t begin = 0;
 		if (instruction_index != 0) {
-			begin = instruction_indexes_[instruction_index - 1];
+			begin = indexes[instruction_index - 1];
 		}
 
 		std::uint32_t end = block().instruction_data.size();
-		if (instruction_index < instruction_indexes_.size()) {
-			end = instruction_indexes_[instruction_index];
+		if (instruction_index < indexes.size()) {
+			end = indexes[instruction_index];
 		}
 
 		// If we never executed the entire block, we may mistakenly take bytes from instructions further in this
@@ -76,17 +111,24 @@ public:
 	//!
 	//! This can be different from the InstructionBlock::instruction_count field if the block was never fully executed.
 	std::uint32_t instruction_count() const {
-		return block().instruction_count == 0 ? 0 : instruction_indexes_.size() + 1;
+		return block().instruction_count == 0 ? 0 : indexes().size() + 1;
 	}
 
 	//! Performance helping method that allows to shred this BlockInstructions to recover its underlying vector.
 	//!
 	//! This allows reusing vectors of BlockInstructions rather than allocating new ones for each new instance.
+	//! If the indexes are shared, returns the spare vector that was passed to the constructor.
 	std::vector<std::uint32_t> take_instruction_indexes() && {
 		return std::move(this->instruction_indexes_);
 	}
 private:
-	const InstructionBlock* block_;
+	const std::vector<std::uint32_t>& indexes() const {
+		return shared_indexes_ ? *shared_indexes_ : instruction_indexes_;
+	}
+
+	std::shared_ptr<const InstructionBlock> block_;
+	// The indexes, if they are shared with the cache of a Reader. Otherwise, instruction_indexes_
+	std::shared_ptr<const std::vector<std::uint32_t>> shared_indexes_;
 	std::vector<std::uint32_t> instruction_indexes_;
 };
 
@@ -119,7 +161,6 @@ private:
 
 	BlockHandle(std::int32_t handle) : handle_(handle) {}
 	friend class Reader;
-	friend struct EventQueryState;
 };
 
 //! An event representing a range a transitions where a block was executed.
@@ -167,6 +208,12 @@ public:
 		return handle_.handle() != 0;
 	}
 
+	//! The block of the related instruction, if has_related_instruction: the instruction executed last before the
+	//! interrupt.
+	BlockHandle related_block() const {
+		return handle_;
+	}
+
 private:
 	Interrupt(std::uint64_t pc_, ExecutionMode mode_, std::uint32_t number_, bool is_hw_, BlockHandle handle)
 	: pc(pc_)
@@ -182,22 +229,134 @@ private:
 	friend class Reader;
 };
 
+//! Criteria of the interrupts iterated by Reader::query_interrupts. An unset criterion matches all the interrupts.
+struct InterruptFilter {
+	std::experimental::optional<std::uint32_t> number;
+	std::experimental::optional<bool> is_hw;
+	std::experimental::optional<ExecutionMode> mode;
+};
+
+//! An interrupt and the transition at which it occurs, see Reader::query_interrupts
+struct TransitionInterrupt {
+	std::uint64_t transition_id;
+	Interrupt interrupt;
+};
+
+//! The instruction executed at a transition, see Reader::query_instructions
+struct TransitionInstruction {
+	std::uint64_t transition_id = 0;
+	//! Whether the transition is an instruction. If it is a non-instruction (interrupt, fault, ...), instruction and
+	//! mode are not set.
+	bool is_instruction = false;
+	//! pc and data of the instruction, see BlockInstructions::instruction. Empty if the offsets of the instructions in
+	//! the block were not recorded, see Writer::add_block_instruction.
+	Instruction instruction = Instruction{0, Span{0, nullptr}};
+	//! Mode in which the instruction was executed
+	ExecutionMode mode = ExecutionMode::x86_64_bits;
+};
+
+//! Input iterator over the values of a query, see Reader::EventQuery and Reader::TransitionQuery.
+//!
+//! The query computes its next value with next(), returning false at the end, and exposes it with value().
+template <typename Query, typename Value>
+class QueryIterator {
+public:
+	using iterator_category = std::input_iterator_tag;
+	using value_type = Value;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const Value*;
+	using reference = const Value&;
+
+	QueryIterator() = default;
+	explicit QueryIterator(Query* query) : query_(query) { advance(); }
+
+	const Value& operator*() const { return query_->value(); }
+	const Value* operator->() const { return &query_->value(); }
+
+	QueryIterator& operator++() {
+		advance();
+		return *this;
+	}
+
+	bool operator==(const QueryIterator& o) const { return query_ == o.query_; }
+	bool operator!=(const QueryIterator& o) const { return query_ != o.query_; }
+private:
+	void advance() {
+		if (not query_->next()) {
+			query_ = nullptr;
+		}
+	}
+
+	Query* query_ = nullptr;
+};
+
+//! Counters of the block cache of a Reader, see Reader::cache_stats
+struct BlockCacheStats {
+	//! Requests of a block that was in the cache
+	std::uint64_t hits = 0;
+	//! Requests of a block that was read from the database
+	std::uint64_t misses = 0;
+	//! Blocks removed from the cache to respect ReaderOptions::cache_bytes
+	std::uint64_t evictions = 0;
+	//! Blocks currently in the cache
+	std::uint64_t blocks = 0;
+	//! Approximate memory taken by the blocks currently in the cache
+	std::uint64_t bytes = 0;
+	//! Requests of the instruction offsets of a cached block that were already decoded, see block_with_instructions
+	std::uint64_t offsets_hits = 0;
+	//! Requests of the instruction offsets of a block that were read from the database
+	std::uint64_t offsets_misses = 0;
+};
+
+//! Options of a Reader
+struct ReaderOptions {
+	//! Approximate memory that the block cache may take, in bytes. Beyond it, the least recently used blocks are
+	//! evicted from the cache. 0 for no limit, where blocks remain in the cache until clear_cache is called.
+	std::size_t cache_bytes = 0;
+
+	//! Load an in-memory index of the execution table when the database is opened, so that event_at does not query
+	//! the database. The index takes about 3 bytes per row of the execution table, and is extended by refresh.
+	//!
+	//! Ignored for flat traces, whose events are looked up in place.
+	bool transition_index = false;
+
+	//! Load the in-memory index of the executions of each block when the database is opened, rather than at the first
+	//! call to next_execution, prev_execution or executions_of. The index takes about 4 bytes per execution event,
+	//! and is extended by refresh.
+	bool execution_index = false;
+};
+
 //! Read a file in the format described in [trace-format.md](../trace-format.md) as the trace of executed blocks.
 class Reader {
 public:
-	using EventQuery = sqlite::Query<BlockExecutionEvent, std::function<BlockExecutionEvent(sqlite::Statement&)>>;
+	class EventQuery;
+	class PrefetchedEventQuery;
+	class ReverseEventQuery;
+	class InstructionQuery;
+	class TransitionQuery;
+	class ExecutionQuery;
+	class InterruptQuery;
 
-	using TransitionQuery = sqlite::Query<std::uint64_t, std::function<std::uint64_t(sqlite::Statement&)>>;
-
-	//! Attempt to open the file specified by filename
+	//! Attempt to open the file specified by filename, either a database or a flat trace written by
+	//! export_flat_trace.
+	//!
+	//! A flat trace is mapped in memory: opening it does not read it, and the events and interrupts are looked up in
+	//! place, without a query.
 	//!
 	//! Throws RuntimeError if the file cannot be opened, is not in the correct format or not in the correct version
-	Reader(const char* filename);
+	Reader(const char* filename, ReaderOptions options = {});
 
 	//! Attempt to open the resource database passed as parameter
 	//!
 	//! Throws RuntimeError if the database is not in the correct format or not in the correct version
-	Reader(sqlite::ResourceDatabase db);
+	Reader(sqlite::ResourceDatabase db, ReaderOptions options = {});
+
+	// Rule of five
+	~Reader();
+	Reader(const Reader&) = delete;
+	Reader(Reader&&);
+	Reader& operator=(const Reader&) = delete;
+	Reader& operator=(Reader&&);
 
 	//! Attempt to retrieve a block of instructions from its handle.
 	//!
@@ -205,18 +364,30 @@ public:
 	//!
 	//! The reader uses a block cache, so requesting twice the same block will not read from the database
 	//!
+	//! The reference remains valid until the block leaves the cache: with ReaderOptions::cache_bytes, this may happen
+	//! at the next request of another block. Use pinned_block to keep a block regardless of the cache.
+	//!
 	//! Throws RuntimeError if the block corresponding to the handle is not in the database.
 	//!        This can happen if a handle obtained from a different BlockReader is passed to this function.
 	const InstructionBlock& block(BlockHandle handle) const;
 
+	//! Same as block, but the returned block remains valid as long as it is referenced, even after it leaves the
+	//! cache.
+	std::shared_ptr<const InstructionBlock> pinned_block(BlockHandle handle) const;
+
 	//! Attempt to retrieve a block of instructions with the indexes of instructions from its handle.
 	//!
 	//! The handle can be obtained from the BlockExecutionEvent returned by event_at and query_events.
 	//!
-	//! The reader uses a block cache, so requesting twice the same block will not read from the database
+	//! The reader uses a block cache, so requesting twice the same block will not read from the database. The indexes
+	//! of the instructions are decoded once and cached with the block until the next refresh, and the
+	//! BlockInstructions shares them with the cache: requesting a cached block neither reads from the database nor
+	//! allocates.
+	//!
+	//! The instruction_indexes parameter is an arbitrary vector that is not used, but is moved into the constructed
+	//! BlockInstructions so that take_instruction_indexes can hand it back.
 	//!
-	//! The instruction_indexes parameter is an arbitrary vector whose backing storage will be reused in the constructed
-	//! BlockInstructions. This spares an allocation if the vector already has enough capacity.
+	//! The BlockInstructions keeps its block and indexes alive, like pinned_block.
 	//!
 	//! Throws RuntimeError if the block corresponding to the handle is not in the database.
 	//!        This can happen if a handle obtained from a different BlockReader is passed to this function.
@@ -228,6 +399,20 @@ public:
 	//! Return nullopt if no such event exists, e.g. if the transition_id is greater than transition_count.
 	std::experimental::optional<BlockExecutionEvent> event_at(std::uint64_t transition_id) const;
 
+	//! Obtain the execution events that contain each of the transitions whose ids are specified, like event_at.
+	//!
+	//! The batch is resolved in a single forward pass over the rows of the execution table (or of the transition
+	//! index), from the row that contains the first transition, rather than with a lookup per transition.
+	//!
+	//! - transition_ids, count: the transitions, in increasing order. A transition may appear several times.
+	//! - events: its content is replaced by the event of each transition, in the same order. As the transitions are
+	//!   sorted, the transitions past the end of the trace come last: they have no event, and events is shorter than
+	//!   the batch. Its storage is reused, which spares an allocation if it already has enough capacity.
+	//!
+	//! Throws LogicError if the transitions are not sorted.
+	void events_at(const std::uint64_t* transition_ids, std::size_t count,
+	               std::vector<BlockExecutionEvent>& events) const;
+
 	//! Obtain the Interrupt event that occurs at the transition whose id is specified
 	//!
 	//! Return nullopt if no such event exists, e.g. if the transition is an instruction, or if the transition_id is
@@ -237,10 +422,16 @@ public:
 	//! If there is an instruction related to the interrupt, attempts to obtain its data.
 	//!
 	//! If the data is not available or there is no instruction related to this interrupt, returns a nullopt_t.
+	//!
+	//! The data belongs to the block of the instruction, and remains valid as long as a reference returned by block.
 	std::experimental::optional<Span> related_instruction_data(const Interrupt& interrupt) const;
 
 	//! Iterate on the execution event in the trace
 	//!
+	//! While a Writer is still recording the database, the query can follow the recording: once the iteration
+	//! reaches the last committed event, each new call to begin continues after the last returned event with the
+	//! events committed since.
+	//!
 	//! # Examples
 	//!
 	//! ```cpp
@@ -263,8 +454,67 @@ public:
 	//! ```
 	EventQuery query_events() const;
 
+	//! Default number of events that query_events_prefetched reads ahead
+	static constexpr std::size_t DEFAULT_PREFETCH_WINDOW = 4096;
+
+	//! Iterate on the execution events in the trace like query_events, while a background thread reads ahead.
+	//!
+	//! The background thread opens its own connection to the file, iterates on the events about window events ahead
+	//! of the caller, and loads their blocks and instruction offsets in the block cache. The calls to block,
+	//! pinned_block and block_with_instructions on these events then find them in the cache.
+	//!
+	//! While the query is running, the background thread adds blocks to the cache: with ReaderOptions::cache_bytes,
+	//! a reference returned by block may become invalid at any time, so use pinned_block or block_with_instructions
+	//! instead, and keep the window well below the number of blocks that fit in the cache. refresh must not be called
+	//! while the query is running.
+	//!
+	//! Unlike query_events, the query does not follow a Writer that is still recording the database.
+	//!
+	//! Errors that occur on the background thread are rethrown by the iteration.
+	//!
+	//! Throws LogicError if the Reader was not opened from a file.
+	PrefetchedEventQuery query_events_prefetched(std::size_t window = DEFAULT_PREFETCH_WINDOW) const;
+
+	//! Iterate on the execution events that contain at least one of the transitions in [begin_transition_id,
+	//! end_transition_id), like query_events.
+	//!
+	//! The query seeks directly to the event that contains begin_transition_id, so its cost depends on the length of
+	//! the range rather than on the length of the trace. The first and last events are complete: the first event may
+	//! begin before begin_transition_id, and the last one may end after end_transition_id.
+	EventQuery query_events(std::uint64_t begin_transition_id, std::uint64_t end_transition_id) const;
+
+	//! Iterate backward on the execution events, from the event that contains the specified transition (or from the
+	//! last event if the transition is past the end of the trace) down to the first event of the trace.
+	//!
+	//! The query seeks directly to its first event, and reads the events in batches of a few rows of the execution
+	//! table: stopping the iteration after n events costs about n events.
+	//!
+	//! Unlike query_events, the query does not follow a Writer that is still recording the database.
+	ReverseEventQuery query_events_reverse(std::uint64_t transition_id) const;
+
+	//! Iterate on the transitions in [begin_transition_id, end_transition_id), with the pc, data and mode of the
+	//! instruction executed at each of them.
+	//!
+	//! The query decodes the instruction offsets of each block once, and then yields the instructions of its
+	//! executions without querying the database.
+	//!
+	//! # Examples
+	//!
+	//! ```cpp
+	//! for (const auto& transition : reader.query_instructions(0, 1000)) {
+	//! 	if (transition.is_instruction) {
+	//! 		std::cout << std::dec << transition.transition_id << " rip=0x" << std::hex << transition.instruction.pc
+	//! 		          << " size=" << std::dec << transition.instruction.data.size << "\n";
+	//! 	}
+	//! }
+	//! ```
+	InstructionQuery query_instructions(std::uint64_t begin_transition_id, std::uint64_t end_transition_id) const;
+
 	//! Iterate on the transitions that are not instructions in the trace
 	//!
+	//! Each non-instruction is reported once, at the transition of its interrupt (see query_interrupts to also read
+	//! the interrupts), which is the beginning of its event even if the event spans several transitions.
+	//!
 	//! # Examples
 	//! ```cpp
 	//! for (std::uint64_t transition : reader.query_non_instructions()) {
@@ -273,37 +523,523 @@ public:
 	//! ```
 	TransitionQuery query_non_instructions() const;
 
+	//! Iterate on the interrupts in [begin_transition_id, end_transition_id) that match the filter, in increasing
+	//! transition order.
+	//!
+	//! The interrupts are read from the interrupts table, without going through the events. The databases recorded by
+	//! this version of the Writer have an index on the interrupt numbers, so that filtering on a number only reads
+	//! the interrupts of that number.
+	//!
+	//! # Examples
+	//!
+	//! ```cpp
+	//! // the page faults of the first million transitions
+	//! reader::InterruptFilter page_faults;
+	//! page_faults.number = 14;
+	//! for (const auto& fault : reader.query_interrupts(0, 1000000, page_faults)) {
+	//! 	std::cout << std::dec << fault.transition_id << " rip=0x" << std::hex << fault.interrupt.pc << "\n";
+	//! }
+	//! ```
+	InterruptQuery query_interrupts(std::uint64_t begin_transition_id, std::uint64_t end_transition_id,
+	                                InterruptFilter filter = {}) const;
+
+	//! Retrieve the first transition at or after transition_id at which the instruction at pc is executed, or nullopt
+	//! if there is none.
+	//!
+	//! The instruction is found in all the blocks that contain pc, including the blocks in the middle of which pc is.
+	//! The executions are looked up in an in-memory index of the executions of each block, that is loaded at the first
+	//! call, see ReaderOptions::execution_index. Loading it reads all the events of the trace once.
+	std::experimental::optional<std::uint64_t> next_execution(std::uint64_t pc, std::uint64_t transition_id) const;
+
+	//! Retrieve the last transition before transition_id at which the instruction at pc is executed, or nullopt if
+	//! there is none, like next_execution.
+	std::experimental::optional<std::uint64_t> prev_execution(std::uint64_t pc, std::uint64_t transition_id) const;
+
+	//! Iterate on the transitions in [begin_transition_id, end_transition_id) at which the instruction at pc is
+	//! executed, in increasing order, like next_execution.
+	//!
+	//! # Examples
+	//!
+	//! ```cpp
+	//! for (std::uint64_t transition : reader.executions_of(0xfffff80002a4c2d0)) {
+	//! 	std::cout << std::dec << transition << "\n";
+	//! }
+	//! ```
+	ExecutionQuery executions_of(std::uint64_t pc, std::uint64_t begin_transition_id = 0,
+	                             std::uint64_t end_transition_id = std::numeric_limits<std::uint64_t>::max()) const;
+
+	//! Pick up the events committed by a Writer that is still recording the database since the Reader was opened or
+	//! last refreshed, without reopening the database.
+	//!
+	//! The cached blocks are kept, but their cached instruction offsets are dropped: the Writer adds offsets to a
+	//! committed block when it executes more of its instructions.
+	//!
+	//! The Writer must use a journal mode that allows concurrent readers, such as WriterOptions::live_tail.
+	//!
+	//! Returns the end of the last committed event: event_at finds the events of all the transitions before it.
+	std::uint64_t refresh();
+
 	//! Clear the cache, reclaiming the memory allocated by the cache.
 	//!
-	//! Warning: calling this method removes all block from the cache, invalidating any values returned by block or
-	//! block_with_instructions.
-	void clear_cache() const {
-		cache_ = CacheMap{};
-	}
+	//! Warning: calling this method removes all block from the cache, invalidating any values returned by block.
+	//! The blocks returned by pinned_block or block_with_instructions remain valid.
+	void clear_cache() const;
 
 	//! Retrieve the number of blocks currently contained in the cache.
-	std::size_t cache_size() const {
-		return cache_.size();
-	}
+	std::size_t cache_size() const;
+
+	//! Counters of the block cache since the Reader was opened
+	BlockCacheStats cache_stats() const;
+
+	//! Write the trace as a flat trace, a file that a Reader maps in memory rather than querying it, as described in
+	//! [trace-format.md](../trace-format.md).
+	//!
+	//! The events are written as they would be returned by query_events, and the blocks with their instruction
+	//! offsets. The file is overwritten if it exists.
+	//!
+	//! Throws RuntimeError if the file cannot be written.
+	void export_flat_trace(const char* filename) const;
 
 	static metadata::Version resource_version();
 
 	static metadata::ResourceType resource_type();
 
 private:
-	using CacheMap = std::unordered_map<std::int64_t, InstructionBlock>;
-	using CacheIterator = CacheMap::const_iterator;
+	//! One iteration of a run of the execution table
+	struct ExecutionRun {
+		std::vector<std::int32_t> block_ids;
+		//! End of each execution of the iteration, relative to the beginning of the iteration
+		std::vector<std::uint64_t> ends;
+
+		std::uint64_t length() const {
+			return ends.back();
+		}
 
+		//! The event of the run beginning at run_begin that contains transition_id
+		BlockExecutionEvent event_at(std::uint64_t run_begin, std::uint64_t transition_id) const;
+
+		//! The step of an iteration that contains the transition at offset from the beginning of the iteration
+		std::size_t step_at(std::uint64_t offset) const;
+	};
+
+	//! Sequential cursor over the rows of the execution table, that decodes the chunks of chunked databases.
+	class ExecutionRows {
+	public:
+		//! - stmt: selects either the transition_id and block_id columns of the execution table, or the id and data
+		//!   columns of the execution_chunks table in order if chunked.
+		//! - transition_id, chunk_id: if chunked, the transition at which the first selected chunk begins, and the id
+		//!   of the chunk before it, if any.
+		ExecutionRows(sqlite::Statement stmt, bool chunked, std::uint64_t transition_id = 0, std::int64_t chunk_id = 0) :
+		    stmt_(new sqlite::Statement(std::move(stmt))), chunked_(chunked), transition_id_(transition_id),
+		    chunk_id_(chunk_id) {}
+
+		//! The events of a flat trace, from the event at index
+		ExecutionRows(const detail::FlatTrace& flat, std::uint64_t index) :
+		    chunked_(false), flat_(&flat), flat_index_(index) {}
+
+		//! Read the next row, returning false at the end of the table.
+		bool next(std::uint64_t& transition_id, std::int32_t& block_id);
+
+		//! If chunked, the id of the last chunk that was read, 0 if none
+		std::int64_t chunk_id() const { return chunk_id_; }
+	private:
+		// Only for databases
+		std::unique_ptr<sqlite::Statement> stmt_;
+		bool chunked_;
+		// Rows of the current chunk that remain to be decoded, and end of the last decoded row
+		const std::uint8_t* chunk_ = nullptr;
+		const std::uint8_t* chunk_end_ = nullptr;
+		std::uint64_t transition_id_ = 0;
+		std::int64_t chunk_id_ = 0;
+		// Only for flat traces: the index of the next event
+		const detail::FlatTrace* flat_ = nullptr;
+		std::uint64_t flat_index_ = 0;
+	};
+
+	//! Open db with the specified cache, and with the specified transition index and execution index if not null: the
+	//! Readers of a ConcurrentReader share them.
+	Reader(sqlite::ResourceDatabase db, ReaderOptions options, std::shared_ptr<detail::BlockCache> cache,
+	       std::shared_ptr<detail::TransitionIndex> transition_index,
+	       std::shared_ptr<detail::ExecutionIndex> execution_index);
+
+	//! Read a flat trace with the specified cache, and with the specified execution index if not null
+	Reader(std::shared_ptr<const detail::FlatTrace> flat, ReaderOptions options,
+	       std::shared_ptr<detail::BlockCache> cache, std::shared_ptr<detail::ExecutionIndex> execution_index);
+
+	//! Open the file, either a database or a flat trace, with the specified cache and indices like above
+	static Reader open(const char* filename, ReaderOptions options, std::shared_ptr<detail::BlockCache> cache,
+	                   std::shared_ptr<detail::TransitionIndex> transition_index,
+	                   std::shared_ptr<detail::ExecutionIndex> execution_index);
+
+	//! Cursor over the rows of the execution table in reverse order, from the row that contains a transition.
+	//!
+	//! The rows are read in batches in order: a sample of the transition index, a chunk, or a series of rows of the
+	//! execution table, whose rows are then returned backward.
+	class ReverseExecutionRows {
+	public:
+		ReverseExecutionRows(const Reader& reader, std::uint64_t transition_id);
+
+		//! Read the previous row, returning false before the first row of the table.
+		bool previous(std::uint64_t& begin_transition_id, std::uint64_t& end_transition_id, std::int32_t& block_id);
+	private:
+		//! Replace the batch with the rows of the previous sample or chunk, returning false before the first one.
+		bool load_previous_batch();
+		//! Read the next row of stmt_ ahead
+		void read_ahead();
+
+		const Reader* reader_;
+		std::uint64_t transition_id_;
+		// Only for execution tables without transition index: the rows in reverse order, and the next row read ahead
+		std::unique_ptr<sqlite::Statement> stmt_;
+		bool has_next_ = false;
+		std::uint64_t next_end_transition_id_ = 0;
+		std::int32_t next_block_id_ = 0;
+		// Otherwise: the samples or chunks [0, batch_) remain to be loaded, or the events [0, batch_) of a flat trace
+		// remain to be returned. The transition at which the loaded one
+		// begins, and the end and block of its rows that remain to be returned
+		std::size_t batch_ = 0;
+		std::uint64_t batch_begin_transition_id_ = 0;
+		std::vector<std::uint64_t> ends_;
+		std::vector<std::int32_t> block_ids_;
+	};
+
+	//! An instruction of a block, at the address passed to next_execution
+	struct PcInstruction {
+		std::int32_t block_id;
+		std::uint32_t instruction_index;
+	};
+
+	//! Replace the content of instructions with the instructions at pc in all the blocks, loading the execution index
+	//! if it is not loaded yet
+	void pc_instructions(std::uint64_t pc, std::vector<PcInstruction>& instructions) const;
+	std::experimental::optional<std::uint64_t> next_execution(const std::vector<PcInstruction>& instructions,
+	                                                          std::uint64_t transition_id) const;
+	//! Add the events that are not in the execution index yet
+	void load_execution_index() const;
+	//! Pick up the rows committed since the Reader was opened or last refreshed, see refresh
+	std::uint64_t refresh_rows();
+
+	//! Throws RuntimeError if the first block of the trace is not the interrupt block
+	void check_interrupt_block() const;
 	InstructionBlock fetch_from_db(BlockHandle handle) const;
+	//! The block from the cache, fetching it from the database if it is not cached
+	std::shared_ptr<const InstructionBlock> cached_block(BlockHandle handle) const;
+	//! The instruction offsets of a block from the cache, reading them from the database if they are not cached
+	std::shared_ptr<const std::vector<std::uint32_t>> cached_instruction_indexes(BlockHandle handle,
+	                                                                             const InstructionBlock& block) const;
+	//! Read the instruction offsets of a block from the database into instruction_indexes, replacing its content
+	void read_instruction_indexes(BlockHandle handle, std::vector<std::uint32_t>& instruction_indexes) const;
+	//! Attempt to retrieve a run from the id stored in the execution table (-block_id)
+	const ExecutionRun& execution_run(std::int64_t run_id) const;
+	//! The event that contains transition_id, in a row of the execution table
+	BlockExecutionEvent row_event_at(std::uint64_t begin_transition_id, std::uint64_t end_transition_id,
+	                                 std::int32_t block_id, std::uint64_t transition_id) const;
+	std::experimental::optional<BlockExecutionEvent> chunked_event_at(std::uint64_t transition_id) const;
+	ExecutionRows execution_rows() const;
+	//! The rows of the execution table from the row that contains transition_id, or from a row before it.
+	//!
+	//! - begin_transition_id: set to the transition at which the first selected row begins.
+	ExecutionRows execution_rows_from(std::uint64_t transition_id, std::uint64_t& begin_transition_id) const;
+	//! The rows of the execution table after the ones already read by rows, which reached the end of the table.
+	//!
+	//! - transition_id: end of the last row read by rows.
+	ExecutionRows execution_rows_after(const ExecutionRows& rows, std::uint64_t transition_id) const;
+	//! Load the entries of the chunk index that begin at or after the specified transition
+	void load_chunk_index(std::uint64_t begin_transition_id);
+	//! Add the rows that are not in the transition index yet
+	void load_transition_index();
+	//! End the read transaction of the database, which keeps the Reader on the state of the database when it began,
+	//! by resetting all the statements that may be pending
+	void end_read_transaction() const;
+
+	// Only for databases
+	mutable std::unique_ptr<sqlite::ResourceDatabase> db_;
+	// Only for flat traces
+	std::shared_ptr<const detail::FlatTrace> flat_;
+	// Only if the Reader was opened from a file
+	std::string filename_;
+	// Whether the instruction offsets are stored in the blocks table, rather than in the instruction_indices table
+	bool packed_instruction_offsets_ = true;
+	std::shared_ptr<detail::BlockCache> cache_;
+
+	// Only for databases
+	mutable std::unique_ptr<sqlite::Statement> stmt_after_;
+	mutable std::unique_ptr<sqlite::Statement> stmt_before_;
+	mutable std::unique_ptr<sqlite::Statement> stmt_block_;
+	mutable std::unique_ptr<sqlite::Statement> stmt_block_inst_;
+	mutable std::unique_ptr<sqlite::Statement> stmt_interrupt_at_;
+
+	// Only for databases with an execution_runs table
+	mutable std::unique_ptr<sqlite::Statement> stmt_run_;
+	mutable std::unordered_map<std::int64_t, ExecutionRun> runs_;
+
+	// Only for chunked databases: the chunk index, as the transition at which each chunk begins, and its id
+	bool chunked_ = false;
+	std::vector<std::uint64_t> chunk_begins_;
+	std::vector<std::int64_t> chunk_ids_;
+	mutable std::unique_ptr<sqlite::Statement> stmt_chunk_;
+
+	// Only with ReaderOptions::transition_index: the index, and the rows it was loaded from
+	std::shared_ptr<detail::TransitionIndex> transition_index_;
+	std::unique_ptr<ExecutionRows> index_rows_;
+
+	// Only once loaded, see ReaderOptions::execution_index
+	mutable std::shared_ptr<detail::ExecutionIndex> execution_index_;
+
+	friend class ConcurrentReader;
+};
+
+//! Range of the execution events of a trace, see Reader::query_events.
+//!
+//! The iterators are input iterators: the range can only be iterated once.
+class Reader::EventQuery {
+public:
+	using Iterator = QueryIterator<EventQuery, BlockExecutionEvent>;
+
+	//! Continues after the last event returned by the previous iterations, if any.
+	Iterator begin() {
+		if (finished_) {
+			resume();
+		}
+		return Iterator(this);
+	}
+	Iterator end() { return Iterator(); }
+private:
+	//! - rows: the rows of the execution table from a row that begins at previous_transition_id.
+	//! - begin_transition_id, end_transition_id: range of transitions whose events are returned.
+	EventQuery(const Reader& reader, ExecutionRows rows, std::uint64_t previous_transition_id = 0,
+	           std::uint64_t begin_transition_id = 0,
+	           std::uint64_t end_transition_id = std::numeric_limits<std::uint64_t>::max()) :
+	    reader_(&reader), rows_(std::move(rows)), previous_transition_id_(previous_transition_id),
+	    begin_transition_id_(begin_transition_id), end_transition_id_(end_transition_id) {}
+
+	bool next();
+	const BlockExecutionEvent& value() const { return event_; }
+	//! Select the rows committed since the end of the query was reached
+	void resume();
+
+	const Reader* reader_;
+	ExecutionRows rows_;
+	// Whether rows_ reached the end of the execution table
+	bool finished_ = false;
+	BlockExecutionEvent event_{0, 0, BlockHandle::interrupt_block_handle()};
+	std::uint64_t previous_transition_id_ = 0;
+	std::uint64_t begin_transition_id_;
+	std::uint64_t end_transition_id_;
+
+	// Run being expanded: its events up to run_end_, starting with the step run_step_ at run_cursor_
+	const ExecutionRun* run_ = nullptr;
+	std::uint64_t run_end_ = 0;
+	std::uint64_t run_cursor_ = 0;
+	std::size_t run_step_ = 0;
+
+	friend class Reader;
+	friend class InstructionQuery;
+	friend Iterator;
+};
+
+//! Range of the execution events of a trace read ahead by a background thread, see Reader::query_events_prefetched.
+//!
+//! The iterators are input iterators: the range can only be iterated once.
+class Reader::PrefetchedEventQuery {
+public:
+	using Iterator = QueryIterator<PrefetchedEventQuery, BlockExecutionEvent>;
+
+	// Rule of five
+	~PrefetchedEventQuery();
+	PrefetchedEventQuery(const PrefetchedEventQuery&) = delete;
+	PrefetchedEventQuery(PrefetchedEventQuery&&);
+	PrefetchedEventQuery& operator=(const PrefetchedEventQuery&) = delete;
+	PrefetchedEventQuery& operator=(PrefetchedEventQuery&&);
+
+	Iterator begin() { return Iterator(this); }
+	Iterator end() { return Iterator(); }
+private:
+	PrefetchedEventQuery(const Reader& reader, std::size_t window);
+
+	bool next();
+	const BlockExecutionEvent& value() const { return event_; }
+
+	struct State;
+	std::unique_ptr<State> state_;
+	BlockExecutionEvent event_{0, 0, BlockHandle::interrupt_block_handle()};
+
+	friend class Reader;
+	friend Iterator;
+};
+
+//! Range of the execution events of a trace in reverse order, see Reader::query_events_reverse.
+//!
+//! The iterators are input iterators: the range can only be iterated once.
+class Reader::ReverseEventQuery {
+public:
+	using Iterator = QueryIterator<ReverseEventQuery, BlockExecutionEvent>;
+
+	Iterator begin() { return Iterator(this); }
+	Iterator end() { return Iterator(); }
+private:
+	ReverseEventQuery(const Reader& reader, std::uint64_t transition_id) :
+	    reader_(&reader), rows_(reader, transition_id), transition_id_(transition_id) {}
+
+	bool next();
+	const BlockExecutionEvent& value() const { return event_; }
+
+	const Reader* reader_;
+	ReverseExecutionRows rows_;
+	// The transition the query starts from, until the first row is read
+	std::uint64_t transition_id_;
+	bool first_row_ = true;
+	BlockExecutionEvent event_{0, 0, BlockHandle::interrupt_block_handle()};
+
+	// Run being expanded backward: its events from run_begin_ up to run_cursor_
+	const ExecutionRun* run_ = nullptr;
+	std::uint64_t run_begin_ = 0;
+	std::uint64_t run_cursor_ = 0;
+
+	friend class Reader;
+	friend Iterator;
+};
 
-	mutable sqlite::ResourceDatabase db_;
-	mutable CacheMap cache_;
+//! Range of the instructions executed at each transition of a trace, see Reader::query_instructions.
+//!
+//! The data of an instruction remains valid until the iterator is incremented.
+//!
+//! The iterators are input iterators: the range can only be iterated once.
+class Reader::InstructionQuery {
+public:
+	using Iterator = QueryIterator<InstructionQuery, TransitionInstruction>;
+
+	Iterator begin() { return Iterator(this); }
+	Iterator end() { return Iterator(); }
+private:
+	InstructionQuery(const Reader& reader, EventQuery events, std::uint64_t begin_transition_id,
+	                 std::uint64_t end_transition_id) :
+	    reader_(&reader), events_(std::move(events)),
+	    begin_transition_id_(begin_transition_id), end_transition_id_(end_transition_id) {}
+
+	bool next() {
+		if (transition_id_ == event_end_transition_id_ and not next_event()) {
+			return false;
+		}
 
-	mutable sqlite::Statement stmt_after_;
-	mutable sqlite::Statement stmt_before_;
-	mutable sqlite::Statement stmt_block_;
-	mutable sqlite::Statement stmt_block_inst_;
-	mutable sqlite::Statement stmt_interrupt_at_;
+		value_.transition_id = transition_id_;
+		if (instructions_ != nullptr) {
+			value_.instruction = instructions_->instruction(transition_id_ - event_begin_transition_id_)
+			                     .value_or(Instruction{0, Span{0, nullptr}});
+		}
+		++transition_id_;
+		return true;
+	}
+	//! Move to the next event that contains transitions of the range, returning false at the end of the range
+	bool next_event();
+	const TransitionInstruction& value() const { return value_; }
+
+	const Reader* reader_;
+	EventQuery events_;
+	std::uint64_t begin_transition_id_;
+	std::uint64_t end_transition_id_;
+	TransitionInstruction value_;
+
+	// Current event: its transitions in the range up to event_end_transition_id_, starting with transition_id_, and
+	// the instructions of its block, or nullptr if it is not a block of instructions
+	std::uint64_t event_begin_transition_id_ = 0;
+	std::uint64_t event_end_transition_id_ = 0;
+	std::uint64_t transition_id_ = 0;
+	const BlockInstructions* instructions_ = nullptr;
+
+	// The blocks of the last events, with their decoded instruction offsets, most recently used first
+	using Blocks = std::list<std::pair<std::int32_t, BlockInstructions>>;
+	Blocks blocks_;
+	std::unordered_map<std::int32_t, Blocks::iterator> block_index_;
+
+	friend class Reader;
+	friend Iterator;
+};
+
+//! Range of the interrupts of a trace, see Reader::query_interrupts.
+//!
+//! The iterators are input iterators: the range can only be iterated once.
+class Reader::InterruptQuery {
+public:
+	using Iterator = QueryIterator<InterruptQuery, TransitionInterrupt>;
+
+	Iterator begin() { return Iterator(this); }
+	Iterator end() { return Iterator(); }
+private:
+	//! stmt selects the columns of the interrupts table in order, see Reader::query_interrupts
+	explicit InterruptQuery(sqlite::Statement stmt) : stmt_(new sqlite::Statement(std::move(stmt))) {}
+
+	//! The interrupts of a flat trace in [index, end_index) that match the filter
+	InterruptQuery(const detail::FlatTrace& flat, std::uint64_t index, std::uint64_t end_index,
+	               InterruptFilter filter) :
+	    flat_(&flat), flat_index_(index), flat_end_(end_index), filter_(std::move(filter)) {}
+
+	bool next();
+	const TransitionInterrupt& value() const { return *value_; }
+
+	// Only for databases
+	std::unique_ptr<sqlite::Statement> stmt_;
+	// Only for flat traces: the index of the next interrupt, and the filter that is applied while iterating
+	const detail::FlatTrace* flat_ = nullptr;
+	std::uint64_t flat_index_ = 0;
+	std::uint64_t flat_end_ = 0;
+	InterruptFilter filter_;
+
+	std::experimental::optional<TransitionInterrupt> value_;
+
+	friend class Reader;
+	friend Iterator;
+};
+
+//! Range of the transitions of a trace that are not instructions, see Reader::query_non_instructions.
+//!
+//! The iterators are input iterators: the range can only be iterated once.
+class Reader::TransitionQuery {
+public:
+	using Iterator = QueryIterator<TransitionQuery, std::uint64_t>;
+
+	Iterator begin() { return Iterator(this); }
+	Iterator end() { return Iterator(); }
+private:
+	explicit TransitionQuery(InterruptQuery interrupts) : interrupts_(std::move(interrupts)) {}
+
+	bool next();
+	const std::uint64_t& value() const { return transition_id_; }
+
+	InterruptQuery interrupts_;
+	std::uint64_t transition_id_ = 0;
+
+	friend class Reader;
+	friend Iterator;
+};
+
+//! Range of the transitions at which an instruction is executed, see Reader::executions_of.
+//!
+//! The iterators are input iterators: the range can only be iterated once.
+class Reader::ExecutionQuery {
+public:
+	using Iterator = QueryIterator<ExecutionQuery, std::uint64_t>;
+
+	Iterator begin() { return Iterator(this); }
+	Iterator end() { return Iterator(); }
+private:
+	ExecutionQuery(const Reader& reader, std::vector<PcInstruction> instructions, std::uint64_t begin_transition_id,
+	               std::uint64_t end_transition_id) :
+	    reader_(&reader), instructions_(std::move(instructions)), next_transition_id_(begin_transition_id),
+	    end_transition_id_(end_transition_id) {}
+
+	bool next();
+	const std::uint64_t& value() const { return transition_id_; }
+
+	const Reader* reader_;
+	std::vector<PcInstruction> instructions_;
+	// The transition from which the next execution is looked up
+	std::uint64_t next_transition_id_;
+	std::uint64_t end_transition_id_;
+	std::uint64_t transition_id_ = 0;
+
+	friend class Reader;
+	friend Iterator;
 };
 
 }}} // namespace reven::block::reader
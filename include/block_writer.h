@@ -1,9 +1,13 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
 #include <vector>
 #include <unordered_map>
-#include <experimental/string_view>
 
 #include "common.h"
 
@@ -11,6 +15,29 @@
 
 namespace reven {
 namespace block {
+
+namespace detail {
+
+class BatchInsert;
+class BlockTable;
+struct KnownBlock;
+class KnownBlockData;
+class ExecutionChunkEncoder;
+class RunCompressor;
+class WriterStatsRecorder;
+
+//! 128-bit fingerprint of a block and its instruction data, used as a fixed-size deduplication key.
+struct Fingerprint {
+	std::uint64_t low;
+	std::uint64_t high;
+
+	bool operator==(const Fingerprint& o) const {
+		return low == o.low and high == o.high;
+	}
+};
+
+} // namespace detail
+
 namespace writer {
 
 //! Indicates which block was executed, as defined by its pc, instruction count and mode
@@ -51,19 +78,243 @@ struct Interrupt {
 	bool has_related_instruction = false;
 };
 
+//! A single event reported to Writer::add_events.
+//!
+//! Only the fields corresponding to the type of the event are meaningful.
+struct Event {
+	enum class Type : std::uint8_t {
+		//! See Writer::add_block
+		Block,
+		//! See Writer::add_block_instruction
+		BlockInstruction,
+		//! See Writer::add_interrupt
+		Interrupt,
+	};
+
+	Type type;
+	//! Block, Interrupt: id of the transition of the event
+	std::uint64_t current_transition;
+	//! BlockInstruction: address of the executed instruction
+	std::uint64_t rip;
+	//! Block: executed block
+	ExecutedBlock block;
+	//! Block: data of the executed block
+	Span instruction_data;
+	//! Interrupt: executed non-instruction
+	Interrupt interrupt;
+
+	static Event executed_block(std::uint64_t current_transition, ExecutedBlock block, Span instruction_data) {
+		Event event{};
+		event.type = Type::Block;
+		event.current_transition = current_transition;
+		event.block = block;
+		event.instruction_data = instruction_data;
+		return event;
+	}
+
+	static Event executed_instruction(std::uint64_t rip) {
+		Event event{};
+		event.type = Type::BlockInstruction;
+		event.rip = rip;
+		return event;
+	}
+
+	static Event executed_interrupt(std::uint64_t current_transition, Interrupt interrupt) {
+		Event event{};
+		event.type = Type::Interrupt;
+		event.current_transition = current_transition;
+		event.interrupt = interrupt;
+		return event;
+	}
+};
+
+//! Distribution of the durations of an operation.
+struct LatencyHistogram {
+	//! buckets[i] counts the durations of [2^i, 2^(i+1)) nanoseconds. buckets[0] also counts the durations under a
+	//! nanosecond, and the last bucket all the durations above.
+	std::array<std::uint64_t, 40> buckets{};
+	//! Number of measured operations
+	std::uint64_t count = 0;
+	std::uint64_t total_ns = 0;
+	std::uint64_t max_ns = 0;
+
+	void add(std::uint64_t duration_ns);
+
+	//! Upper bound of the durations of the specified fraction (between 0 and 1) of the operations, in nanoseconds,
+	//! at the precision of the buckets. 0 if there is no measured operation.
+	std::uint64_t percentile(double fraction) const;
+};
+
+//! Counters of the work done by a Writer, see Writer::stats.
+//!
+//! They are only recorded if the library is built with RVNBLOCK_WRITER_STATS. Otherwise, the instrumentation is
+//! compiled out and all the values stay 0.
+struct WriterStats {
+	//! Whether the library records the stats
+	bool enabled = false;
+
+	//! Blocks reported to add_block or add_events
+	std::uint64_t blocks_added = 0;
+	//! Instructions reported to add_block_instruction or add_events
+	std::uint64_t instructions_added = 0;
+	//! Non-instructions reported to add_interrupt or add_events
+	std::uint64_t interrupts = 0;
+
+	//! Executed blocks that were already known
+	std::uint64_t dedup_hits = 0;
+	//! Executed blocks that were inserted in the blocks table
+	std::uint64_t dedup_misses = 0;
+	//! Updates of the instruction offsets of a known block, after it executed more instructions than before
+	std::uint64_t instruction_offsets_updates = 0;
+
+	//! Executions of blocks and non-instructions stored in the trace
+	std::uint64_t executions = 0;
+	//! Rows of the execution table, including the rows of runs. With WriterOptions::loop_compression, the executions
+	//! that are not stored as rows yet are pending in a possible run.
+	std::uint64_t execution_rows = 0;
+	//! Executions that are stored as part of a run, see WriterOptions::loop_compression.
+	std::uint64_t collapsed_executions() const {
+		return executions - execution_rows;
+	}
+
+	std::uint64_t commits = 0;
+
+	//! Duration of the processing of a block by add_block, add_interrupt or add_events
+	LatencyHistogram add_block_latency;
+	//! Duration of the commits, including the flush of the pending batches
+	LatencyHistogram commit_latency;
+};
+
+//! Human-readable summary of the stats, on a single line
+std::ostream& operator<<(std::ostream& os, const WriterStats& stats);
+
+//! Journal mode of the database, see sqlite's `PRAGMA journal_mode`
+enum class JournalMode : std::uint8_t {
+	Delete,
+	Truncate,
+	Persist,
+	Memory,
+	Wal,
+	Off,
+};
+
+//! Synchronization of the database with the storage, see sqlite's `PRAGMA synchronous`
+enum class Synchronous : std::uint8_t {
+	Off,
+	Normal,
+	Full,
+};
+
+//! Commit and durability policy of a Writer.
+//!
+//! The running transaction is committed as soon as any of the enabled thresholds is reached.
+//! The default values reproduce the historical behavior of the Writer.
+struct WriterOptions {
+	//! Commit after this number of inserted rows. 0 disables this threshold.
+	std::uint64_t commit_rows = 10000;
+	//! Commit after approximately this number of inserted bytes. 0 disables this threshold.
+	std::uint64_t commit_bytes = 0;
+	//! Commit once the transaction has been running for this duration. 0 disables this threshold.
+	//!
+	//! The duration is only checked when rows are inserted, every few hundred rows.
+	std::chrono::milliseconds commit_interval{0};
+
+	JournalMode journal_mode = JournalMode::Memory;
+	Synchronous synchronous = Synchronous::Off;
+	//! Size of the pages of the database in bytes, a power of two between 512 and 65536. 0 keeps sqlite's default.
+	std::uint32_t page_size = 0;
+	//! Size of the page cache in KiB. 0 keeps sqlite's default.
+	std::uint64_t cache_size_kib = 0;
+
+	//! Store the repeating cycles of up to 8 blocks, such as tight loops, as runs in the execution_runs table,
+	//! rather than as one execution row per executed block.
+	//!
+	//! The rows of a cycle are only stored in the database once the cycle ends, after at most 65536 executions, or
+	//! when the Writer is closed (see Writer::close). Until then, a commit does not make them visible to a Reader.
+	bool loop_compression = false;
+
+	//! Store the rows of the execution table as compressed chunks of up to 1024 rows in the execution_chunks table,
+	//! rather than as one row each in the execution table.
+	//!
+	//! The rows of a chunk are only stored in the database once the chunk is full, or when the Writer is closed (see
+	//! Writer::close).
+	bool chunked_execution = false;
+
+	//! Memory budget, in bytes, of the copies of the known blocks, which confirm that a block whose fingerprint
+	//! matches a known block is indeed the same block. A known block without a copy is read back from the database
+	//! instead, which is much slower. Each copy takes the size of the instruction data of the block plus about 80
+	//! bytes, so the default budget keeps the copies of about 500000 blocks of 50 bytes.
+	std::uint64_t known_block_bytes = 64 * 1024 * 1024;
+
+	//! Report the stats of the Writer to stats_callback at most once per interval. 0 disables the reports.
+	//!
+	//! The duration is only checked when rows are inserted, every few hundred rows. There is no report if the
+	//! library is built without RVNBLOCK_WRITER_STATS, see WriterStats.
+	std::chrono::milliseconds stats_interval{0};
+	//! Receives the periodic reports of the stats. If empty, they are written to std::clog.
+	std::function<void(const WriterStats&)> stats_callback;
+
+	//! Fastest recording on local storage: huge transactions bounded by volume, large pages and cache, no
+	//! synchronization. A crash during the recording loses the database.
+	static WriterOptions max_throughput() {
+		WriterOptions options;
+		options.commit_rows = 0;
+		options.commit_bytes = 256 * 1024 * 1024;
+		options.journal_mode = JournalMode::Memory;
+		options.synchronous = Synchronous::Off;
+		options.page_size = 65536;
+		options.cache_size_kib = 256 * 1024;
+		return options;
+	}
+
+	//! Recording that survives a crash of the process or of the system: write-ahead log, with commits at least every
+	//! second so that at most the last second of the recording is lost.
+	static WriterOptions crash_safe() {
+		WriterOptions options;
+		options.commit_rows = 100000;
+		options.commit_bytes = 0;
+		options.commit_interval = std::chrono::milliseconds(1000);
+		options.journal_mode = JournalMode::Wal;
+		options.synchronous = Synchronous::Normal;
+		options.page_size = 4096;
+		options.cache_size_kib = 64 * 1024;
+		// the rows of a cycle would only be stored once it ends
+		options.loop_compression = false;
+		return options;
+	}
+
+	//! Recording that a Reader can follow while it is running, see Reader::refresh: write-ahead log so that the Reader
+	//! does not block the Writer, with commits at least every 100 milliseconds while rows are inserted.
+	//!
+	//! The rows that are only stored once the recording is done, or once a cycle or a chunk ends, are disabled so
+	//! that every event becomes visible after the next commit. The last reported block still only becomes visible
+	//! after the next call to add_block.
+	static WriterOptions live_tail() {
+		WriterOptions options = crash_safe();
+		options.commit_interval = std::chrono::milliseconds(100);
+		options.chunked_execution = false;
+		return options;
+	}
+};
+
 //! Write the trace of executed blocks as a versioned database in the format described in
 //!   [trace-format.md](../trace-format.md).
 class Writer {
 public:
 	//! Create a new database from the specified filename, tool_name, tool_version and tool_info
-	Writer(const char* filename, const char* tool_name, const char* tool_version, const char* tool_info);
+	//!
+	//! - options: commit and durability policy of the database, see WriterOptions
+	Writer(const char* filename, const char* tool_name, const char* tool_version, const char* tool_info,
+	       WriterOptions options = {});
 
 	// Rule of five
+	//! Closes the Writer if close was not called (see close), but never throws: errors are written to std::clog, and
+	//! the rows that could not be stored are lost.
 	~Writer();
 	Writer(const Writer&) = delete;
-	Writer(Writer&&) = default;
+	Writer(Writer&&);
 	Writer& operator=(const Writer&) = delete;
-	Writer& operator=(Writer&&) = default;
+	Writer& operator=(Writer&&);
 
 	//! Report the execution of a block to the database
 	//!
@@ -72,6 +323,12 @@ public:
 	//! - instruction_data: data of the executed block
 	void add_block(std::uint64_t current_transition, ExecutedBlock block, Span instruction_data);
 
+	//! Same as add_block, but the caller guarantees that instruction_data remains valid and unchanged until the next
+	//! call to a method of this Writer returns, so that the Writer does not need to copy it.
+	//!
+	//! For instance, a caller reusing its buffers can alternate between two of them.
+	void add_block_borrowed(std::uint64_t current_transition, ExecutedBlock block, Span instruction_data);
+
 	//! Report the execution of an instruction at the specified rip in the currently executing block.
 	//!
 	//! This allows to compute the offsets of each instruction inside the block.
@@ -93,13 +350,45 @@ public:
 	//! - current_transition: id of the transition corresponding to the non-instruction
 	void add_interrupt(std::uint64_t current_transition, Interrupt interrupt);
 
+	//! Report a batch of events to the database, in order.
+	//!
+	//! This is equivalent to calling add_block, add_block_instruction or add_interrupt for each event, but
+	//! processes the whole batch in a single pass.
+	//!
+	//! The instruction data of the events only needs to be valid for the duration of the call, even if it throws: the
+	//! events before the failing one are reported.
+	void add_events(const Event* events, std::size_t count);
+
 	//! Indicate that the last basic block finished executing.
 	//!
 	//! As the final basic block is not necessarily executed fully, call this method to send the
 	//! final transition id of the trace
 	void finalize_execution(std::uint64_t last_transition_id);
 
-	//! Finalizes any running transaction and recovers the underlying resource database.
+	//! Indicate that the last basic block stopped executing at the specified transition, because the execution
+	//! continues elsewhere (e.g. on another vCPU recorded by another Writer, see ShardedWriter).
+	//!
+	//! The next call to add_block starts a new block, possibly at a later transition. The transitions in between
+	//! are not recorded by this Writer: they are stored in the `execution_gaps` table, see merge_shards.
+	void suspend_execution(std::uint64_t transition_id);
+
+	//! Commit the running transaction, if any, so that the events reported so far are stored in the database.
+	//!
+	//! Note that the last reported block is only stored after the next call to add_block, add_interrupt or
+	//! finalize_execution.
+	void flush();
+
+	//! Snapshot of the counters of the work done so far, see WriterStats.
+	WriterStats stats() const;
+
+	//! Store all the rows retained in memory (see WriterOptions::loop_compression and WriterOptions::chunked_execution),
+	//! and commit the running transaction.
+	//!
+	//! Call it once the recording is done, after finalize_execution: no event should be reported afterwards.
+	//! Unlike the destructor, it throws if the rows cannot be stored.
+	void close();
+
+	//! Closes the Writer (see close) and recovers the underlying resource database.
 	//!
 	//! Note that to avoid any leak of resources, the obtained database should not be destroyed
 	//! before this instance of Writer is destroyed.
@@ -107,67 +396,98 @@ public:
 	//! No method should be called on a moved-out Writer.
 	sqlite::ResourceDatabase take() &&;
 private:
-	static constexpr std::uint32_t TRANSACTION_COUNT = 10000;
-
-	// see boost::uuids::sha1::digest_type
-	using Hash = std::vector<unsigned int>;
+	using Fingerprint = detail::Fingerprint;
 	using BlockId = std::int64_t;
 
 	// Data of the last block that has been inserted into the database.
 	// This is used as compression to generate a single execution event when the same block has been
 	// executed several times (such as when the block is looping on itself)
-	Hash last_hash_;
+	bool has_last_block_ = false;
+	Fingerprint last_fingerprint_;
 	ExecutedBlock last_block_;
 	BlockId last_id_ = 0;
+	// Entry of the last block in block_table_ if it was known when reported, or nullptr.
+	// Remains valid until the next insertion in the table, which is the insertion of the last block itself.
+	detail::KnownBlock* last_known_block_ = nullptr;
+	// Instruction data of the last block if it was unknown when reported: either last_instruction_data_, or the data
+	// borrowed from the caller. The data of known blocks is never written again, so it is not retained.
+	Span last_instruction_span_{0, nullptr};
 	std::vector<uint8_t> last_instruction_data_;
 	std::uint64_t last_transition_id_ = 0;
 	std::vector<uint32_t> last_block_instruction_indices_;
+	// whether the execution_gaps table was created, on the first gap
+	bool has_execution_gaps_ = false;
+	bool closed_ = false;
 
-	// if 0, no transaction is running, otherwise transaction has been running for this number of steps
-	std::uint32_t transaction_items_ = 0;
+	WriterOptions options_;
+	// if 0, no transaction is running, otherwise transaction has been running for this number of rows
+	std::uint64_t transaction_items_ = 0;
+	// approximate size of the rows inserted in the running transaction
+	std::uint64_t transaction_bytes_ = 0;
+	std::chrono::steady_clock::time_point transaction_start_;
+	// rowid of the next block inserted in the database
+	BlockId next_block_id_ = 1;
+	// rowid of the next chunk inserted in the database
+	std::int64_t next_chunk_id_ = 1;
 
-	struct MappedBlock {
-		BlockId id;
-		std::uint32_t executed_instructions;
-		ExecutedBlock block;
-	};
-
-	// Boilerplate required to use Hash as key in an unordered_map
-	struct Hasher {
-		std::size_t operator()(const Hash& hash) const {
-			std::experimental::string_view view(reinterpret_cast<const char*>(hash.data()),
-			                                    hash.size() * sizeof(unsigned int));
-			return std::hash<std::experimental::string_view>()(view);
-		}
-	};
-	struct Equaler {
-		bool operator()(const Hash& l, const Hash& r) const {
-			return std::equal(l.begin(), l.end(), r.begin(), r.end());
-		}
-	};
-	// Map of known blocks. Used to determine if a new block should be inserted in the database
-	std::unordered_map<Hash, MappedBlock, Hasher, Equaler> block_map_;
+	// Known blocks. Used to determine if a new block should be inserted in the database
+	std::unique_ptr<detail::BlockTable> block_table_;
+	// Copies of the known blocks within WriterOptions::known_block_bytes, to confirm their fingerprint matches
+	std::unique_ptr<detail::KnownBlockData> known_block_data_;
 
 	reven::sqlite::ResourceDatabase db_;
-	reven::sqlite::Statement last_block_stmt_;
-	reven::sqlite::Statement instructions_stmt_;
-	reven::sqlite::Statement block_execution_stmt_;
-	reven::sqlite::Statement interrupt_stmt_;
+	// Rows are accumulated and inserted with multi-row statements
+	std::unique_ptr<detail::BatchInsert> blocks_batch_;
+	// Instruction offsets of the blocks whose offsets grew during the running transaction, updated at commit
+	std::unordered_map<BlockId, std::vector<std::uint8_t>> pending_offsets_;
+	reven::sqlite::Statement update_offsets_stmt_;
+	// The fields and instruction data of a stored block, to confirm a fingerprint match
+	reven::sqlite::Statement block_row_stmt_;
+	// Encoded offsets of the last new block
+	std::vector<std::uint8_t> offsets_buffer_;
+	std::unique_ptr<detail::BatchInsert> execution_batch_;
+	std::unique_ptr<detail::BatchInsert> interrupts_batch_;
+	std::unique_ptr<detail::BatchInsert> runs_batch_;
+	// Only with WriterOptions::chunked_execution: the chunk being filled, and the tables it is inserted into
+	std::unique_ptr<detail::BatchInsert> chunks_batch_;
+	std::unique_ptr<detail::BatchInsert> chunk_index_batch_;
+	std::unique_ptr<detail::ExecutionChunkEncoder> execution_chunk_;
+	// Only with WriterOptions::loop_compression: replaces the cycles of execution rows with runs
+	std::unique_ptr<detail::RunCompressor> run_compressor_;
+	std::unique_ptr<detail::WriterStatsRecorder> stats_;
 
-	void reset_last_block(ExecutedBlock block, unsigned int* digest, Span instruction_data);
+	void reset_last_block(ExecutedBlock block, Fingerprint fingerprint, Span instruction_data, bool borrowed);
+	// copy the data of the last block if it is borrowed
+	void retain_last_instruction_data();
+	detail::KnownBlock& map_block(Fingerprint fingerprint, BlockId id, std::size_t executed_instructions);
+	// whether the known block with the id is the same as block with instruction_data, from its copy if any, otherwise
+	// from the database
+	bool is_known_block(BlockId id, const ExecutedBlock& block, Span instruction_data);
+	bool is_stored_block(BlockId id, const ExecutedBlock& block, Span instruction_data);
 	void insert_last_block();
-	std::int64_t insert_block_db(const ExecutedBlock& block, Span instruction_data);
-	void insert_executed_instructions_db(const std::vector<std::uint32_t>& block_instruction_indices,
-	                                     std::uint32_t already_inserted_instructions);
+	std::int64_t insert_block_db(const ExecutedBlock& block, Span instruction_data, Span instruction_offsets);
+	void update_instruction_offsets_db(const std::vector<std::uint32_t>& block_instruction_indices);
 	void insert_block_execution(std::uint64_t transition_id);
+	void insert_execution_row(std::uint64_t transition_id, std::int64_t block_id);
+	void insert_execution_chunk();
+	void insert_compressed_rows();
 
 	void insert_interrupt(std::uint64_t current_transition, Interrupt interrupt);
+	void insert_execution_gap(std::uint64_t begin_transition_id, std::uint64_t end_transition_id);
 
 	void add_block_inner(std::uint64_t current_transition, ExecutedBlock block, Span instruction_data,
-	                     bool force_last_block_insertion);
+	                     bool force_last_block_insertion, bool borrowed);
 
-	// use for transaction-aware statement steps
-	reven::sqlite::Statement::StepResult step_transaction(reven::sqlite::Statement& stmt);
+	// call after appending a row of the specified approximate size to a batch, to start and commit transactions as
+	// required
+	void end_row(detail::BatchInsert& batch, std::size_t bytes);
+	// account for a row of the specified approximate size in the running transaction, starting it if required
+	void count_row(std::size_t bytes);
+	void commit_if_needed();
+	void commit_transaction();
+	void report_stats_if_needed();
+	// Store all the rows that are waiting for the end of the recording
+	void finish_execution_rows();
 };
 
 }}} // namespace reven::block::writer
@@ -23,7 +23,7 @@ struct Span {
 	const std::uint8_t* data = nullptr;
 };
 
-constexpr const char* format_version = "1.0.0";
-constexpr const char* writer_version = "1.0.0";
+constexpr const char* format_version = "1.3.0";
+constexpr const char* writer_version = "1.3.0";
 
 }} // namespace reven::block
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "block_reader.h"
+
+namespace reven {
+namespace block {
+namespace reader {
+
+//! Read a trace like Reader, from any number of threads at the same time.
+//!
+//! A Reader keeps prepared statements and caches that a single thread may use at a time. A ConcurrentReader keeps a
+//! pool of Readers, each with its own read-only connection to the file and its own prepared statements, and lends
+//! one to each thread for the duration of a call. The pool grows with the number of threads that use it at the same
+//! time, and a thread usually gets back the Reader it used last.
+//!
+//! All the Readers of the pool share a single block cache, split in independently locked shards, a single transition
+//! index if ReaderOptions::transition_index is set, and a single execution index if ReaderOptions::execution_index is
+//! set. Otherwise, each Reader of the pool loads its own execution index on its first query by address.
+//!
+//! All methods can be called concurrently.
+class ConcurrentReader {
+	struct State;
+public:
+	//! Default number of independently locked shards of the block cache
+	static constexpr std::size_t DEFAULT_CACHE_SHARDS = 64;
+
+	//! A Reader of the pool, lent to the calling thread until the Lease is destroyed.
+	//!
+	//! The Reader must not be used by other threads while it is leased.
+	class Lease {
+	public:
+		~Lease();
+		Lease(const Lease&) = delete;
+		Lease(Lease&&) = default;
+		Lease& operator=(const Lease&) = delete;
+		Lease& operator=(Lease&&) = delete;
+
+		const Reader& operator*() const { return *reader_; }
+		const Reader* operator->() const { return reader_.get(); }
+	private:
+		Lease(State& state, std::size_t slot, std::unique_ptr<Reader> reader) :
+		    state_(&state), slot_(slot), reader_(std::move(reader)) {}
+
+		State* state_;
+		std::size_t slot_;
+		std::unique_ptr<Reader> reader_;
+
+		friend class ConcurrentReader;
+	};
+
+	//! Attempt to open the file specified by filename, either a database or a flat trace like Reader. More connections
+	//! to the file are opened on demand.
+	//!
+	//! - options: see ReaderOptions. cache_bytes is the budget of the cache shared by all the Readers.
+	//! - cache_shards: number of independently locked shards of the block cache.
+	//!
+	//! Throws RuntimeError if the file cannot be opened, is not in the correct format or not in the correct version
+	ConcurrentReader(const char* filename, ReaderOptions options = {},
+	                 std::size_t cache_shards = DEFAULT_CACHE_SHARDS);
+
+	// Rule of five
+	~ConcurrentReader();
+	ConcurrentReader(const ConcurrentReader&) = delete;
+	ConcurrentReader(ConcurrentReader&&);
+	ConcurrentReader& operator=(const ConcurrentReader&) = delete;
+	ConcurrentReader& operator=(ConcurrentReader&&);
+
+	//! Borrow a Reader of the pool, to run queries that are not available on ConcurrentReader, such as
+	//! Reader::query_events.
+	//!
+	//! The Lease must not outlive the ConcurrentReader.
+	Lease lease() const;
+
+	//! See Reader::pinned_block
+	std::shared_ptr<const InstructionBlock> block(BlockHandle handle) const;
+
+	//! See Reader::block_with_instructions
+	BlockInstructions block_with_instructions(BlockHandle handle,
+	                                          std::vector<std::uint32_t> instruction_indexes) const;
+
+	//! See Reader::event_at
+	std::experimental::optional<BlockExecutionEvent> event_at(std::uint64_t transition_id) const;
+
+	//! See Reader::events_at
+	void events_at(const std::uint64_t* transition_ids, std::size_t count,
+	               std::vector<BlockExecutionEvent>& events) const;
+
+	//! See Reader::interrupt_at
+	std::experimental::optional<Interrupt> interrupt_at(std::uint64_t transition_id) const;
+
+	//! Clear the shared block cache, see Reader::clear_cache
+	void clear_cache() const;
+
+	//! Counters of the shared block cache since the ConcurrentReader was opened
+	BlockCacheStats cache_stats() const;
+
+	//! Number of Readers, and thus of connections to the file, opened so far
+	std::size_t connection_count() const;
+private:
+	std::unique_ptr<State> state_;
+};
+
+}}} // namespace reven::block::reader
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "block_writer.h"
+
+namespace reven {
+namespace block {
+namespace writer {
+
+//! Merge databases that each recorded part of the execution into a single database, through output.
+//!
+//! Each shard is a database written by a Writer (see Writer::suspend_execution) whose execution events cover a set
+//! of transitions disjoint from the other shards. Together, the shards must cover the whole trace.
+//!
+//! The events of all shards are interleaved in transition order and reported to output, which deduplicates the
+//! blocks of all shards into a single dictionary of blocks. The result is deterministic and only depends on the
+//! content of the shards.
+//!
+//! The transitions that the Writer of a shard did not record (before its first block or while its execution was
+//! suspended) are stored in its `execution_gaps` table, so each event of a shard begins either at the end of its
+//! previous event in the shard, or at the end of a gap.
+//!
+//! Throws RuntimeError if two shards record the same transition, if no shard records a transition, or if a shard is
+//! inconsistent.
+void merge_shards(std::vector<sqlite::ResourceDatabase> shards, Writer& output);
+
+//! Record the execution of several vCPUs in parallel, with one Writer (shard) per vCPU, then merge the shards into
+//! a single database in the format described in [trace-format.md](../trace-format.md).
+//!
+//! Each shard has its own database, block dictionary and transactions, so that shards can be used concurrently
+//! from different threads without any synchronization. A single shard must not be used concurrently.
+//!
+//! Transition ids are global to the trace: when a vCPU stops executing because another one takes over, call
+//! Writer::suspend_execution on its shard. Each shard must end with a call to finalize_execution or
+//! suspend_execution.
+class ShardedWriter {
+public:
+	//! Create shard_count shards, writing to temporary files next to filename, and a final database at filename.
+	//!
+	//! If filename is ":memory:", the shards are in memory as well.
+	ShardedWriter(const char* filename, const char* tool_name, const char* tool_version, const char* tool_info,
+	              std::size_t shard_count, WriterOptions options = {});
+
+	~ShardedWriter();
+	ShardedWriter(const ShardedWriter&) = delete;
+	ShardedWriter(ShardedWriter&&) = default;
+	ShardedWriter& operator=(const ShardedWriter&) = delete;
+	ShardedWriter& operator=(ShardedWriter&&) = default;
+
+	//! The Writer of the specified shard
+	Writer& shard(std::size_t index) {
+		return shards_.at(index);
+	}
+
+	std::size_t shard_count() const {
+		return shards_.size();
+	}
+
+	//! Merge all the shards into the final database, remove the temporary files and recover the final database.
+	//!
+	//! See merge_shards and Writer::take.
+	sqlite::ResourceDatabase merge() &&;
+private:
+	std::string filename_;
+	std::string tool_name_;
+	std::string tool_version_;
+	std::string tool_info_;
+	WriterOptions options_;
+
+	std::vector<std::string> shard_filenames_;
+	std::vector<Writer> shards_;
+
+	void remove_shard_files();
+};
+
+}}} // namespace reven::block::writer
@@ -0,0 +1,260 @@
+#include <async_writer.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <thread>
+
+#include "spsc_ring.h"
+
+namespace reven {
+namespace block {
+namespace writer {
+
+namespace {
+
+enum class RecordType : std::uint8_t {
+	Block,
+	BlockInstruction,
+	Interrupt,
+	FinalizeExecution,
+	Flush,
+	Stop,
+};
+
+// Compact, trivially copyable representation of the reported events.
+// The instruction data of a Block record immediately follows the record in the ring.
+struct Record {
+	RecordType type;
+	ExecutionMode mode;
+	std::uint16_t block_instruction_count;
+	std::uint32_t number;
+	std::uint64_t transition;
+	std::uint64_t pc;
+	bool is_hw;
+	bool has_related_instruction;
+};
+
+// Number of empty polls of the ring before the background thread starts sleeping
+constexpr std::uint32_t SPIN_COUNT = 1024;
+constexpr auto IDLE_SLEEP = std::chrono::microseconds(50);
+
+} // anonymous namespace
+
+struct AsyncWriter::State {
+	State(const char* filename, const char* tool_name, const char* tool_version, const char* tool_info,
+	      WriterOptions options, std::size_t ring_size) :
+	    writer(filename, tool_name, tool_version, tool_info, options),
+	    ring(ring_size)
+	{}
+
+	~State() {
+		stop();
+	}
+
+	Writer writer;
+	detail::SpscRing ring;
+
+	// Number of Flush records pushed by the producer, and processed by the background thread
+	std::uint64_t flush_requests = 0;
+	std::atomic<std::uint64_t> flushed{0};
+
+	std::atomic<bool> failed{false};
+	std::exception_ptr error;
+
+	std::thread thread;
+
+	void push(Record record, Span data = {}) {
+		check_error();
+		const auto size = sizeof(Record) + data.size;
+		std::uint8_t* storage;
+		// backpressure: wait for the background thread to make room
+		while ((storage = ring.try_reserve(size)) == nullptr) {
+			check_error();
+			std::this_thread::yield();
+		}
+		std::memcpy(storage, &record, sizeof(Record));
+		if (data.size != 0) {
+			std::memcpy(storage + sizeof(Record), data.data, data.size);
+		}
+		ring.commit();
+	}
+
+	void wait_flushed() {
+		Record record{};
+		record.type = RecordType::Flush;
+		push(record);
+		++flush_requests;
+		while (flushed.load(std::memory_order_acquire) < flush_requests) {
+			check_error();
+			std::this_thread::yield();
+		}
+		check_error();
+	}
+
+	void check_error() {
+		if (failed.load(std::memory_order_acquire)) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	// Background thread
+
+	void run() {
+		std::uint32_t idle = 0;
+		while (true) {
+			std::size_t size;
+			const auto* storage = ring.front(size);
+			if (storage == nullptr) {
+				if (++idle > SPIN_COUNT) {
+					std::this_thread::sleep_for(IDLE_SLEEP);
+				} else {
+					std::this_thread::yield();
+				}
+				continue;
+			}
+			idle = 0;
+
+			Record record;
+			std::memcpy(&record, storage, sizeof(Record));
+			if (record.type == RecordType::Stop) {
+				ring.pop(size);
+				return;
+			}
+
+			if (not failed.load(std::memory_order_relaxed)) {
+				try {
+					process(record, Span{size - sizeof(Record), storage + sizeof(Record)});
+				} catch (...) {
+					error = std::current_exception();
+					failed.store(true, std::memory_order_release);
+				}
+			}
+			// Flush requests are acknowledged even after a failure so that the producer never waits forever
+			if (record.type == RecordType::Flush) {
+				flushed.fetch_add(1, std::memory_order_release);
+			}
+			ring.pop(size);
+		}
+	}
+
+	void process(const Record& record, Span data) {
+		switch (record.type) {
+			case RecordType::Block:
+				writer.add_block(record.transition,
+				                 ExecutedBlock{record.pc, record.block_instruction_count, record.mode}, data);
+				break;
+			case RecordType::BlockInstruction:
+				writer.add_block_instruction(record.pc);
+				break;
+			case RecordType::Interrupt: {
+				Interrupt interrupt;
+				interrupt.pc = record.pc;
+				interrupt.mode = record.mode;
+				interrupt.number = record.number;
+				interrupt.is_hw = record.is_hw;
+				interrupt.has_related_instruction = record.has_related_instruction;
+				writer.add_interrupt(record.transition, interrupt);
+				break;
+			}
+			case RecordType::FinalizeExecution:
+				writer.finalize_execution(record.transition);
+				break;
+			case RecordType::Flush:
+				writer.flush();
+				break;
+			case RecordType::Stop:
+				break;
+		}
+	}
+
+	void stop() {
+		if (not thread.joinable()) {
+			return;
+		}
+		Record record{};
+		record.type = RecordType::Stop;
+		// Do not rethrow here: the error is reported by the caller once the thread is joined
+		std::uint8_t* storage;
+		while ((storage = ring.try_reserve(sizeof(Record))) == nullptr) {
+			std::this_thread::yield();
+		}
+		std::memcpy(storage, &record, sizeof(Record));
+		ring.commit();
+		thread.join();
+	}
+};
+
+AsyncWriter::AsyncWriter(const char* filename, const char* tool_name, const char* tool_version,
+                         const char* tool_info, WriterOptions options, std::size_t ring_size) :
+    state_(new State(filename, tool_name, tool_version, tool_info, options, ring_size))
+{
+	auto* state = state_.get();
+	state_->thread = std::thread([state]() { state->run(); });
+}
+
+AsyncWriter::~AsyncWriter() = default;
+AsyncWriter::AsyncWriter(AsyncWriter&&) = default;
+AsyncWriter& AsyncWriter::operator=(AsyncWriter&&) = default;
+
+void AsyncWriter::add_block(std::uint64_t current_transition, ExecutedBlock block, Span instruction_data)
+{
+	Record record{};
+	record.type = RecordType::Block;
+	record.transition = current_transition;
+	record.pc = block.pc;
+	record.block_instruction_count = block.block_instruction_count;
+	record.mode = block.mode;
+	state_->push(record, instruction_data);
+}
+
+void AsyncWriter::add_block_instruction(std::uint64_t rip)
+{
+	Record record{};
+	record.type = RecordType::BlockInstruction;
+	record.pc = rip;
+	state_->push(record);
+}
+
+void AsyncWriter::add_interrupt(std::uint64_t current_transition, Interrupt interrupt)
+{
+	Record record{};
+	record.type = RecordType::Interrupt;
+	record.transition = current_transition;
+	record.pc = interrupt.pc;
+	record.mode = interrupt.mode;
+	record.number = interrupt.number;
+	record.is_hw = interrupt.is_hw;
+	record.has_related_instruction = interrupt.has_related_instruction;
+	state_->push(record);
+}
+
+void AsyncWriter::finalize_execution(std::uint64_t last_transition_id)
+{
+	Record record{};
+	record.type = RecordType::FinalizeExecution;
+	record.transition = last_transition_id;
+	state_->push(record);
+}
+
+void AsyncWriter::flush()
+{
+	state_->wait_flushed();
+}
+
+void AsyncWriter::close()
+{
+	state_->stop();
+	state_->check_error();
+	state_->writer.close();
+}
+
+sqlite::ResourceDatabase AsyncWriter::take() &&
+{
+	state_->stop();
+	state_->check_error();
+	return std::move(state_->writer).take();
+}
+
+}}} // namespace reven::block::writer
@@ -0,0 +1,81 @@
+#include "batch_insert.h"
+
+#include <limits>
+#include <stdexcept>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+namespace {
+
+// Lowest default value of SQLITE_MAX_VARIABLE_NUMBER across the sqlite versions we support
+constexpr std::size_t MAX_VARIABLES = 999;
+
+std::string insert_query(const char* table, const char* columns, std::size_t column_count, std::size_t rows)
+{
+	std::string row = "(";
+	for (std::size_t column = 0; column < column_count; ++column) {
+		row += column == 0 ? "?" : ", ?";
+	}
+	row += ")";
+
+	std::string query = std::string("INSERT INTO ") + table + columns + " VALUES ";
+	for (std::size_t i = 0; i < rows; ++i) {
+		if (i != 0) {
+			query += ", ";
+		}
+		query += row;
+	}
+	return query + ";";
+}
+
+} // anonymous namespace
+
+BatchInsert::BatchInsert(sqlite::Database& db, const char* table, const char* columns, std::size_t column_count) :
+    table_(table),
+    column_count_(column_count),
+    batch_rows_(MAX_VARIABLES / column_count),
+    row_stmt_(db, insert_query(table, columns, column_count, 1).c_str()),
+    batch_stmt_(db, insert_query(table, columns, column_count, batch_rows_).c_str())
+{
+	values_.reserve(batch_rows_ * column_count_);
+}
+
+BatchInsert& BatchInsert::unsigned_integer(std::uint64_t value)
+{
+	if (value > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max())) {
+		throw std::runtime_error("Value too large to be inserted into " + table_);
+	}
+	return integer(static_cast<std::int64_t>(value));
+}
+
+void BatchInsert::flush()
+{
+	const auto rows = values_.size() / column_count_;
+	for (std::size_t row = 0; row < rows; ++row) {
+		execute(row_stmt_, row, 1);
+	}
+	clear();
+}
+
+void BatchInsert::execute(sqlite::Statement& stmt, std::size_t first_row, std::size_t rows)
+{
+	// a null pointer would bind NULL rather than an empty blob
+	static const std::uint8_t empty_blob = 0;
+
+	const auto first = first_row * column_count_;
+	for (std::size_t i = 0; i < rows * column_count_; ++i) {
+		const auto& value = values_[first + i];
+		if (value.is_blob) {
+			const auto* data = value.integer == 0 ? &empty_blob : blobs_.data() + value.blob_offset;
+			stmt.bind_blob_without_copy(i + 1, data, value.integer, table_.c_str());
+		} else {
+			stmt.bind_arg(i + 1, value.integer, table_.c_str());
+		}
+	}
+	stmt.step();
+	stmt.reset();
+}
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+#include <rvnsqlite/resource_database.h>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Accumulates the rows inserted into a table, and inserts them with a single multi-row INSERT statement once a
+//! full batch is available.
+//!
+//! Rows are appended one value at a time, in column order, then closed with end_row.
+//! Rows that do not fill a complete batch are inserted one at a time by flush.
+class BatchInsert {
+public:
+	//! Prepare the statements inserting rows of column_count values into table.
+	//!
+	//! - columns: column list of the INSERT statement, e.g. "(rowid, pc)", or an empty string for all columns.
+	BatchInsert(sqlite::Database& db, const char* table, const char* columns, std::size_t column_count);
+
+	BatchInsert& integer(std::int64_t value) {
+		values_.push_back(Value{value, 0, false});
+		return *this;
+	}
+
+	//! Append a value to the current row, throwing if it does not fit in a signed 64-bit integer.
+	BatchInsert& unsigned_integer(std::uint64_t value);
+
+	//! Append a blob to the current row. The data is copied and does not need to outlive this call.
+	BatchInsert& blob(Span value) {
+		values_.push_back(Value{static_cast<std::int64_t>(value.size), blobs_.size(), true});
+		blobs_.insert(blobs_.end(), value.data, value.data + value.size);
+		return *this;
+	}
+
+	//! Close the current row, executing the batch statement if the batch is full.
+	//!
+	//! Returns true if rows were inserted in the database.
+	bool end_row() {
+		if (values_.size() < batch_rows_ * column_count_) {
+			return false;
+		}
+		execute(batch_stmt_, 0, batch_rows_);
+		clear();
+		return true;
+	}
+
+	//! Insert all the pending rows in the database.
+	void flush();
+
+	//! Whether rows are waiting to be inserted.
+	bool empty() const {
+		return values_.empty();
+	}
+
+private:
+	struct Value {
+		// integer value, or size of the blob
+		std::int64_t integer;
+		std::size_t blob_offset;
+		bool is_blob;
+	};
+
+	void execute(sqlite::Statement& stmt, std::size_t first_row, std::size_t rows);
+	void clear() {
+		values_.clear();
+		blobs_.clear();
+	}
+
+	std::string table_;
+	std::size_t column_count_;
+	std::size_t batch_rows_;
+
+	std::vector<Value> values_;
+	std::vector<std::uint8_t> blobs_;
+
+	sqlite::Statement row_stmt_;
+	sqlite::Statement batch_stmt_;
+};
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,175 @@
+#include "block_cache.h"
+
+#include <algorithm>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+namespace {
+
+// Approximate memory taken by the bookkeeping of a cached block: list and map nodes, shared_ptr control block
+constexpr std::size_t ENTRY_OVERHEAD = 128;
+
+std::size_t offsets_bytes(const std::vector<std::uint32_t>& offsets)
+{
+	return offsets.capacity() * sizeof(std::uint32_t) + ENTRY_OVERHEAD;
+}
+
+} // anonymous namespace
+
+BlockCache::BlockCache(std::size_t budget_bytes, std::size_t shard_count) :
+    shard_count_(std::max<std::size_t>(shard_count, 1)),
+    // a limited budget must not become unlimited when divided
+    shard_budget_bytes_(budget_bytes == 0 ? 0 : std::max<std::size_t>(budget_bytes / shard_count_, 1)),
+    shards_(new Shard[shard_count_])
+{}
+
+BlockCache::Block BlockCache::find(std::int64_t id)
+{
+	auto& shard = this->shard(id);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto it = shard.index.find(id);
+	if (it == shard.index.end()) {
+		++shard.stats.misses;
+		return nullptr;
+	}
+
+	++shard.stats.hits;
+	shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+	return it->second->block;
+}
+
+BlockCache::Block BlockCache::insert(std::int64_t id, reader::InstructionBlock block)
+{
+	const auto bytes = sizeof(reader::InstructionBlock) + block.instruction_data.capacity() + ENTRY_OVERHEAD;
+	auto cached = std::make_shared<const reader::InstructionBlock>(std::move(block));
+
+	auto& shard = this->shard(id);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto it = shard.index.find(id);
+	if (it != shard.index.end()) {
+		shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+		return it->second->block;
+	}
+
+	shard.entries.push_front(Entry{id, std::move(cached), nullptr, bytes});
+	shard.index.emplace(id, shard.entries.begin());
+	shard.stats.bytes += bytes;
+	evict(shard);
+
+	return shard.entries.front().block;
+}
+
+BlockCache::Offsets BlockCache::find_offsets(std::int64_t id)
+{
+	auto& shard = this->shard(id);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto it = shard.index.find(id);
+	if (it == shard.index.end() or not it->second->offsets) {
+		++shard.stats.offsets_misses;
+		return nullptr;
+	}
+
+	++shard.stats.offsets_hits;
+	return it->second->offsets;
+}
+
+BlockCache::Offsets BlockCache::insert_offsets(std::int64_t id, std::vector<std::uint32_t> offsets)
+{
+	const auto bytes = offsets_bytes(offsets);
+	auto cached = std::make_shared<const std::vector<std::uint32_t>>(std::move(offsets));
+
+	auto& shard = this->shard(id);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto it = shard.index.find(id);
+	if (it == shard.index.end()) {
+		return cached;
+	}
+	if (it->second->offsets) {
+		return it->second->offsets;
+	}
+
+	it->second->offsets = std::move(cached);
+	it->second->bytes += bytes;
+	shard.stats.bytes += bytes;
+	// the block is kept, like a block is kept by its own insertion
+	shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+	evict(shard);
+
+	return shard.entries.front().offsets;
+}
+
+void BlockCache::evict(Shard& shard)
+{
+	while (shard_budget_bytes_ != 0 and shard.stats.bytes > shard_budget_bytes_ and shard.entries.size() > 1) {
+		const auto& lru = shard.entries.back();
+		shard.stats.bytes -= lru.bytes;
+		shard.index.erase(lru.id);
+		shard.entries.pop_back();
+		++shard.stats.evictions;
+	}
+	shard.stats.blocks = shard.entries.size();
+}
+
+void BlockCache::clear_offsets()
+{
+	for (std::size_t i = 0; i < shard_count_; ++i) {
+		auto& shard = shards_[i];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		for (auto& entry : shard.entries) {
+			if (entry.offsets) {
+				const auto bytes = offsets_bytes(*entry.offsets);
+				entry.bytes -= bytes;
+				shard.stats.bytes -= bytes;
+				entry.offsets = nullptr;
+			}
+		}
+	}
+}
+
+void BlockCache::clear()
+{
+	for (std::size_t i = 0; i < shard_count_; ++i) {
+		auto& shard = shards_[i];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		// Reclaim the memory of the containers as well
+		Entries{}.swap(shard.entries);
+		decltype(shard.index){}.swap(shard.index);
+		shard.stats.bytes = 0;
+		shard.stats.blocks = 0;
+	}
+}
+
+std::size_t BlockCache::size() const
+{
+	std::size_t size = 0;
+	for (std::size_t i = 0; i < shard_count_; ++i) {
+		std::lock_guard<std::mutex> lock(shards_[i].mutex);
+		size += shards_[i].entries.size();
+	}
+	return size;
+}
+
+reader::BlockCacheStats BlockCache::stats() const
+{
+	reader::BlockCacheStats stats;
+	for (std::size_t i = 0; i < shard_count_; ++i) {
+		std::lock_guard<std::mutex> lock(shards_[i].mutex);
+		const auto& shard = shards_[i].stats;
+		stats.hits += shard.hits;
+		stats.misses += shard.misses;
+		stats.evictions += shard.evictions;
+		stats.blocks += shard.blocks;
+		stats.bytes += shard.bytes;
+		stats.offsets_hits += shard.offsets_hits;
+		stats.offsets_misses += shard.offsets_misses;
+	}
+	return stats;
+}
+
+}}} // namespace reven::block::detail
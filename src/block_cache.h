@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <block_reader.h>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Cache of the blocks of a Reader, evicting the least recently used blocks beyond a budget of bytes.
+//!
+//! Blocks are reference-counted: evicting a block only drops the reference of the cache, so the blocks that are
+//! still in use elsewhere remain valid.
+//!
+//! The cache can be used concurrently from several threads. The blocks are spread by id over shards that each have
+//! their own lock, least recently used list and share of the budget, so that threads requesting different blocks
+//! rarely wait for each other.
+class BlockCache {
+public:
+	using Block = std::shared_ptr<const reader::InstructionBlock>;
+	using Offsets = std::shared_ptr<const std::vector<std::uint32_t>>;
+
+	//! - budget_bytes: approximate memory that the cached blocks may take. 0 for no limit.
+	//! - shard_count: number of independently locked shards. 1 keeps an exact least recently used order.
+	explicit BlockCache(std::size_t budget_bytes, std::size_t shard_count = 1);
+
+	//! Retrieve a cached block and mark it as the most recently used, or return nullptr if it is not cached.
+	Block find(std::int64_t id);
+
+	//! Add a block, evicting the least recently used blocks of its shard if the budget is exceeded.
+	//!
+	//! If another thread cached the same block in the meantime, the block of the other thread is kept and returned.
+	//! The block itself is never evicted by its own insertion.
+	Block insert(std::int64_t id, reader::InstructionBlock block);
+
+	//! Retrieve the instruction offsets of a cached block, or return nullptr if the block is not cached or its offsets
+	//! were not inserted.
+	Offsets find_offsets(std::int64_t id);
+
+	//! Add the instruction offsets of a block, which are kept as long as the block is cached.
+	//!
+	//! If the block is not cached anymore, the offsets are only returned.
+	Offsets insert_offsets(std::int64_t id, std::vector<std::uint32_t> offsets);
+
+	//! Drop the instruction offsets of all the cached blocks, but keep the blocks.
+	void clear_offsets();
+
+	void clear();
+
+	std::size_t size() const;
+
+	reader::BlockCacheStats stats() const;
+
+private:
+	struct Entry {
+		std::int64_t id;
+		Block block;
+		Offsets offsets;
+		std::size_t bytes;
+	};
+	// Most recently used first
+	using Entries = std::list<Entry>;
+
+	struct Shard {
+		mutable std::mutex mutex;
+		Entries entries;
+		std::unordered_map<std::int64_t, Entries::iterator> index;
+		reader::BlockCacheStats stats;
+	};
+
+	Shard& shard(std::int64_t id) {
+		return shards_[static_cast<std::uint64_t>(id) % shard_count_];
+	}
+
+	//! Evict the least recently used entries of the shard beyond its budget, except the most recently used one
+	void evict(Shard& shard);
+
+	std::size_t shard_count_;
+	std::size_t shard_budget_bytes_;
+	std::unique_ptr<Shard[]> shards_;
+};
+
+}}} // namespace reven::block::detail
@@ -1,6 +1,22 @@
 #include <block_reader.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#include "block_cache.h"
 #include "common.h"
+#include "execution_chunks.h"
+#include "execution_index.h"
+#include "execution_runs.h"
+#include "flat_trace.h"
+#include "instruction_offsets.h"
+#include "spsc_ring.h"
+#include "transition_index.h"
 
 #include <rvnmetadata/metadata-sql.h>
 
@@ -8,36 +24,117 @@ namespace reven {
 namespace block {
 namespace reader {
 
-Reader::Reader(const char* filename) :
-    Reader(sqlite::ResourceDatabase::open(filename, true))
-{
-
-}
-
-Reader::Reader(sqlite::ResourceDatabase db) :
-    db_(std::move(db)),
-    stmt_after_(db_, "SELECT transition_id, block_id FROM execution "
-                     "WHERE transition_id > ? "
-                     "ORDER BY transition_id ASC "
-                     "LIMIT 1"
-                     ";"),
-    stmt_before_(db_, "SELECT transition_id FROM execution "
-                      "WHERE transition_id <= ? "
-                      "ORDER BY transition_id DESC "
-                      "LIMIT 1"
-                      ";"),
-    stmt_block_(db_, "SELECT pc, instruction_data, instruction_count, mode "
-                     "FROM blocks WHERE rowid = ?"
-                     ";"),
-    stmt_block_inst_(db_, "SELECT instruction_index "
-                          "FROM instruction_indices WHERE block_id = ? "
-                          "ORDER BY instruction_id ASC"
-                          ";"),
-    stmt_interrupt_at_(db_, "SELECT pc, mode, number, is_hw, related_instruction_block_id "
-                            "FROM interrupts WHERE transition_id = ? "
-                            ";")
-{
-	const auto md = metadata::from_raw_metadata(db_.metadata());
+namespace {
+
+bool has_table(sqlite::Database& db, const char* name)
+{
+	sqlite::Statement stmt(db, (std::string("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = '") + name +
+	                            "';").c_str());
+	return stmt.step() == sqlite::Statement::StepResult::Row;
+}
+
+// Waiting policy of the threads of a PrefetchedEventQuery, like the ones of AsyncWriter
+constexpr std::uint32_t SPIN_COUNT = 1024;
+constexpr auto IDLE_SLEEP = std::chrono::microseconds(50);
+
+// Blocks whose instruction offsets an InstructionQuery keeps decoded
+constexpr std::size_t INSTRUCTION_QUERY_MAX_BLOCKS = 16384;
+
+//! Resolve the sorted transitions with a single pass over the rows returned by next_row, the first of which begins at
+//! begin_transition_id. row_event turns the row that contains a transition into its event.
+template <typename NextRow, typename RowEvent>
+void merge_rows(const std::uint64_t* transition_ids, std::size_t count, std::vector<BlockExecutionEvent>& events,
+                std::uint64_t begin_transition_id, NextRow next_row, RowEvent row_event)
+{
+	std::uint64_t end_transition_id;
+	std::int32_t block_id;
+	while (events.size() < count and next_row(end_transition_id, block_id)) {
+		while (events.size() < count and transition_ids[events.size()] < end_transition_id) {
+			events.push_back(row_event(begin_transition_id, end_transition_id, block_id,
+			                           transition_ids[events.size()]));
+		}
+		begin_transition_id = end_transition_id;
+	}
+}
+
+// The instruction offsets of a block are in the order of its instructions, which is increasing unless the Writer was
+// given the instructions out of order: the lookups fall back to a linear search when they are not sorted.
+
+//! The first instruction offset equal to offset, or the end of offsets if there is none
+std::vector<std::uint32_t>::const_iterator find_instruction_offset(const std::vector<std::uint32_t>& offsets,
+                                                                   std::uint64_t offset)
+{
+	const auto it = std::lower_bound(offsets.begin(), offsets.end(), offset);
+	if (it != offsets.end() and *it == offset) {
+		return it;
+	}
+	if (std::is_sorted(offsets.begin(), offsets.end())) {
+		return offsets.end();
+	}
+	return std::find(offsets.begin(), offsets.end(), offset);
+}
+
+//! The smallest instruction offset greater than offset, or the end of offsets if there is none
+std::vector<std::uint32_t>::const_iterator next_instruction_offset(const std::vector<std::uint32_t>& offsets,
+                                                                   std::uint64_t offset)
+{
+	if (std::is_sorted(offsets.begin(), offsets.end())) {
+		return std::upper_bound(offsets.begin(), offsets.end(), offset);
+	}
+	auto next = offsets.end();
+	for (auto it = offsets.begin(); it != offsets.end(); ++it) {
+		if (*it > offset and (next == offsets.end() or *it < *next)) {
+			next = it;
+		}
+	}
+	return next;
+}
+
+} // anonymous namespace
+
+Reader::Reader(const char* filename, ReaderOptions options) :
+    Reader(open(filename, options, std::make_shared<detail::BlockCache>(options.cache_bytes), nullptr, nullptr))
+{
+
+}
+
+Reader::Reader(sqlite::ResourceDatabase db, ReaderOptions options) :
+    Reader(std::move(db), options, std::make_shared<detail::BlockCache>(options.cache_bytes), nullptr, nullptr)
+{
+
+}
+
+Reader::Reader(sqlite::ResourceDatabase db, ReaderOptions options, std::shared_ptr<detail::BlockCache> cache,
+               std::shared_ptr<detail::TransitionIndex> transition_index,
+               std::shared_ptr<detail::ExecutionIndex> execution_index) :
+    db_(new sqlite::ResourceDatabase(std::move(db))),
+    // Instruction offsets were moved from the instruction_indices table to the blocks table in version 1.3
+    packed_instruction_offsets_(not has_table(*db_, "instruction_indices")),
+    cache_(std::move(cache)),
+    stmt_after_(new sqlite::Statement(*db_, "SELECT transition_id, block_id FROM execution "
+                                            "WHERE transition_id > ? "
+                                            "ORDER BY transition_id ASC "
+                                            "LIMIT 1"
+                                            ";")),
+    stmt_before_(new sqlite::Statement(*db_, "SELECT transition_id FROM execution "
+                                             "WHERE transition_id <= ? "
+                                             "ORDER BY transition_id DESC "
+                                             "LIMIT 1"
+                                             ";")),
+    stmt_block_(new sqlite::Statement(*db_, "SELECT pc, instruction_data, instruction_count, mode "
+                                            "FROM blocks WHERE rowid = ?"
+                                            ";")),
+    stmt_block_inst_(new sqlite::Statement(*db_, packed_instruction_offsets_ ?
+                                                 "SELECT instruction_offsets FROM blocks WHERE rowid = ?;" :
+                                                 "SELECT instruction_index "
+                                                 "FROM instruction_indices WHERE block_id = ? "
+                                                 "ORDER BY instruction_id ASC"
+                                                 ";")),
+    stmt_interrupt_at_(new sqlite::Statement(*db_, "SELECT pc, mode, number, is_hw, related_instruction_block_id "
+                                                   "FROM interrupts WHERE transition_id = ? "
+                                                   ";"))
+{
+	const auto md = metadata::from_raw_metadata(db_->metadata());
 	if (md.type() != metadata::ResourceType::Block) {
 		throw std::runtime_error("Cannot open a resource of type " +
 		                         metadata::to_string(md.type()).to_string());
@@ -53,9 +150,71 @@ Reader::Reader(sqlite::ResourceDatabase db) :
 		}
 	}
 
+	// Runs were introduced in version 1.1
+	if (has_table(*db_, "execution_runs")) {
+		stmt_run_.reset(new sqlite::Statement(*db_, "SELECT pattern FROM execution_runs WHERE id = ?;"));
+	}
+
+	// Chunks were introduced in version 1.2, and replace the rows of the execution table
+	if (has_table(*db_, "execution_chunk_index")) {
+		chunked_ = true;
+		load_chunk_index(0);
+		stmt_chunk_.reset(new sqlite::Statement(*db_, "SELECT data FROM execution_chunks WHERE id = ?;"));
+	}
+
+	check_interrupt_block();
+
+	if (transition_index) {
+		transition_index_ = std::move(transition_index);
+	} else if (options.transition_index) {
+		transition_index_ = std::make_shared<detail::TransitionIndex>();
+		load_transition_index();
+		transition_index_->shrink_to_fit();
+	}
+
+	if (execution_index) {
+		execution_index_ = std::move(execution_index);
+	} else if (options.execution_index) {
+		load_execution_index();
+	}
+}
+
+Reader::Reader(std::shared_ptr<const detail::FlatTrace> flat, ReaderOptions options,
+               std::shared_ptr<detail::BlockCache> cache, std::shared_ptr<detail::ExecutionIndex> execution_index) :
+    flat_(std::move(flat)),
+    cache_(std::move(cache))
+{
+	check_interrupt_block();
+
+	if (execution_index) {
+		execution_index_ = std::move(execution_index);
+	} else if (options.execution_index) {
+		load_execution_index();
+	}
+}
+
+Reader Reader::open(const char* filename, ReaderOptions options, std::shared_ptr<detail::BlockCache> cache,
+                    std::shared_ptr<detail::TransitionIndex> transition_index,
+                    std::shared_ptr<detail::ExecutionIndex> execution_index)
+{
+	if (detail::FlatTrace::is_flat_trace(filename)) {
+		Reader reader(std::make_shared<const detail::FlatTrace>(filename), options, std::move(cache),
+		              std::move(execution_index));
+		reader.filename_ = filename;
+		return reader;
+	}
+
+	Reader reader(sqlite::ResourceDatabase::open(filename, true), options, std::move(cache),
+	              std::move(transition_index), std::move(execution_index));
+	reader.filename_ = filename;
+	return reader;
+}
+
+void Reader::check_interrupt_block() const
+{
 	try {
 		auto interrupt = block(BlockHandle::interrupt_block_handle());
-		auto interrupt_msg = std::string(reinterpret_cast<char*>(interrupt.instruction_data.data()),
+		auto interrupt_msg = std::string(reinterpret_cast<const char*>(interrupt.instruction_data.data()),
 		                                 interrupt.instruction_data.size());
 		if (interrupt_msg != "interrupt") {
 			throw std::runtime_error("First block is not a valid interrupt block.");
@@ -65,76 +224,371 @@ Reader::Reader(sqlite::ResourceDatabase db) :
 	}
 }
 
-const InstructionBlock& Reader::block(BlockHandle handle) const
+Reader::~Reader() = default;
+Reader::Reader(Reader&&) = default;
+Reader& Reader::operator=(Reader&&) = default;
+
+void Reader::load_transition_index()
 {
-	auto itbool = cache_.insert({handle.handle_, {}});
-	if (itbool.second) {
-		try {
-			itbool.first->second= fetch_from_db(handle);
-		} catch (std::runtime_error&) {
-			cache_.erase(itbool.first);
-			throw;
+	if (index_rows_) {
+		index_rows_.reset(new ExecutionRows(execution_rows_after(*index_rows_,
+		                                                         transition_index_->end_transition_id())));
+	} else {
+		index_rows_.reset(new ExecutionRows(execution_rows()));
+	}
+
+	std::uint64_t transition_id;
+	std::int32_t block_id;
+	while (index_rows_->next(transition_id, block_id)) {
+		transition_index_->push(transition_id, block_id);
+	}
+}
+
+void Reader::load_chunk_index(std::uint64_t begin_transition_id)
+{
+	sqlite::Statement stmt_index(*db_, "SELECT begin_transition_id, chunk_id FROM execution_chunk_index "
+	                                   "WHERE begin_transition_id >= ? "
+	                                   "ORDER BY begin_transition_id ASC;");
+	stmt_index.bind_arg_throw(1, begin_transition_id, "begin_transition_id");
+	while (stmt_index.step() == sqlite::Statement::StepResult::Row) {
+		chunk_begins_.push_back(stmt_index.column_u64(0));
+		chunk_ids_.push_back(stmt_index.column_u64(1));
+	}
+}
+
+void Reader::load_execution_index() const
+{
+	const bool loaded = execution_index_ != nullptr;
+	if (not loaded) {
+		execution_index_.reset(new detail::ExecutionIndex());
+	}
+	auto& index = *execution_index_;
+
+	for (const auto& event : query_events(index.end_transition_id(), std::numeric_limits<std::uint64_t>::max())) {
+		const auto block_id = event.block_handle.handle_;
+		// the blocks of the interrupts have no address, but their events are pushed to keep the index contiguous
+		if (event.has_instructions() and not index.has_block(block_id)) {
+			const auto block = cached_block(event.block_handle);
+			index.add_block(block_id, block->first_pc, block->instruction_data.size());
 		}
+		index.push(block_id, event.begin_transition_id, event.execution_count());
 	}
 
-	return itbool.first->second;
+	if (not loaded) {
+		index.shrink_to_fit();
+	}
+}
+
+std::uint64_t Reader::refresh()
+{
+	const auto end_transition_id = refresh_rows();
+	if (not flat_) {
+		// the Writer adds instruction offsets to the blocks it already committed, when they execute further
+		cache_->clear_offsets();
+	}
+	if (execution_index_) {
+		load_execution_index();
+	}
+	return end_transition_id;
+}
+
+std::uint64_t Reader::refresh_rows()
+{
+	if (flat_) {
+		// a flat trace is not recorded anymore
+		const auto event_count = flat_->event_count();
+		return event_count == 0 ? 0 : flat_->event(event_count - 1).end_transition_id;
+	}
+
+	end_read_transaction();
+
+	if (transition_index_) {
+		load_transition_index();
+		if (chunked_) {
+			load_chunk_index(chunk_begins_.empty() ? 0 : chunk_begins_.back() + 1);
+		}
+		return transition_index_->end_transition_id();
+	}
+
+	if (not chunked_) {
+		sqlite::Statement stmt(*db_, "SELECT MAX(transition_id) FROM execution;");
+		stmt.step();
+		return stmt.column_u64(0);
+	}
+
+	load_chunk_index(chunk_begins_.empty() ? 0 : chunk_begins_.back() + 1);
+	if (chunk_begins_.empty()) {
+		return 0;
+	}
+
+	// the end of the last row of the last chunk
+	stmt_chunk_->reset();
+	stmt_chunk_->bind_arg(1, chunk_ids_.back(), "id");
+	if (stmt_chunk_->step() != sqlite::Statement::StepResult::Row) {
+		throw std::runtime_error("Unknown execution chunk");
+	}
+	const auto data = stmt_chunk_->column_blob(0);
+	const auto* cursor = reinterpret_cast<const std::uint8_t*>(std::get<0>(data));
+	const auto* end = cursor + std::get<1>(data);
+
+	std::uint64_t end_transition_id = chunk_begins_.back();
+	while (cursor != end) {
+		std::int32_t block_id;
+		detail::decode_execution_row(cursor, end, end_transition_id, block_id);
+	}
+	stmt_chunk_->reset();
+	return end_transition_id;
+}
+
+void Reader::end_read_transaction() const
+{
+	if (not db_) {
+		return;
+	}
+	stmt_after_->reset();
+	stmt_before_->reset();
+	stmt_block_->reset();
+	stmt_block_inst_->reset();
+	stmt_interrupt_at_->reset();
+	if (stmt_run_) {
+		stmt_run_->reset();
+	}
+	if (stmt_chunk_) {
+		stmt_chunk_->reset();
+	}
+}
+
+std::shared_ptr<const InstructionBlock> Reader::cached_block(BlockHandle handle) const
+{
+	if (auto cached = cache_->find(handle.handle_)) {
+		return cached;
+	}
+	return cache_->insert(handle.handle_, fetch_from_db(handle));
+}
+
+const InstructionBlock& Reader::block(BlockHandle handle) const
+{
+	return *cached_block(handle);
+}
+
+std::shared_ptr<const InstructionBlock> Reader::pinned_block(BlockHandle handle) const
+{
+	return cached_block(handle);
 }
 
 BlockInstructions Reader::block_with_instructions(BlockHandle handle,
                                                   std::vector<std::uint32_t> instruction_indexes) const
 {
-	const auto& db_block = block(handle);
-	if (db_block.instruction_count == 0) {
-		return BlockInstructions(db_block, {});
+	auto db_block = pinned_block(handle);
+	if (db_block->instruction_count == 0) {
+		return BlockInstructions(std::move(db_block), {});
+	}
+
+	auto indexes = cached_instruction_indexes(handle, *db_block);
+	return BlockInstructions(std::move(db_block), std::move(indexes), std::move(instruction_indexes));
+}
+
+std::shared_ptr<const std::vector<std::uint32_t>> Reader::cached_instruction_indexes(BlockHandle handle,
+                                                                                     const InstructionBlock& block) const
+{
+	if (auto cached = cache_->find_offsets(handle.handle_)) {
+		return cached;
+	}
+
+	std::vector<std::uint32_t> instruction_indexes;
+	instruction_indexes.reserve(block.instruction_count);
+	read_instruction_indexes(handle, instruction_indexes);
+	return cache_->insert_offsets(handle.handle_, std::move(instruction_indexes));
+}
+
+void Reader::clear_cache() const
+{
+	cache_->clear();
+}
+
+std::size_t Reader::cache_size() const
+{
+	return cache_->size();
+}
+
+BlockCacheStats Reader::cache_stats() const
+{
+	return cache_->stats();
+}
+
+void Reader::read_instruction_indexes(BlockHandle handle, std::vector<std::uint32_t>& instruction_indexes) const
+{
+	if (flat_) {
+		const auto* block = flat_->block(handle.handle_);
+		if (block == nullptr) {
+			throw std::runtime_error("Unknown block_id");
+		}
+		const auto* offsets = flat_->block_instruction_offsets(*block);
+		instruction_indexes.assign(offsets, offsets + block->instruction_offset_count);
+		return;
+	}
+
+	stmt_block_inst_->reset();
+	stmt_block_inst_->bind_arg(1, handle.handle_, "rowid");
+
+	if (packed_instruction_offsets_) {
+		if (stmt_block_inst_->step() != sqlite::Statement::StepResult::Row) {
+			throw std::runtime_error("Unknown block_id");
+		}
+		const auto offsets = stmt_block_inst_->column_blob(0);
+		detail::decode_instruction_offsets(reinterpret_cast<const std::uint8_t*>(std::get<0>(offsets)),
+		                                   std::get<1>(offsets), instruction_indexes);
+		return;
 	}
 
-	stmt_block_inst_.reset();
-	stmt_block_inst_.bind_arg(1, handle.handle_, "rowid");
 	instruction_indexes.clear();
-	instruction_indexes.reserve(db_block.instruction_count);
-	while (stmt_block_inst_.step() == sqlite::Statement::StepResult::Row) {
-		std::uint32_t instruction_index = stmt_block_inst_.column_u32(0);
+	while (stmt_block_inst_->step() == sqlite::Statement::StepResult::Row) {
+		std::uint32_t instruction_index = stmt_block_inst_->column_u32(0);
 		instruction_indexes.push_back(instruction_index);
 	}
-	return BlockInstructions(db_block, std::move(instruction_indexes));
 }
 
 std::experimental::optional<BlockExecutionEvent> Reader::event_at(uint64_t transition_id) const
 {
+	if (flat_) {
+		const auto index = flat_->find_event(transition_id);
+		if (index == flat_->event_count()) {
+			return {};
+		}
+		const auto& event = flat_->event(index);
+		return BlockExecutionEvent{flat_->event_begin(index), event.end_transition_id, BlockHandle{event.block_id}};
+	}
+
+	if (transition_index_) {
+		detail::TransitionIndex::Row row;
+		if (not transition_index_->find(transition_id, row)) {
+			return {};
+		}
+		return row_event_at(row.begin_transition_id, row.end_transition_id, row.block_id, transition_id);
+	}
+
+	if (chunked_) {
+		return chunked_event_at(transition_id);
+	}
+
 	// find next block
-	stmt_after_.reset();
-	stmt_after_.bind_arg_throw(1, transition_id, "transition_id");
-	if (stmt_after_.step() == sqlite::Statement::StepResult::Done) {
+	stmt_after_->reset();
+	stmt_after_->bind_arg_throw(1, transition_id, "transition_id");
+	if (stmt_after_->step() == sqlite::Statement::StepResult::Done) {
 		return {};
 	}
 
-	std::uint64_t end_transition_id = stmt_after_.column_u64(0);
-	std::int32_t block_id = stmt_after_.column_i32(1);
+	std::uint64_t end_transition_id = stmt_after_->column_u64(0);
+	std::int32_t block_id = stmt_after_->column_i32(1);
 
 	// find block right before the current transition
-	stmt_before_.reset();
+	stmt_before_->reset();
 	std::uint64_t begin_transition_id = 0;
-	stmt_before_.bind_arg_throw(1, transition_id, "transition_id");
-	if (stmt_before_.step() == sqlite::Statement::StepResult::Row) {
-		begin_transition_id = stmt_before_.column_u64(0);
+	stmt_before_->bind_arg_throw(1, transition_id, "transition_id");
+	if (stmt_before_->step() == sqlite::Statement::StepResult::Row) {
+		begin_transition_id = stmt_before_->column_u64(0);
 	} // else block_begin remains at 0;
 
+	return row_event_at(begin_transition_id, end_transition_id, block_id, transition_id);
+}
+
+void Reader::events_at(const std::uint64_t* transition_ids, std::size_t count,
+                       std::vector<BlockExecutionEvent>& events) const
+{
+	if (not std::is_sorted(transition_ids, transition_ids + count)) {
+		throw std::logic_error("events_at: the transitions are not sorted");
+	}
+	events.clear();
+	if (count == 0) {
+		return;
+	}
+
+	auto row_event = [this](std::uint64_t begin_transition_id, std::uint64_t end_transition_id, std::int32_t block_id,
+	                        std::uint64_t transition_id) {
+		return row_event_at(begin_transition_id, end_transition_id, block_id, transition_id);
+	};
+
+	std::uint64_t begin_transition_id;
+	if (transition_index_) {
+		auto cursor = transition_index_->seek(transition_ids[0], begin_transition_id);
+		merge_rows(transition_ids, count, events, begin_transition_id,
+		           [&cursor](std::uint64_t& transition_id, std::int32_t& block_id) {
+		               return cursor.next(transition_id, block_id);
+		           }, row_event);
+		return;
+	}
+
+	auto rows = execution_rows_from(transition_ids[0], begin_transition_id);
+	merge_rows(transition_ids, count, events, begin_transition_id,
+	           [&rows](std::uint64_t& transition_id, std::int32_t& block_id) {
+	               return rows.next(transition_id, block_id);
+	           }, row_event);
+}
+
+std::experimental::optional<BlockExecutionEvent> Reader::chunked_event_at(std::uint64_t transition_id) const
+{
+	// find the last chunk that begins at or before the transition
+	const auto chunk = std::upper_bound(chunk_begins_.begin(), chunk_begins_.end(), transition_id) -
+	                   chunk_begins_.begin();
+	if (chunk == 0) {
+		return {};
+	}
+
+	stmt_chunk_->reset();
+	stmt_chunk_->bind_arg(1, chunk_ids_[chunk - 1], "id");
+	if (stmt_chunk_->step() != sqlite::Statement::StepResult::Row) {
+		throw std::runtime_error("Unknown execution chunk");
+	}
+	const auto data = stmt_chunk_->column_blob(0);
+	const auto* cursor = reinterpret_cast<const std::uint8_t*>(std::get<0>(data));
+	const auto* end = cursor + std::get<1>(data);
+
+	std::uint64_t end_transition_id = chunk_begins_[chunk - 1];
+	while (cursor != end) {
+		const auto begin_transition_id = end_transition_id;
+		std::int32_t block_id;
+		detail::decode_execution_row(cursor, end, end_transition_id, block_id);
+		if (transition_id < end_transition_id) {
+			return row_event_at(begin_transition_id, end_transition_id, block_id, transition_id);
+		}
+	}
+
+	// past the end of the trace
+	return {};
+}
+
+BlockExecutionEvent Reader::row_event_at(std::uint64_t begin_transition_id, std::uint64_t end_transition_id,
+                                         std::int32_t block_id, std::uint64_t transition_id) const
+{
+	if (block_id < 0) {
+		return execution_run(-block_id).event_at(begin_transition_id, transition_id);
+	}
+
 	return BlockExecutionEvent{begin_transition_id, end_transition_id, BlockHandle{block_id}};
 }
 
 std::experimental::optional<Interrupt> Reader::interrupt_at(std::uint64_t transition_id) const
 {
-	stmt_interrupt_at_.reset();
-	stmt_interrupt_at_.bind_arg_throw(1, transition_id, "transition_id");
-	if (stmt_interrupt_at_.step() == sqlite::Statement::StepResult::Done) {
+	if (flat_) {
+		const auto* interrupt = flat_->find_interrupt(transition_id);
+		if (interrupt == nullptr) {
+			return {};
+		}
+		return Interrupt(interrupt->pc, static_cast<ExecutionMode>(interrupt->mode), interrupt->number,
+		                 interrupt->is_hw != 0, BlockHandle{interrupt->related_block_id});
+	}
+
+	stmt_interrupt_at_->reset();
+	stmt_interrupt_at_->bind_arg_throw(1, transition_id, "transition_id");
+	if (stmt_interrupt_at_->step() == sqlite::Statement::StepResult::Done) {
 		return {};
 	}
 
-	std::uint64_t pc = stmt_interrupt_at_.column_u64(0);
-	ExecutionMode mode = static_cast<ExecutionMode>(stmt_interrupt_at_.column_i32(1));
-	std::int32_t number = stmt_interrupt_at_.column_i32(2);
-	bool is_hw = stmt_interrupt_at_.column_i32(3) != 0;
-	BlockHandle block_handle = BlockHandle{ stmt_interrupt_at_.column_i32(4) };
+	std::uint64_t pc = stmt_interrupt_at_->column_u64(0);
+	ExecutionMode mode = static_cast<ExecutionMode>(stmt_interrupt_at_->column_i32(1));
+	std::int32_t number = stmt_interrupt_at_->column_i32(2);
+	bool is_hw = stmt_interrupt_at_->column_i32(3) != 0;
+	BlockHandle block_handle = BlockHandle{ stmt_interrupt_at_->column_i32(4) };
 	return Interrupt(pc, mode, number, is_hw, block_handle);
 }
 
@@ -148,91 +602,831 @@ std::experimental::optional<Span> Reader::related_instruction_data(const Interru
 
 	std::uint64_t interrupt_offset = interrupt.pc - db_block.first_pc;
 
+	// The offsets of the instructions after the first one: the instruction begins either at 0 or at one of them, and
+	// ends at the next one.
+	const auto instruction_indexes = cached_instruction_indexes(interrupt.handle_, db_block);
 	std::uint64_t begin = 0;
+	if (interrupt_offset != 0) {
+		if (find_instruction_offset(*instruction_indexes, interrupt_offset) == instruction_indexes->end()) {
+			return {};
+		}
+		begin = interrupt_offset;
+	}
 
-	stmt_block_inst_.reset();
-	stmt_block_inst_.bind_arg(1, interrupt.handle_.handle_, "rowid");
-	while (stmt_block_inst_.step() == sqlite::Statement::StepResult::Row) {
-		std::uint32_t end = stmt_block_inst_.column_u32(0);
+	const auto next = next_instruction_offset(*instruction_indexes, begin);
+	if (next != instruction_indexes->end()) {
+		std::size_t size = *next - begin;
+		auto* data = db_block.instruction_data.data() + begin;
+		return Span{size, data};
+	}
+
+	// At this point we are at the last possible offset
+	std::uint64_t end = db_block.instruction_data.size();
+	std::size_t size = end - begin;
+	// If we never executed the entire block, we may mistakenly take bytes from instructions further in this block.
+	// Without a disassembler, we have absolutely no way of distinguishing where to end the instruction,
+	// so (like in the existing context-based transition implementation), we will have to take more bytes.
+	// For performance reasons, we limit this to the maximal number of bytes a x86 instruction can contain: 15.
+	if (size > 15) {
+		size = 15;
+	}
+	auto* data = db_block.instruction_data.data() + begin;
+	return Span{size, data};
+}
 
-		if (begin == interrupt_offset) {
-			std::size_t size = end - begin;
-			auto* data = db_block.instruction_data.data() + begin;
-			return Span{size, data};
+bool Reader::EventQuery::next()
+{
+	if (run_ != nullptr and run_cursor_ < run_end_) {
+		const auto begin_transition_id = run_cursor_;
+		run_cursor_ += run_->ends[run_step_] - (run_step_ == 0 ? 0 : run_->ends[run_step_ - 1]);
+		event_ = BlockExecutionEvent{begin_transition_id, run_cursor_, BlockHandle{run_->block_ids[run_step_]}};
+		run_step_ = (run_step_ + 1) % run_->block_ids.size();
+		return begin_transition_id < end_transition_id_;
+	}
+	run_ = nullptr;
+
+	std::uint64_t begin_transition_id;
+	std::uint64_t end_transition_id;
+	std::int32_t block_id;
+	// skip the rows before the range
+	do {
+		if (not rows_.next(end_transition_id, block_id)) {
+			finished_ = true;
+			return false;
 		}
+		begin_transition_id = previous_transition_id_;
+		previous_transition_id_ = end_transition_id;
+	} while (end_transition_id <= begin_transition_id_);
 
-		begin = end;
+	if (block_id < 0) {
+		run_ = &reader_->execution_run(-block_id);
+		run_end_ = end_transition_id;
+		run_cursor_ = begin_transition_id;
+		run_step_ = 0;
+		if (begin_transition_id_ > begin_transition_id) {
+			// start with the event of the run that contains the beginning of the range
+			const auto offset = begin_transition_id_ - begin_transition_id;
+			run_step_ = run_->step_at(offset % run_->length());
+			run_cursor_ += offset / run_->length() * run_->length() +
+			               (run_step_ == 0 ? 0 : run_->ends[run_step_ - 1]);
+		}
+		return next();
 	}
 
-	// At this point we are at the last possible offset
-	if (begin == interrupt_offset) {
-		std::uint64_t end = db_block.instruction_data.size();
-		std::size_t size = end - begin;
-		// If we never executed the entire block, we may mistakenly take bytes from instructions further in this block.
-		// Without a disassembler, we have absolutely no way of distinguishing where to end the instruction,
-		// so (like in the existing context-based transition implementation), we will have to take more bytes.
-		// For performance reasons, we limit this to the maximal number of bytes a x86 instruction can contain: 15.
-		if (size > 15) {
-			size = 15;
+	event_ = BlockExecutionEvent{begin_transition_id, end_transition_id, BlockHandle{block_id}};
+	return begin_transition_id < end_transition_id_;
+}
+
+void Reader::EventQuery::resume()
+{
+	reader_->end_read_transaction();
+	rows_ = reader_->execution_rows_after(rows_, previous_transition_id_);
+	finished_ = false;
+}
+
+Reader::EventQuery Reader::query_events() const
+{
+	return EventQuery(*this, execution_rows());
+}
+
+Reader::EventQuery Reader::query_events(std::uint64_t begin_transition_id, std::uint64_t end_transition_id) const
+{
+	std::uint64_t previous_transition_id;
+	auto rows = execution_rows_from(begin_transition_id, previous_transition_id);
+	return EventQuery(*this, std::move(rows), previous_transition_id, begin_transition_id, end_transition_id);
+}
+
+bool Reader::ReverseEventQuery::next()
+{
+	if (run_ != nullptr and run_cursor_ > run_begin_) {
+		event_ = run_->event_at(run_begin_, run_cursor_ - 1);
+		run_cursor_ = event_.begin_transition_id;
+		return true;
+	}
+	run_ = nullptr;
+
+	std::uint64_t begin_transition_id;
+	std::uint64_t end_transition_id;
+	std::int32_t block_id;
+	if (not rows_.previous(begin_transition_id, end_transition_id, block_id)) {
+		return false;
+	}
+	const bool first_row = first_row_;
+	first_row_ = false;
+
+	if (block_id < 0) {
+		run_ = &reader_->execution_run(-block_id);
+		run_begin_ = begin_transition_id;
+		run_cursor_ = end_transition_id;
+		if (first_row and transition_id_ < end_transition_id) {
+			// start with the event of the run that contains the transition
+			run_cursor_ = transition_id_ + 1;
 		}
-		auto* data = db_block.instruction_data.data() + begin;
-		return Span{size, data};
+		return next();
 	}
 
-	return {};
+	event_ = BlockExecutionEvent{begin_transition_id, end_transition_id, BlockHandle{block_id}};
+	return true;
 }
 
-struct EventQueryState {
-	std::uint64_t previous_transition_id = 0;
+bool Reader::InstructionQuery::next_event()
+{
+	do {
+		if (not events_.next()) {
+			return false;
+		}
+		const auto& event = events_.value();
+		event_begin_transition_id_ = event.begin_transition_id;
+		transition_id_ = std::max(event.begin_transition_id, begin_transition_id_);
+		event_end_transition_id_ = std::min(event.end_transition_id, end_transition_id_);
+	} while (transition_id_ >= event_end_transition_id_);
+
+	const auto handle = events_.value().block_handle;
+	value_.is_instruction = events_.value().has_instructions();
+	if (not value_.is_instruction) {
+		instructions_ = nullptr;
+		return true;
+	}
+
+	auto it = block_index_.find(handle.handle_);
+	if (it != block_index_.end()) {
+		blocks_.splice(blocks_.begin(), blocks_, it->second);
+	} else {
+		// bound the memory of long queries, by evicting the least recently used block
+		if (blocks_.size() >= INSTRUCTION_QUERY_MAX_BLOCKS) {
+			block_index_.erase(blocks_.back().first);
+			blocks_.pop_back();
+		}
+		blocks_.emplace_front(handle.handle_, reader_->block_with_instructions(handle, {}));
+		block_index_.emplace(handle.handle_, blocks_.begin());
+	}
+	instructions_ = &blocks_.front().second;
+	value_.mode = instructions_->block().mode;
+	return true;
+}
+
+Reader::InstructionQuery Reader::query_instructions(std::uint64_t begin_transition_id,
+                                                    std::uint64_t end_transition_id) const
+{
+	return InstructionQuery(*this, query_events(begin_transition_id, end_transition_id), begin_transition_id,
+	                        end_transition_id);
+}
+
+struct Reader::PrefetchedEventQuery::State {
+	// The worker Reader shares the block cache of the Reader that created the query
+	State(const Reader& reader, std::size_t window) :
+	    worker(Reader::open(reader.filename_.c_str(), ReaderOptions{}, reader.cache_, nullptr, nullptr)),
+	    // each record is prefixed by its size
+	    ring(window * (sizeof(std::uint64_t) + sizeof(BlockExecutionEvent)))
+	{}
+
+	~State() {
+		stop.store(true, std::memory_order_release);
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	Reader worker;
+	detail::SpscRing ring;
+	std::atomic<bool> stop{false};
+	std::exception_ptr error;
+	std::thread thread;
+
+	// Consumer: the end of the events was reached
+	bool finished = false;
+
+	// Background thread: push the events, then an empty record at the end or on error
 
-	BlockExecutionEvent operator()(sqlite::Statement& stmt) {
-		std::uint64_t end_transition_id = stmt.column_u64(0);
-		std::int32_t block_id = stmt.column_i32(1);
+	void run() {
+		try {
+			for (const auto& event : worker.query_events()) {
+				if (event.has_instructions()) {
+					worker.block_with_instructions(event.block_handle, {});
+				}
+				if (not push(&event, sizeof(event))) {
+					return;
+				}
+			}
+		} catch (...) {
+			error = std::current_exception();
+		}
+		push(nullptr, 0);
+	}
 
-		auto event = BlockExecutionEvent{previous_transition_id, end_transition_id, BlockHandle{block_id}};
-		previous_transition_id = end_transition_id;
-		return event;
+	//! Returns false if the query was destroyed while waiting for room in the ring
+	bool push(const void* data, std::size_t size) {
+		std::uint8_t* storage;
+		std::uint32_t idle = 0;
+		while ((storage = ring.try_reserve(size)) == nullptr) {
+			if (stop.load(std::memory_order_acquire)) {
+				return false;
+			}
+			wait(idle);
+		}
+		if (size != 0) {
+			std::memcpy(storage, data, size);
+		}
+		ring.commit();
+		return true;
+	}
+
+	static void wait(std::uint32_t& idle) {
+		if (++idle > SPIN_COUNT) {
+			std::this_thread::sleep_for(IDLE_SLEEP);
+		} else {
+			std::this_thread::yield();
+		}
 	}
 };
 
-Reader::EventQuery Reader::query_events() const
+Reader::PrefetchedEventQuery::PrefetchedEventQuery(const Reader& reader, std::size_t window) :
+    state_(new State(reader, window))
+{
+	auto* state = state_.get();
+	state_->thread = std::thread([state]() { state->run(); });
+}
+
+Reader::PrefetchedEventQuery::~PrefetchedEventQuery() = default;
+Reader::PrefetchedEventQuery::PrefetchedEventQuery(PrefetchedEventQuery&&) = default;
+Reader::PrefetchedEventQuery& Reader::PrefetchedEventQuery::operator=(PrefetchedEventQuery&&) = default;
+
+bool Reader::PrefetchedEventQuery::next()
+{
+	if (state_->finished) {
+		return false;
+	}
+
+	std::size_t size;
+	const std::uint8_t* storage;
+	std::uint32_t idle = 0;
+	while ((storage = state_->ring.front(size)) == nullptr) {
+		State::wait(idle);
+	}
+
+	if (size == 0) {
+		state_->ring.pop(size);
+		state_->finished = true;
+		// the background thread does not touch the error once it pushed the last record
+		if (state_->error) {
+			std::rethrow_exception(state_->error);
+		}
+		return false;
+	}
+
+	std::memcpy(&event_, storage, sizeof(event_));
+	state_->ring.pop(size);
+	return true;
+}
+
+Reader::PrefetchedEventQuery Reader::query_events_prefetched(std::size_t window) const
+{
+	if (filename_.empty()) {
+		throw std::logic_error("query_events_prefetched requires a Reader opened from a file");
+	}
+	return PrefetchedEventQuery(*this, window);
+}
+
+Reader::ReverseEventQuery Reader::query_events_reverse(std::uint64_t transition_id) const
+{
+	return ReverseEventQuery(*this, transition_id);
+}
+
+Reader::ReverseExecutionRows::ReverseExecutionRows(const Reader& reader, std::uint64_t transition_id) :
+    reader_(&reader), transition_id_(transition_id)
+{
+	if (reader.flat_) {
+		// up to the event that contains the transition, or the last event
+		batch_ = std::min(reader.flat_->find_event(transition_id) + 1, reader.flat_->event_count());
+		return;
+	}
+
+	if (reader.transition_index_) {
+		if (reader.transition_index_->sample_count() != 0) {
+			batch_ = reader.transition_index_->sample_at(transition_id) + 1;
+		}
+		return;
+	}
+
+	if (reader.chunked_) {
+		// up to the last chunk that begins at or before the transition
+		batch_ = std::upper_bound(reader.chunk_begins_.begin(), reader.chunk_begins_.end(), transition_id) -
+		         reader.chunk_begins_.begin();
+		return;
+	}
+
+	// from the row that contains the transition, or from the last row
+	stmt_.reset(new sqlite::Statement(*reader.db_,
+	                                  "SELECT transition_id, block_id FROM execution "
+	                                  "WHERE transition_id <= "
+	                                  "IFNULL((SELECT MIN(transition_id) FROM execution WHERE transition_id > ?), "
+	                                  "       (SELECT MAX(transition_id) FROM execution)) "
+	                                  "ORDER BY transition_id DESC;"));
+	stmt_->bind_arg_throw(1, transition_id, "transition_id");
+	read_ahead();
+}
+
+void Reader::ReverseExecutionRows::read_ahead()
 {
-	sqlite::Statement stmt(db_, "SELECT transition_id, block_id FROM execution ORDER BY transition_id ASC;");
+	has_next_ = stmt_->step() == sqlite::Statement::StepResult::Row;
+	if (has_next_) {
+		next_end_transition_id_ = stmt_->column_u64(0);
+		next_block_id_ = stmt_->column_i32(1);
+	}
+}
+
+bool Reader::ReverseExecutionRows::previous(std::uint64_t& begin_transition_id, std::uint64_t& end_transition_id,
+                                            std::int32_t& block_id)
+{
+	if (stmt_) {
+		if (not has_next_) {
+			return false;
+		}
+		end_transition_id = next_end_transition_id_;
+		block_id = next_block_id_;
+		read_ahead();
+		begin_transition_id = has_next_ ? next_end_transition_id_ : 0;
+		return true;
+	}
 
-	return EventQuery(std::move(stmt), EventQueryState{});
+	if (reader_->flat_) {
+		if (batch_ == 0) {
+			return false;
+		}
+		--batch_;
+		const auto& event = reader_->flat_->event(batch_);
+		begin_transition_id = reader_->flat_->event_begin(batch_);
+		end_transition_id = event.end_transition_id;
+		block_id = event.block_id;
+		return true;
+	}
+
+	while (ends_.empty()) {
+		if (not load_previous_batch()) {
+			return false;
+		}
+	}
+
+	end_transition_id = ends_.back();
+	block_id = block_ids_.back();
+	ends_.pop_back();
+	block_ids_.pop_back();
+	begin_transition_id = ends_.empty() ? batch_begin_transition_id_ : ends_.back();
+	return true;
+}
+
+bool Reader::ReverseExecutionRows::load_previous_batch()
+{
+	if (batch_ == 0) {
+		return false;
+	}
+	--batch_;
+
+	ends_.clear();
+	block_ids_.clear();
+	std::uint64_t end_transition_id;
+	std::int32_t block_id;
+	if (reader_->transition_index_) {
+		auto cursor = reader_->transition_index_->sample_rows(batch_, batch_begin_transition_id_);
+		while (cursor.next(end_transition_id, block_id)) {
+			ends_.push_back(end_transition_id);
+			block_ids_.push_back(block_id);
+		}
+	} else {
+		auto& stmt = *reader_->stmt_chunk_;
+		stmt.reset();
+		stmt.bind_arg(1, reader_->chunk_ids_[batch_], "id");
+		if (stmt.step() != sqlite::Statement::StepResult::Row) {
+			throw std::runtime_error("Unknown execution chunk");
+		}
+		const auto data = stmt.column_blob(0);
+		const auto* cursor = reinterpret_cast<const std::uint8_t*>(std::get<0>(data));
+		const auto* end = cursor + std::get<1>(data);
+
+		batch_begin_transition_id_ = reader_->chunk_begins_[batch_];
+		end_transition_id = batch_begin_transition_id_;
+		while (cursor != end) {
+			detail::decode_execution_row(cursor, end, end_transition_id, block_id);
+			ends_.push_back(end_transition_id);
+			block_ids_.push_back(block_id);
+		}
+		stmt.reset();
+	}
+
+	// drop the rows after the one that contains the transition the query starts from, if it is in this batch
+	const auto last = std::upper_bound(ends_.begin(), ends_.end(), transition_id_);
+	if (last != ends_.end()) {
+		ends_.erase(last + 1, ends_.end());
+		block_ids_.resize(ends_.size());
+	}
+	return true;
+}
+
+bool Reader::TransitionQuery::next()
+{
+	if (not interrupts_.next()) {
+		return false;
+	}
+	transition_id_ = interrupts_.value().transition_id;
+	return true;
 }
 
 Reader::TransitionQuery Reader::query_non_instructions() const
 {
-	sqlite::Statement stmt(db_, "SELECT transition_id FROM execution WHERE block_id = 1 ORDER BY transition_id ASC;");
+	// The Writer records an interrupt with each event of the interrupt block, at the beginning of the event. The
+	// execution table has no index on the blocks, and the chunks would all have to be decoded.
+	return TransitionQuery(query_interrupts(0, std::numeric_limits<std::uint64_t>::max()));
+}
+
+Reader::InterruptQuery Reader::query_interrupts(std::uint64_t begin_transition_id, std::uint64_t end_transition_id,
+                                                InterruptFilter filter) const
+{
+	if (flat_) {
+		return InterruptQuery(*flat_, flat_->interrupt_index(begin_transition_id),
+		                      flat_->interrupt_index(end_transition_id), std::move(filter));
+	}
+
+	// An equality on the number selects the interrupts_number index, whose rows are in transition order
+	std::string query = "SELECT transition_id, pc, mode, number, is_hw, related_instruction_block_id "
+	                    "FROM interrupts WHERE transition_id >= ? AND transition_id < ?";
+	if (filter.number) {
+		query += " AND number = ?";
+	}
+	if (filter.is_hw) {
+		query += " AND is_hw = ?";
+	}
+	if (filter.mode) {
+		query += " AND mode = ?";
+	}
+	query += " ORDER BY transition_id ASC;";
+
+	sqlite::Statement stmt(*db_, query.c_str());
+	// the transitions are stored as signed integers
+	const std::uint64_t max_transition_id = std::numeric_limits<std::int64_t>::max();
+	stmt.bind_arg(1, std::min(begin_transition_id, max_transition_id), "begin_transition_id");
+	stmt.bind_arg(2, std::min(end_transition_id, max_transition_id), "end_transition_id");
+	int arg = 3;
+	if (filter.number) {
+		stmt.bind_arg(arg++, *filter.number, "number");
+	}
+	if (filter.is_hw) {
+		stmt.bind_arg(arg++, static_cast<int>(*filter.is_hw), "is_hw");
+	}
+	if (filter.mode) {
+		stmt.bind_arg(arg++, static_cast<int>(*filter.mode), "mode");
+	}
+	return InterruptQuery(std::move(stmt));
+}
+
+bool Reader::InterruptQuery::next()
+{
+	if (flat_) {
+		for (; flat_index_ < flat_end_; ++flat_index_) {
+			const auto& interrupt = flat_->interrupt(flat_index_);
+			if ((filter_.number and interrupt.number != *filter_.number) or
+			    (filter_.is_hw and (interrupt.is_hw != 0) != *filter_.is_hw) or
+			    (filter_.mode and static_cast<ExecutionMode>(interrupt.mode) != *filter_.mode)) {
+				continue;
+			}
+			value_ = TransitionInterrupt{interrupt.transition_id,
+			                             Interrupt(interrupt.pc, static_cast<ExecutionMode>(interrupt.mode),
+			                                       interrupt.number, interrupt.is_hw != 0,
+			                                       BlockHandle{interrupt.related_block_id})};
+			++flat_index_;
+			return true;
+		}
+		return false;
+	}
+
+	if (stmt_->step() != sqlite::Statement::StepResult::Row) {
+		return false;
+	}
+	value_ = TransitionInterrupt{stmt_->column_u64(0),
+	                             Interrupt(stmt_->column_u64(1), static_cast<ExecutionMode>(stmt_->column_i32(2)),
+	                                       stmt_->column_u32(3), stmt_->column_i32(4) != 0,
+	                                       BlockHandle{stmt_->column_i32(5)})};
+	return true;
+}
+
+Reader::ExecutionRows Reader::execution_rows() const
+{
+	if (flat_) {
+		return ExecutionRows(*flat_, 0);
+	}
+
+	if (chunked_) {
+		return ExecutionRows(sqlite::Statement(*db_, "SELECT id, data FROM execution_chunks ORDER BY id ASC;"), true);
+	}
+
+	return ExecutionRows(sqlite::Statement(*db_, "SELECT transition_id, block_id FROM execution "
+	                                             "ORDER BY transition_id ASC;"), false);
+}
+
+Reader::ExecutionRows Reader::execution_rows_from(std::uint64_t transition_id,
+                                                  std::uint64_t& begin_transition_id) const
+{
+	if (flat_) {
+		const auto index = flat_->find_event(transition_id);
+		begin_transition_id = flat_->event_begin(index);
+		return ExecutionRows(*flat_, index);
+	}
 
-	return TransitionQuery(std::move(stmt), [](auto& stmt) -> std::uint64_t {
-		std::uint64_t next_transition_id = stmt.column_u64(0);
-		if (next_transition_id == 0) {
-			return 0;
+	if (chunked_) {
+		// the last chunk that begins at or before the transition
+		const auto chunk = std::upper_bound(chunk_begins_.begin(), chunk_begins_.end(), transition_id) -
+		                   chunk_begins_.begin();
+		if (chunk == 0) {
+			begin_transition_id = 0;
+			return execution_rows();
 		}
-		return next_transition_id - 1;
-	});
+
+		begin_transition_id = chunk_begins_[chunk - 1];
+		sqlite::Statement stmt(*db_, "SELECT id, data FROM execution_chunks WHERE id >= ? ORDER BY id ASC;");
+		stmt.bind_arg(1, chunk_ids_[chunk - 1], "id");
+		return ExecutionRows(std::move(stmt), true, begin_transition_id);
+	}
+
+	// the end of the row before the one that contains the transition
+	stmt_before_->reset();
+	stmt_before_->bind_arg_throw(1, transition_id, "transition_id");
+	begin_transition_id = 0;
+	if (stmt_before_->step() == sqlite::Statement::StepResult::Row) {
+		begin_transition_id = stmt_before_->column_u64(0);
+	}
+	stmt_before_->reset();
+
+	sqlite::Statement stmt(*db_, "SELECT transition_id, block_id FROM execution "
+	                             "WHERE transition_id > ? "
+	                             "ORDER BY transition_id ASC;");
+	stmt.bind_arg_throw(1, begin_transition_id, "transition_id");
+	return ExecutionRows(std::move(stmt), false);
+}
+
+Reader::ExecutionRows Reader::execution_rows_after(const ExecutionRows& rows, std::uint64_t transition_id) const
+{
+	if (flat_) {
+		// no events are added to a flat trace
+		return ExecutionRows(*flat_, flat_->event_count());
+	}
+
+	if (chunked_) {
+		// the chunks are inserted in order, and the last chunk that was read was read entirely
+		sqlite::Statement stmt(*db_, "SELECT id, data FROM execution_chunks WHERE id > ? ORDER BY id ASC;");
+		stmt.bind_arg(1, rows.chunk_id(), "id");
+		return ExecutionRows(std::move(stmt), true, transition_id, rows.chunk_id());
+	}
+
+	sqlite::Statement stmt(*db_, "SELECT transition_id, block_id FROM execution "
+	                             "WHERE transition_id > ? "
+	                             "ORDER BY transition_id ASC;");
+	stmt.bind_arg_throw(1, transition_id, "transition_id");
+	return ExecutionRows(std::move(stmt), false);
+}
+
+bool Reader::ExecutionRows::next(std::uint64_t& transition_id, std::int32_t& block_id)
+{
+	if (flat_) {
+		if (flat_index_ == flat_->event_count()) {
+			return false;
+		}
+		const auto& event = flat_->event(flat_index_++);
+		transition_id = event.end_transition_id;
+		block_id = event.block_id;
+		return true;
+	}
+
+	if (not chunked_) {
+		if (stmt_->step() != sqlite::Statement::StepResult::Row) {
+			return false;
+		}
+		transition_id = stmt_->column_u64(0);
+		block_id = stmt_->column_i32(1);
+		return true;
+	}
+
+	// The chunk data remains valid until the next step
+	while (chunk_ == chunk_end_) {
+		if (stmt_->step() != sqlite::Statement::StepResult::Row) {
+			return false;
+		}
+		chunk_id_ = stmt_->column_i64(0);
+		const auto data = stmt_->column_blob(1);
+		chunk_ = reinterpret_cast<const std::uint8_t*>(std::get<0>(data));
+		chunk_end_ = chunk_ + std::get<1>(data);
+	}
+
+	detail::decode_execution_row(chunk_, chunk_end_, transition_id_, block_id);
+	transition_id = transition_id_;
+	return true;
 }
 
 InstructionBlock Reader::fetch_from_db(BlockHandle handle) const
 {
-	stmt_block_.reset();
-	stmt_block_.bind_arg(1, handle.handle_, "rowid");
-	if (stmt_block_.step() != sqlite::Statement::StepResult::Row) {
+	if (flat_) {
+		const auto* block = flat_->block(handle.handle_);
+		if (block == nullptr) {
+			throw std::runtime_error("Unknown block_id");
+		}
+		const auto* data = flat_->block_data(*block);
+		return InstructionBlock{{data, data + block->data_size}, block->first_pc, block->instruction_count,
+		                        static_cast<ExecutionMode>(block->mode)};
+	}
+
+	stmt_block_->reset();
+	stmt_block_->bind_arg(1, handle.handle_, "rowid");
+	if (stmt_block_->step() != sqlite::Statement::StepResult::Row) {
 		throw std::runtime_error("Unknown block_id");
 	}
 
-	auto pc = stmt_block_.column_u64(0);
-	auto inst_data = stmt_block_.column_blob(1);
+	auto pc = stmt_block_->column_u64(0);
+	auto inst_data = stmt_block_->column_blob(1);
 	const uint8_t* inst_data_buf = reinterpret_cast<const uint8_t*>(std::get<0>(inst_data));
 	std::size_t inst_data_size = std::get<1>(inst_data);
-	std::uint16_t inst_count = stmt_block_.column_i32(2);
-	ExecutionMode mode = static_cast<ExecutionMode>(stmt_block_.column_i32(3));
+	std::uint16_t inst_count = stmt_block_->column_i32(2);
+	ExecutionMode mode = static_cast<ExecutionMode>(stmt_block_->column_i32(3));
 
 	return InstructionBlock{{inst_data_buf, inst_data_buf + inst_data_size}, pc, inst_count, mode};
 }
 
+const Reader::ExecutionRun& Reader::execution_run(std::int64_t run_id) const
+{
+	auto it = runs_.find(run_id);
+	if (it != runs_.end()) {
+		return it->second;
+	}
+
+	if (not stmt_run_) {
+		throw std::runtime_error("Unknown execution run");
+	}
+	stmt_run_->reset();
+	stmt_run_->bind_arg(1, run_id, "id");
+	if (stmt_run_->step() != sqlite::Statement::StepResult::Row) {
+		throw std::runtime_error("Unknown execution run");
+	}
+
+	const auto pattern = stmt_run_->column_blob(0);
+	const auto steps = detail::decode_run_pattern(reinterpret_cast<const std::uint8_t*>(std::get<0>(pattern)),
+	                                              std::get<1>(pattern));
+
+	ExecutionRun run;
+	std::uint64_t end = 0;
+	for (const auto& step : steps) {
+		end += step.length;
+		run.block_ids.push_back(step.block_id);
+		run.ends.push_back(end);
+	}
+	return runs_.emplace(run_id, std::move(run)).first->second;
+}
+
+BlockExecutionEvent Reader::ExecutionRun::event_at(std::uint64_t run_begin, std::uint64_t transition_id) const
+{
+	const auto offset = transition_id - run_begin;
+	const auto iteration_begin = run_begin + offset / length() * length();
+	const auto step = step_at(offset % length());
+
+	const auto begin_transition_id = iteration_begin + (step == 0 ? 0 : ends[step - 1]);
+	return BlockExecutionEvent{begin_transition_id, iteration_begin + ends[step], BlockHandle{block_ids[step]}};
+}
+
+std::size_t Reader::ExecutionRun::step_at(std::uint64_t offset) const
+{
+	return std::upper_bound(ends.begin(), ends.end(), offset) - ends.begin();
+}
+
+void Reader::pc_instructions(std::uint64_t pc, std::vector<PcInstruction>& instructions) const
+{
+	if (not execution_index_) {
+		load_execution_index();
+	}
+
+	std::vector<std::int32_t> block_ids;
+	execution_index_->blocks_at(pc, block_ids);
+
+	instructions.clear();
+	for (const auto block_id : block_ids) {
+		const BlockHandle handle{block_id};
+		const auto block = cached_block(handle);
+
+		// pc must be the beginning of an instruction of the block
+		const auto offset = pc - block->first_pc;
+		std::uint32_t instruction_index = 0;
+		if (offset != 0) {
+			const auto indexes = cached_instruction_indexes(handle, *block);
+			const auto it = find_instruction_offset(*indexes, offset);
+			if (it == indexes->end()) {
+				continue;
+			}
+			instruction_index = it - indexes->begin() + 1;
+		}
+		instructions.push_back(PcInstruction{block_id, instruction_index});
+	}
+}
+
+std::experimental::optional<std::uint64_t> Reader::next_execution(const std::vector<PcInstruction>& instructions,
+                                                                  std::uint64_t transition_id) const
+{
+	std::experimental::optional<std::uint64_t> first;
+	for (const auto& instruction : instructions) {
+		std::uint64_t execution;
+		if (execution_index_->next(instruction.block_id, instruction.instruction_index, transition_id, execution) and
+		    (not first or execution < *first)) {
+			first = execution;
+		}
+	}
+	return first;
+}
+
+std::experimental::optional<std::uint64_t> Reader::next_execution(std::uint64_t pc, std::uint64_t transition_id) const
+{
+	std::vector<PcInstruction> instructions;
+	pc_instructions(pc, instructions);
+	return next_execution(instructions, transition_id);
+}
+
+std::experimental::optional<std::uint64_t> Reader::prev_execution(std::uint64_t pc, std::uint64_t transition_id) const
+{
+	std::vector<PcInstruction> instructions;
+	pc_instructions(pc, instructions);
+
+	std::experimental::optional<std::uint64_t> last;
+	for (const auto& instruction : instructions) {
+		std::uint64_t execution;
+		if (execution_index_->previous(instruction.block_id, instruction.instruction_index, transition_id,
+		                               execution) and
+		    (not last or execution > *last)) {
+			last = execution;
+		}
+	}
+	return last;
+}
+
+Reader::ExecutionQuery Reader::executions_of(std::uint64_t pc, std::uint64_t begin_transition_id,
+                                             std::uint64_t end_transition_id) const
+{
+	std::vector<PcInstruction> instructions;
+	pc_instructions(pc, instructions);
+	return ExecutionQuery(*this, std::move(instructions), begin_transition_id, end_transition_id);
+}
+
+bool Reader::ExecutionQuery::next()
+{
+	const auto transition_id = reader_->next_execution(instructions_, next_transition_id_);
+	if (not transition_id or *transition_id >= end_transition_id_) {
+		return false;
+	}
+	transition_id_ = *transition_id;
+	next_transition_id_ = transition_id_ + 1;
+	return true;
+}
+
+void Reader::export_flat_trace(const char* filename) const
+{
+	detail::FlatTraceWriter writer(filename);
+
+	for (const auto& event : query_events()) {
+		writer.add_event(event.end_transition_id, event.block_handle.handle_);
+	}
+
+	std::int64_t block_count;
+	if (flat_) {
+		for (std::uint64_t i = 0; i < flat_->interrupt_count(); ++i) {
+			writer.add_interrupt(flat_->interrupt(i));
+		}
+		block_count = flat_->block_count() - 1;
+	} else {
+		sqlite::Statement stmt(*db_, "SELECT transition_id, pc, mode, number, is_hw, related_instruction_block_id "
+		                             "FROM interrupts ORDER BY transition_id ASC;");
+		while (stmt.step() == sqlite::Statement::StepResult::Row) {
+			detail::FlatTrace::Interrupt interrupt = detail::FlatTrace::Interrupt();
+			interrupt.transition_id = stmt.column_u64(0);
+			interrupt.pc = stmt.column_u64(1);
+			interrupt.mode = static_cast<std::uint8_t>(stmt.column_i32(2));
+			interrupt.number = stmt.column_u32(3);
+			interrupt.is_hw = stmt.column_i32(4) != 0;
+			interrupt.related_block_id = stmt.column_i32(5);
+			writer.add_interrupt(interrupt);
+		}
+
+		sqlite::Statement stmt_count(*db_, "SELECT MAX(rowid) FROM blocks;");
+		stmt_count.step();
+		block_count = stmt_count.column_i64(0);
+	}
+
+	// The blocks are read without the cache, which would keep them all
+	std::vector<std::uint32_t> instruction_indexes;
+	for (std::int64_t block_id = 1; block_id <= block_count; ++block_id) {
+		const BlockHandle handle{static_cast<std::int32_t>(block_id)};
+		const auto block = fetch_from_db(handle);
+		instruction_indexes.clear();
+		if (block.instruction_count != 0) {
+			read_instruction_indexes(handle, instruction_indexes);
+		}
+		writer.add_block(block, instruction_indexes);
+	}
+
+	writer.finish();
+}
+
 metadata::Version Reader::resource_version()
 {
 	return metadata::Version::from_string(format_version);
@@ -0,0 +1,63 @@
+#include "block_table.h"
+
+#include <stdexcept>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+namespace {
+
+constexpr std::size_t INITIAL_CAPACITY = 1024;
+
+// Maximum load factor of the table, as a fraction. Linear probing degrades quickly beyond 3/4.
+constexpr std::size_t MAX_LOAD_NUMERATOR = 3;
+constexpr std::size_t MAX_LOAD_DENOMINATOR = 4;
+
+} // anonymous namespace
+
+BlockTable::BlockTable() :
+    entries_(INITIAL_CAPACITY, KnownBlock{Fingerprint{0, 0}, 0, 0}),
+    mask_(INITIAL_CAPACITY - 1)
+{}
+
+KnownBlock& BlockTable::insert(const Fingerprint& fingerprint, std::uint32_t id)
+{
+	if (id == 0) {
+		throw std::logic_error("BlockTable::insert: 0 is not a valid block id");
+	}
+
+	if ((size_ + 1) * MAX_LOAD_DENOMINATOR > entries_.size() * MAX_LOAD_NUMERATOR) {
+		grow();
+	}
+
+	auto slot = slot_of(fingerprint);
+	while (entries_[slot].id != 0) {
+		slot = (slot + 1) & mask_;
+	}
+
+	auto& entry = entries_[slot];
+	entry = KnownBlock{fingerprint, id, 0};
+	++size_;
+	return entry;
+}
+
+void BlockTable::grow()
+{
+	std::vector<KnownBlock> entries(entries_.size() * 2, KnownBlock{Fingerprint{0, 0}, 0, 0});
+	entries.swap(entries_);
+	mask_ = entries_.size() - 1;
+
+	for (const auto& entry : entries) {
+		if (entry.id == 0) {
+			continue;
+		}
+		auto slot = slot_of(entry.fingerprint);
+		while (entries_[slot].id != 0) {
+			slot = (slot + 1) & mask_;
+		}
+		entries_[slot] = entry;
+	}
+}
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <block_writer.h>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Entry of a block in a BlockTable
+struct KnownBlock {
+	Fingerprint fingerprint;
+	//! Id of the block in the database, 0 for an empty slot
+	std::uint32_t id;
+	//! Number of instruction offsets of the block already stored in the database
+	std::uint32_t executed_instructions;
+};
+
+//! Deduplication table of the blocks known to a Writer, indexed by their fingerprint.
+//!
+//! A flat open-addressing table with linear probing, whose entries are stored inline in a single array, so that
+//! each known block costs a bounded 24 bytes divided by the load factor, and a lookup touches one or two cache lines.
+//!
+//! Entries are never removed. Several entries may have the same fingerprint, when different blocks collide.
+class BlockTable {
+public:
+	BlockTable();
+
+	//! Retrieve the first entry with the fingerprint for which is_same(entry) is true, or nullptr if there is none.
+	//!
+	//! The pointer is invalidated by the next call to insert.
+	template <typename IsSame>
+	KnownBlock* find(const Fingerprint& fingerprint, IsSame&& is_same) {
+		for (auto slot = slot_of(fingerprint);; slot = (slot + 1) & mask_) {
+			auto& entry = entries_[slot];
+			if (entry.id == 0) {
+				return nullptr;
+			}
+			if (entry.fingerprint == fingerprint and is_same(static_cast<const KnownBlock&>(entry))) {
+				return &entry;
+			}
+		}
+	}
+
+	//! Retrieve the first entry with the fingerprint, or nullptr if there is none.
+	KnownBlock* find(const Fingerprint& fingerprint) {
+		return find(fingerprint, [](const KnownBlock&) { return true; });
+	}
+
+	//! Add a block, even if an entry with the same fingerprint is already in the table.
+	//!
+	//! The reference is invalidated by the next call to insert.
+	KnownBlock& insert(const Fingerprint& fingerprint, std::uint32_t id);
+
+	//! Number of blocks in the table
+	std::size_t size() const {
+		return size_;
+	}
+
+	//! Memory allocated by the table, in bytes
+	std::size_t memory_usage() const {
+		return entries_.capacity() * sizeof(KnownBlock);
+	}
+
+private:
+	std::size_t slot_of(const Fingerprint& fingerprint) const {
+		// The fingerprint is already uniformly distributed, so any of its words is a good hash
+		return static_cast<std::size_t>(fingerprint.low) & mask_;
+	}
+
+	void grow();
+
+	std::vector<KnownBlock> entries_;
+	std::size_t mask_;
+	std::size_t size_ = 0;
+};
+
+}}} // namespace reven::block::detail
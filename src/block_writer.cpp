@@ -1,21 +1,28 @@
 #include <block_writer.h>
 
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+
 #include <rvnmetadata/metadata-common.h>
 #include <rvnmetadata/metadata-sql.h>
 
-// Get the SHA1 implementation from boost details.
-// As of today this is the easiest way of getting a SHA1 implementation without adding a dedicated dependency.
-// Note that sha1.hpp is an implementation detail of Boost's UUID, and so subject to change/removal, etc.
-#include <boost/uuid/detail/sha1.hpp>
+#include "batch_insert.h"
+#include "block_table.h"
+#include "execution_chunks.h"
+#include "execution_runs.h"
+#include "fingerprint.h"
+#include "known_block_data.h"
+#include "instruction_offsets.h"
+#include "writer_stats.h"
 
 namespace reven {
 namespace block {
 namespace writer {
 
 namespace {
-// see boost::uuids::sha1::digest_type
-constexpr std::size_t DIGEST_SIZE = 5;
-
 using Db = sqlite::Database;
 using RDb = sqlite::ResourceDatabase;
 using Stmt = sqlite::Statement;
@@ -24,13 +31,67 @@ using Meta = ::reven::metadata::Metadata;
 using MetaType = ::reven::metadata::ResourceType;
 using MetaVersion = ::reven::metadata::Version;
 
-void create_sqlite_db(Db& db)
+const char* journal_mode_pragma(JournalMode mode)
+{
+	switch (mode) {
+		case JournalMode::Delete:
+			return "pragma journal_mode=delete";
+		case JournalMode::Truncate:
+			return "pragma journal_mode=truncate";
+		case JournalMode::Persist:
+			return "pragma journal_mode=persist";
+		case JournalMode::Memory:
+			return "pragma journal_mode=memory";
+		case JournalMode::Wal:
+			return "pragma journal_mode=wal";
+		case JournalMode::Off:
+			return "pragma journal_mode=off";
+	}
+	throw std::logic_error("Unknown journal mode");
+}
+
+const char* synchronous_pragma(Synchronous synchronous)
+{
+	switch (synchronous) {
+		case Synchronous::Off:
+			return "pragma synchronous=off";
+		case Synchronous::Normal:
+			return "pragma synchronous=normal";
+		case Synchronous::Full:
+			return "pragma synchronous=full";
+	}
+	throw std::logic_error("Unknown synchronous mode");
+}
+
+// Approximate size of the rows of each table, used for the commit_bytes threshold
+constexpr std::size_t BLOCK_ROW_SIZE = 24;
+constexpr std::size_t OFFSETS_UPDATE_SIZE = 16;
+constexpr std::size_t EXECUTION_ROW_SIZE = 12;
+constexpr std::size_t INTERRUPT_ROW_SIZE = 32;
+constexpr std::size_t RUN_ROW_SIZE = 16;
+constexpr std::size_t CHUNK_ROW_SIZE = 16;
+constexpr std::size_t EXECUTION_GAP_ROW_SIZE = 16;
+
+// Number of rows between two checks of the duration of the running transaction
+constexpr std::uint64_t COMMIT_INTERVAL_CHECK_ROWS = 256;
+
+void create_sqlite_db(Db& db, const WriterOptions& options)
 {
+	if (options.page_size != 0) {
+		// The database already contains the metadata, so the page size only takes effect after a vacuum
+		db.exec(("pragma page_size=" + std::to_string(options.page_size)).c_str(), "Pragma error");
+		db.exec("vacuum", "Cannot apply page size");
+	}
+	if (options.cache_size_kib != 0) {
+		db.exec(("pragma cache_size=-" + std::to_string(options.cache_size_kib)).c_str(), "Pragma error");
+	}
+
 	db.exec("create table blocks("
 	        "pc int8 not null,"
 	        "instruction_data blob not null,"
 	        "instruction_count int2 not null,"
-	        "mode int1 not null"
+	        "mode int1 not null,"
+	        "instruction_offsets blob not null"
 	        ");",
 	        "Can't create table blocks");
 	db.exec("create table execution("
@@ -38,13 +99,6 @@ void create_sqlite_db(Db& db)
 	        "block_id int4 not null"
 	        ") WITHOUT ROWID;",
 	        "Can't create table execution");
-	db.exec("CREATE TABLE instruction_indices("
-	        "block_id INTEGER NOT NULL,"
-	        "instruction_id INTEGER NOT NULL,"
-	        "instruction_index INTEGER NOT NULL,"
-	        "PRIMARY KEY (block_id, instruction_id)"
-	        ") WITHOUT ROWID;",
-	        "Can't create table instruction_indices");
 	db.exec("CREATE TABLE interrupts("
 	        "transition_id int8 PRIMARY KEY NOT NULL,"
 			"pc int8 NOT NULL,"
@@ -54,10 +108,30 @@ void create_sqlite_db(Db& db)
 			"related_instruction_block_id INTEGER NOT NULL"
 	        ") WITHOUT ROWID;",
 			"Can't create table interrupts");
+	// Filters on the interrupt number, see Reader::query_interrupts
+	db.exec("CREATE INDEX interrupts_number ON interrupts(number, transition_id);",
+	        "Can't create index interrupts_number");
+	db.exec("CREATE TABLE execution_runs("
+	        "id INTEGER PRIMARY KEY NOT NULL,"
+	        "pattern BLOB NOT NULL"
+	        ");",
+	        "Can't create table execution_runs");
+	if (options.chunked_execution) {
+		db.exec("CREATE TABLE execution_chunks("
+		        "id INTEGER PRIMARY KEY NOT NULL,"
+		        "data BLOB NOT NULL"
+		        ");",
+		        "Can't create table execution_chunks");
+		db.exec("CREATE TABLE execution_chunk_index("
+		        "begin_transition_id INTEGER PRIMARY KEY NOT NULL,"
+		        "chunk_id INTEGER NOT NULL"
+		        ");",
+		        "Can't create table execution_chunk_index");
+	}
 
-	db.exec("pragma synchronous=off", "Pragma error");
+	db.exec(synchronous_pragma(options.synchronous), "Pragma error");
 	db.exec("pragma count_changes=off", "Pragma error");
-	db.exec("pragma journal_mode=memory", "Pragma error");
+	db.exec(journal_mode_pragma(options.journal_mode), "Pragma error");
 	db.exec("pragma temp_store=memory", "Pragma error");
 }
 
@@ -71,84 +145,196 @@ Span interrupt_data() {
 }
 } // anonymous namespace
 
+void LatencyHistogram::add(std::uint64_t duration_ns)
+{
+	std::size_t bucket = 0;
+	while (bucket + 1 < buckets.size() and (duration_ns >> (bucket + 1)) != 0) {
+		++bucket;
+	}
+	++buckets[bucket];
+	++count;
+	total_ns += duration_ns;
+	max_ns = std::max(max_ns, duration_ns);
+}
+
+std::uint64_t LatencyHistogram::percentile(double fraction) const
+{
+	if (count == 0) {
+		return 0;
+	}
+	const auto rank = static_cast<std::uint64_t>(fraction * static_cast<double>(count));
+	std::uint64_t seen = 0;
+	for (std::size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+		seen += buckets[bucket];
+		if (seen > rank or seen == count) {
+			return std::min(max_ns, (std::uint64_t{2} << bucket) - 1);
+		}
+	}
+	return max_ns;
+}
 
-void Writer::reset_last_block(ExecutedBlock block, unsigned int* digest, reven::block::Span instruction_data)
+std::ostream& operator<<(std::ostream& os, const WriterStats& stats)
 {
-	last_instruction_data_.clear();
-	last_instruction_data_.insert(last_instruction_data_.end(),instruction_data.data,
-	                              instruction_data.data + instruction_data.size);
+	if (not stats.enabled) {
+		return os << "stats disabled (build with RVNBLOCK_WRITER_STATS)";
+	}
+	auto latency = [&os](const char* name, const LatencyHistogram& histogram) {
+		os << ", " << name << " p50 " << histogram.percentile(0.5) << " ns p99 " << histogram.percentile(0.99)
+		   << " ns max " << histogram.max_ns << " ns";
+	};
+	os << "blocks " << stats.blocks_added
+	   << ", instructions " << stats.instructions_added
+	   << ", interrupts " << stats.interrupts
+	   << ", dedup hits " << stats.dedup_hits
+	   << ", dedup misses " << stats.dedup_misses
+	   << ", offsets updates " << stats.instruction_offsets_updates
+	   << ", executions " << stats.executions
+	   << ", execution rows " << stats.execution_rows
+	   << ", commits " << stats.commits;
+	latency("add_block", stats.add_block_latency);
+	latency("commit", stats.commit_latency);
+	return os;
+}
+
+
+void Writer::reset_last_block(ExecutedBlock block, Fingerprint fingerprint, reven::block::Span instruction_data,
+                              bool borrowed)
+{
+	// check with all previously inserted blocks.
+	// The instruction data comes from the guest, which can craft blocks whose fingerprints collide, so a match is
+	// confirmed by comparing the blocks. A block that only collides is inserted as a new block.
+	last_known_block_ = block_table_->find(fingerprint, [&](const detail::KnownBlock& entry) {
+		return is_known_block(entry.id, block, instruction_data);
+	});
+	if (last_known_block_ != nullptr) {
+		last_instruction_span_ = Span{0, nullptr};
+	} else if (borrowed) {
+		last_instruction_span_ = instruction_data;
+	} else {
+		last_instruction_data_.clear();
+		last_instruction_data_.insert(last_instruction_data_.end(),instruction_data.data,
+		                              instruction_data.data + instruction_data.size);
+		last_instruction_span_ = Span{last_instruction_data_.size(), last_instruction_data_.data()};
+	}
 	last_block_ = block;
 	// A previous version of this function would set last_id_ = 0; This is probably not what we want because
 	// the value of the last inserted block is reused (e.g. when adding interrupts), and it being 0 is an error anyway.
-	last_hash_.clear();
+	last_fingerprint_ = fingerprint;
+	has_last_block_ = true;
 	last_block_instruction_indices_.clear();
+}
 
-	last_hash_.insert(last_hash_.end(), digest, digest + DIGEST_SIZE);
+void Writer::retain_last_instruction_data()
+{
+	if (last_instruction_span_.data == last_instruction_data_.data()) {
+		return;
+	}
+	last_instruction_data_.assign(last_instruction_span_.data, last_instruction_span_.data + last_instruction_span_.size);
+	last_instruction_span_ = Span{last_instruction_data_.size(), last_instruction_data_.data()};
 }
 
 void Writer::insert_last_block()
 {
-	// check with all previously inserted blocks
-	auto itbool = block_map_.insert({last_hash_, MappedBlock{0, 0, last_block_}});
-	auto& value = itbool.first->second;
-	if (itbool.second) {
+	auto* entry = last_known_block_;
+	if (entry == nullptr) {
 		// Is a new block
-		last_id_ = insert_block_db(last_block_, Span{last_instruction_data_.size(), last_instruction_data_.data()});
+		stats_->count(&WriterStats::dedup_misses);
+		detail::encode_instruction_offsets(last_block_instruction_indices_, offsets_buffer_);
+		last_id_ = insert_block_db(last_block_, last_instruction_span_,
+		                           Span{offsets_buffer_.size(), offsets_buffer_.data()});
 		if (last_id_ == 0) {
 			throw std::logic_error("last_id_ == 0 after insert_block_db_");
 		}
 
-		value.id = last_id_;
-	} else {
-		// Existing block, get back block ID
-		if (last_block_ != value.block) {
-			throw std::runtime_error("Collision between blocks");
-		}
-		last_id_ = value.id;
-
-		if (last_id_ == 0) {
-			throw std::logic_error("last_id_ == 0 after getting existing block");
-		}
+		// the block may be inserted again, e.g. by successive calls to finalize_execution
+		last_known_block_ = &map_block(last_fingerprint_, last_id_, last_block_instruction_indices_.size());
+		known_block_data_->insert(last_id_, last_block_, last_instruction_span_);
+		return;
 	}
 
-	if (value.executed_instructions < last_block_instruction_indices_.size()) {
-		insert_executed_instructions_db(last_block_instruction_indices_, value.executed_instructions);
-		value.executed_instructions = last_block_instruction_indices_.size();
+	// Existing block, get back block ID
+	stats_->count(&WriterStats::dedup_hits);
+	last_id_ = entry->id;
+	if (entry->executed_instructions < last_block_instruction_indices_.size()) {
+		update_instruction_offsets_db(last_block_instruction_indices_);
+		entry->executed_instructions = last_block_instruction_indices_.size();
 	}
 }
 
-std::int64_t Writer::insert_block_db(const ExecutedBlock& block, Span instruction_data)
+detail::KnownBlock& Writer::map_block(Fingerprint fingerprint, BlockId id, std::size_t executed_instructions)
 {
-	last_block_stmt_.bind_arg_cast(1, block.pc, "pc");
-	last_block_stmt_.bind_blob_without_copy(2, instruction_data.data, instruction_data.size,
-	                                        "instruction_data");
-	last_block_stmt_.bind_arg(3, block.block_instruction_count, "instruction_count");
-	last_block_stmt_.bind_arg(4, static_cast<std::uint8_t>(block.mode), "mode");
+	if (id > std::numeric_limits<std::uint32_t>::max()) {
+		throw std::runtime_error("Too many distinct blocks");
+	}
+	auto& entry = block_table_->insert(fingerprint, static_cast<std::uint32_t>(id));
+	entry.executed_instructions = static_cast<std::uint32_t>(executed_instructions);
+	return entry;
+}
 
-	step_transaction(last_block_stmt_);
-	last_block_stmt_.reset();
+bool Writer::is_known_block(BlockId id, const ExecutedBlock& block, Span instruction_data)
+{
+	bool is_same;
+	if (known_block_data_->compare(id, block, instruction_data, is_same)) {
+		return is_same;
+	}
 
-	return db_.last_insert_rowid();
+	is_same = is_stored_block(id, block, instruction_data);
+	if (is_same) {
+		// the block was evicted, but is executed again
+		known_block_data_->insert(id, block, instruction_data);
+	}
+	return is_same;
 }
 
-void Writer::insert_executed_instructions_db(const std::vector<uint32_t>& block_instruction_indices,
-                                             uint32_t already_inserted_instructions)
+bool Writer::is_stored_block(BlockId id, const ExecutedBlock& block, Span instruction_data)
 {
-	for (std::uint32_t instruction_id = already_inserted_instructions;
-	     instruction_id < block_instruction_indices.size(); ++instruction_id) {
-		const auto instruction_index = block_instruction_indices[instruction_id];
+	// the row of the block may still be waiting in its batch, in the running transaction
+	if (not blocks_batch_->empty()) {
+		blocks_batch_->flush();
+	}
 
-		if (last_id_ == 0) {
-			throw std::logic_error("insert_executed_instructions: attempting to insert with last_id_ = 0");
-		}
+	block_row_stmt_.reset();
+	block_row_stmt_.bind_arg(1, id, "rowid");
+	if (block_row_stmt_.step() != Stmt::StepResult::Row) {
+		throw std::logic_error("Known block " + std::to_string(id) + " is not in the database");
+	}
+	const auto data = block_row_stmt_.column_blob(3);
+	const bool is_same = block_row_stmt_.column_u64(0) == block.pc and
+	                     block_row_stmt_.column_i32(1) == block.block_instruction_count and
+	                     block_row_stmt_.column_i32(2) == static_cast<std::uint8_t>(block.mode) and
+	                     std::get<1>(data) == instruction_data.size and
+	                     (instruction_data.size == 0 or
+	                      std::memcmp(std::get<0>(data), instruction_data.data, instruction_data.size) == 0);
+	block_row_stmt_.reset();
+	return is_same;
+}
 
-		instructions_stmt_.bind_arg(1, last_id_, "block_id");
-		instructions_stmt_.bind_arg_cast(2, instruction_id, "instruction_id");
-		instructions_stmt_.bind_arg_cast(3, instruction_index, "index");
+std::int64_t Writer::insert_block_db(const ExecutedBlock& block, Span instruction_data, Span instruction_offsets)
+{
+	const auto block_id = next_block_id_++;
+	blocks_batch_->integer(block_id)
+	              .unsigned_integer(block.pc)
+	              .blob(instruction_data)
+	              .integer(block.block_instruction_count)
+	              .integer(static_cast<std::uint8_t>(block.mode))
+	              .blob(instruction_offsets);
+	end_row(*blocks_batch_, BLOCK_ROW_SIZE + instruction_data.size + instruction_offsets.size);
+
+	return block_id;
+}
 
-		step_transaction(instructions_stmt_);
-		instructions_stmt_.reset();
+void Writer::update_instruction_offsets_db(const std::vector<std::uint32_t>& block_instruction_indices)
+{
+	if (last_id_ == 0) {
+		throw std::logic_error("update_instruction_offsets_db: attempting to update with last_id_ = 0");
 	}
+
+	// The row of the block may still be waiting in its batch, so the update is only executed at commit
+	stats_->count(&WriterStats::instruction_offsets_updates);
+	auto& offsets = pending_offsets_[last_id_];
+	detail::encode_instruction_offsets(block_instruction_indices, offsets);
+	count_row(OFFSETS_UPDATE_SIZE + offsets.size());
+	commit_if_needed();
 }
 
 void Writer::insert_block_execution(std::uint64_t transition_id)
@@ -156,72 +342,221 @@ void Writer::insert_block_execution(std::uint64_t transition_id)
 	if (last_id_ == 0) {
 		throw std::logic_error("insert_block_execution: attempting to insert with last_id_ == 0");
 	}
-	block_execution_stmt_.bind_arg_throw(1, transition_id, "transition_id");
-	block_execution_stmt_.bind_arg(2, last_id_, "block_id");
-	step_transaction(block_execution_stmt_);
-	block_execution_stmt_.reset();
+	stats_->count(&WriterStats::executions);
+	if (run_compressor_) {
+		run_compressor_->push(detail::ExecutionRow{transition_id, last_id_});
+		insert_compressed_rows();
+	} else {
+		insert_execution_row(transition_id, last_id_);
+	}
 	last_transition_id_ = transition_id;
 }
 
+void Writer::insert_execution_row(std::uint64_t transition_id, std::int64_t block_id)
+{
+	stats_->count(&WriterStats::execution_rows);
+	if (execution_chunk_) {
+		execution_chunk_->push(transition_id, block_id);
+		if (execution_chunk_->full()) {
+			insert_execution_chunk();
+		}
+		return;
+	}
+
+	execution_batch_->unsigned_integer(transition_id)
+	                .integer(block_id);
+	end_row(*execution_batch_, EXECUTION_ROW_SIZE);
+}
+
+void Writer::insert_execution_chunk()
+{
+	if (execution_chunk_->empty()) {
+		return;
+	}
+
+	const auto chunk_id = next_chunk_id_++;
+	chunk_index_batch_->unsigned_integer(execution_chunk_->begin_transition_id())
+	                  .integer(chunk_id);
+	end_row(*chunk_index_batch_, CHUNK_ROW_SIZE);
+	chunks_batch_->integer(chunk_id)
+	             .blob(execution_chunk_->data());
+	end_row(*chunks_batch_, CHUNK_ROW_SIZE + execution_chunk_->data().size);
+
+	execution_chunk_->clear();
+}
+
+void Writer::insert_compressed_rows()
+{
+	auto& patterns = run_compressor_->patterns();
+	for (const auto& pattern : patterns) {
+		runs_batch_->integer(pattern.first)
+		           .blob(Span{pattern.second.size(), reinterpret_cast<const std::uint8_t*>(pattern.second.data())});
+		end_row(*runs_batch_, RUN_ROW_SIZE + pattern.second.size());
+	}
+	patterns.clear();
+
+	auto& rows = run_compressor_->rows();
+	for (const auto& row : rows) {
+		insert_execution_row(row.transition_id, row.block_id);
+	}
+	rows.clear();
+}
+
+void Writer::finish_execution_rows()
+{
+	if (run_compressor_) {
+		run_compressor_->finish();
+		insert_compressed_rows();
+	}
+	if (execution_chunk_) {
+		insert_execution_chunk();
+	}
+}
+
 void Writer::insert_interrupt(uint64_t transition_id, Interrupt interrupt)
 {
-	interrupt_stmt_.bind_arg_throw(1, transition_id, "transition_id");
-	interrupt_stmt_.bind_arg_cast(2, interrupt.pc, "pc");
-	interrupt_stmt_.bind_arg(3, static_cast<std::uint8_t>(interrupt.mode), "mode");
-	interrupt_stmt_.bind_arg_cast(4, interrupt.number, "number");
-	interrupt_stmt_.bind_arg(5, interrupt.is_hw, "is_hw");
-	if (interrupt.has_related_instruction) {
-		interrupt_stmt_.bind_arg(6, last_id_, "related_instruction_block_id");
-	} else {
-		interrupt_stmt_.bind_arg(6, 0, "related_instruction_block_id");
+	interrupts_batch_->unsigned_integer(transition_id)
+	                 .unsigned_integer(interrupt.pc)
+	                 .integer(static_cast<std::uint8_t>(interrupt.mode))
+	                 .integer(interrupt.number)
+	                 .integer(interrupt.is_hw)
+	                 .integer(interrupt.has_related_instruction ? last_id_ : 0);
+	end_row(*interrupts_batch_, INTERRUPT_ROW_SIZE);
+}
+
+void Writer::insert_execution_gap(uint64_t begin_transition_id, uint64_t end_transition_id)
+{
+	count_row(EXECUTION_GAP_ROW_SIZE);
+	// gaps are rare, only a Writer of a ShardedWriter is expected to have some
+	if (not has_execution_gaps_) {
+		db_.exec("CREATE TABLE IF NOT EXISTS execution_gaps("
+		         "begin_transition_id INTEGER PRIMARY KEY NOT NULL,"
+		         "end_transition_id INTEGER NOT NULL"
+		         ");",
+		         "Can't create table execution_gaps");
+		has_execution_gaps_ = true;
 	}
-	step_transaction(interrupt_stmt_);
-	interrupt_stmt_.reset();
+	db_.exec(("INSERT INTO execution_gaps VALUES (" + std::to_string(begin_transition_id) + ", " +
+	          std::to_string(end_transition_id) + ");").c_str(),
+	         "Can't insert execution gap");
+	commit_if_needed();
 }
 
-Stmt::StepResult Writer::step_transaction(sqlite::Statement& stmt)
+void Writer::end_row(detail::BatchInsert& batch, std::size_t bytes)
+{
+	count_row(bytes);
+	batch.end_row();
+	commit_if_needed();
+}
+
+void Writer::count_row(std::size_t bytes)
 {
 	if (transaction_items_ == 0) {
 		db_.exec("begin", "Cannot start transaction");
+		transaction_bytes_ = 0;
+		if (options_.commit_interval.count() != 0) {
+			transaction_start_ = std::chrono::steady_clock::now();
+		}
 	}
 	++transaction_items_;
-	if (transaction_items_ > TRANSACTION_COUNT) {
-		transaction_items_ = 0;
-		db_.exec("commit", "Cannot commit transaction");
+	transaction_bytes_ += bytes;
+
+	if (options_.stats_interval.count() != 0) {
+		report_stats_if_needed();
+	}
+}
+
+void Writer::commit_if_needed()
+{
+	if (options_.commit_rows != 0 and transaction_items_ > options_.commit_rows) {
+		commit_transaction();
+	} else if (options_.commit_bytes != 0 and transaction_bytes_ > options_.commit_bytes) {
+		commit_transaction();
+	} else if (options_.commit_interval.count() != 0 and transaction_items_ % COMMIT_INTERVAL_CHECK_ROWS == 0 and
+	           std::chrono::steady_clock::now() - transaction_start_ > options_.commit_interval) {
+		commit_transaction();
+	}
+}
+
+void Writer::commit_transaction()
+{
+	if (transaction_items_ == 0) {
+		return;
+	}
+	const auto start = stats_->start();
+	blocks_batch_->flush();
+	for (const auto& offsets : pending_offsets_) {
+		update_offsets_stmt_.bind_blob_without_copy(1, offsets.second.data(), offsets.second.size(), "blocks");
+		update_offsets_stmt_.bind_arg(2, offsets.first, "blocks");
+		update_offsets_stmt_.step();
+		update_offsets_stmt_.reset();
+	}
+	pending_offsets_.clear();
+	execution_batch_->flush();
+	interrupts_batch_->flush();
+	runs_batch_->flush();
+	if (execution_chunk_) {
+		chunk_index_batch_->flush();
+		chunks_batch_->flush();
+	}
+	transaction_items_ = 0;
+	db_.exec("commit", "Cannot commit transaction");
+	stats_->count(&WriterStats::commits);
+	stats_->record(&WriterStats::commit_latency, start);
+}
+
+void Writer::report_stats_if_needed()
+{
+	if (not stats_->report_due(options_.stats_interval)) {
+		return;
+	}
+	if (options_.stats_callback) {
+		options_.stats_callback(stats_->stats());
+	} else {
+		std::clog << "rvnblock writer: " << stats_->stats() << std::endl;
 	}
-	return stmt.step();
 }
 
 Writer::Writer(const char* filename, const char* tool_name,
                const char* tool_version,
-               const char* tool_info) :
-    db_([filename, tool_name, tool_version, tool_info]() {
+               const char* tool_info,
+               WriterOptions options) :
+    options_(options),
+    block_table_(new detail::BlockTable),
+    known_block_data_(new detail::KnownBlockData(options.known_block_bytes)),
+    db_([filename, tool_name, tool_version, tool_info, &options]() {
 	auto md = Meta(MetaType::Block, MetaVersion::from_string(format_version), tool_name, MetaVersion::from_string(tool_version),
 	               tool_info + std::string(" - using rvnblock ") + writer_version);
 	auto rdb = RDb::create(filename, metadata::to_sqlite_raw_metadata(md));
-	create_sqlite_db(rdb);
+	create_sqlite_db(rdb, options);
 	return rdb;
 }()),
-    last_block_stmt_(db_, "INSERT INTO blocks VALUES (?, ?, ?, ?);"),
-    instructions_stmt_(db_, "INSERT INTO instruction_indices VALUES (?, ?, ?);"),
-    block_execution_stmt_(db_, "INSERT INTO execution VALUES (?, ?);"),
-    interrupt_stmt_(db_, "INSERT INTO interrupts VALUES (?, ?, ?, ?, ?, ?);")
+    blocks_batch_(new detail::BatchInsert(db_, "blocks",
+                                          "(rowid, pc, instruction_data, instruction_count, mode, instruction_offsets)",
+                                          6)),
+    update_offsets_stmt_(db_, "UPDATE blocks SET instruction_offsets = ? WHERE rowid = ?;"),
+    block_row_stmt_(db_, "SELECT pc, instruction_count, mode, instruction_data FROM blocks WHERE rowid = ?;"),
+    execution_batch_(new detail::BatchInsert(db_, "execution", "", 2)),
+    interrupts_batch_(new detail::BatchInsert(db_, "interrupts", "", 6)),
+    runs_batch_(new detail::BatchInsert(db_, "execution_runs", "", 2)),
+    chunks_batch_(options.chunked_execution ? new detail::BatchInsert(db_, "execution_chunks", "", 2) : nullptr),
+    chunk_index_batch_(options.chunked_execution ?
+                       new detail::BatchInsert(db_, "execution_chunk_index", "", 2) : nullptr),
+    execution_chunk_(options.chunked_execution ? new detail::ExecutionChunkEncoder : nullptr),
+    stats_(new detail::WriterStatsRecorder)
 {
 	// insert interrupt block
-	// see boost::uuids::sha1::digest_type
-	unsigned int digest[DIGEST_SIZE];
-
 	auto block = interrupt_block();
-	auto sha1 = boost::uuids::detail::sha1();
-	sha1.process_bytes(&block, sizeof(block));
-	sha1.process_bytes(interrupt_data().data, interrupt_data().size);
-	sha1.get_digest(digest);
-
-	Hash hash;
-	hash.insert(hash.end(), digest, digest + DIGEST_SIZE);
-
-	auto block_id = insert_block_db(block, interrupt_data());
-	block_map_.insert({hash, MappedBlock{block_id, 0, block}});
+	auto block_id = insert_block_db(block, interrupt_data(), Span{});
+	map_block(detail::fingerprint(block, interrupt_data()), block_id, 0);
+	known_block_data_->insert(block_id, block, interrupt_data());
+	// a Reader can open the database as soon as it contains the interrupt block
+	commit_transaction();
+
+	// non-instructions are looked up in the execution table by their block, so they are never part of a run
+	if (options_.loop_compression) {
+		run_compressor_.reset(new detail::RunCompressor(block_id));
+	}
 }
 
 Writer::~Writer()
@@ -230,34 +565,44 @@ Writer::~Writer()
 		return;
 	}
 
-	if (transaction_items_ != 0) {
-		db_.exec("commit", "Cannot commit transaction");
+	// Also stores the rows retained until close, if it was not called
+	try {
+		close();
+	} catch (const std::exception& e) {
+		// the transaction is rolled back when the database is closed
+		std::clog << "rvnblock writer: " << e.what() << std::endl;
 	}
 }
 
+Writer::Writer(Writer&&) = default;
+Writer& Writer::operator=(Writer&&) = default;
+
 void Writer::add_block(uint64_t current_transition, ExecutedBlock block, Span instruction_data)
 {
-	add_block_inner(current_transition, block, instruction_data, false);
+	stats_->count(&WriterStats::blocks_added);
+	add_block_inner(current_transition, block, instruction_data, false, false);
 }
 
-void Writer::add_block_inner(uint64_t current_transition, ExecutedBlock block, Span instruction_data,
-                             bool force_last_block_insertion)
+void Writer::add_block_borrowed(uint64_t current_transition, ExecutedBlock block, Span instruction_data)
 {
-	// see boost::uuids::sha1::digest_type
-	unsigned int digest[DIGEST_SIZE];
+	stats_->count(&WriterStats::blocks_added);
+	add_block_inner(current_transition, block, instruction_data, false, true);
+}
 
-	auto sha1 = boost::uuids::detail::sha1();
-	sha1.process_bytes(&block, sizeof(block));
-	sha1.process_bytes(instruction_data.data, instruction_data.size);
-	sha1.get_digest(digest);
+void Writer::add_block_inner(uint64_t current_transition, ExecutedBlock block, Span instruction_data,
+                             bool force_last_block_insertion, bool borrowed)
+{
+	const auto start = stats_->start();
+	const auto fingerprint = detail::fingerprint(block, instruction_data);
 
 	// first block
-	if (last_hash_.size() != DIGEST_SIZE) {
-		if (not last_hash_.empty()) {
-			throw std::logic_error("Unexpected non-empty last_hash");
+	if (not has_last_block_) {
+		// the transitions since the beginning of the trace or the suspension were not recorded by this Writer
+		if (current_transition > last_transition_id_) {
+			insert_execution_gap(last_transition_id_, current_transition);
 		}
-
-		reset_last_block(block, digest, instruction_data);
+		reset_last_block(block, fingerprint, instruction_data, borrowed);
+		stats_->record(&WriterStats::add_block_latency, start);
 		return;
 	}
 
@@ -268,15 +613,17 @@ void Writer::add_block_inner(uint64_t current_transition, ExecutedBlock block, S
 		insert_last_block();
 	}
 
-	reset_last_block(block, digest, instruction_data);
+	reset_last_block(block, fingerprint, instruction_data, borrowed);
+	stats_->record(&WriterStats::add_block_latency, start);
 }
 
 void Writer::add_block_instruction(uint64_t rip)
 {
-	if (last_hash_.size() != DIGEST_SIZE) {
+	if (not has_last_block_) {
 		throw std::logic_error("Call to add_block_instruction before any call to add_block");
 	}
 	std::uint32_t index = rip - last_block_.pc;
+	stats_->count(&WriterStats::instructions_added);
 	if (index == 0) {
 		return;
 	}
@@ -285,25 +632,75 @@ void Writer::add_block_instruction(uint64_t rip)
 
 void Writer::add_interrupt(uint64_t current_transition, Interrupt interrupt)
 {
-	add_block_inner(current_transition, interrupt_block(), interrupt_data(), true);
+	stats_->count(&WriterStats::interrupts);
+	add_block_inner(current_transition, interrupt_block(), interrupt_data(), true, true);
 	insert_interrupt(current_transition, interrupt);
 }
 
+void Writer::add_events(const Event* events, std::size_t count)
+{
+	try {
+		for (const auto* event = events; event != events + count; ++event) {
+			switch (event->type) {
+				case Event::Type::Block:
+					stats_->count(&WriterStats::blocks_added);
+					// the data only needs to be copied if the block is still the last block at the end of the batch
+					add_block_inner(event->current_transition, event->block, event->instruction_data, false, true);
+					break;
+				case Event::Type::BlockInstruction:
+					add_block_instruction(event->rip);
+					break;
+				case Event::Type::Interrupt:
+					add_interrupt(event->current_transition, event->interrupt);
+					break;
+				default:
+					throw std::logic_error("Unknown event type");
+			}
+		}
+	} catch (...) {
+		// the data of the caller is not valid after this call, even if it failed
+		retain_last_instruction_data();
+		throw;
+	}
+	retain_last_instruction_data();
+}
+
 void Writer::finalize_execution(uint64_t last_transition_id)
 {
-	if (last_hash_.size() == DIGEST_SIZE and
+	if (has_last_block_ and
 	    last_transition_id != last_transition_id_) {
 		insert_last_block();
 		insert_block_execution(last_transition_id);
 	}
 }
 
+void Writer::suspend_execution(uint64_t transition_id)
+{
+	finalize_execution(transition_id);
+	has_last_block_ = false;
+}
+
+void Writer::flush()
+{
+	commit_transaction();
+}
+
+WriterStats Writer::stats() const
+{
+	return stats_->stats();
+}
+
+void Writer::close()
+{
+	finish_execution_rows();
+	commit_transaction();
+	closed_ = true;
+}
+
 sqlite::ResourceDatabase Writer::take() &&
 {
-	if (db_.get() != nullptr) {
-		if (transaction_items_ != 0) {
-			db_.exec("commit", "Cannot commit transaction");
-		}
+	if (db_.get() != nullptr and not closed_) {
+		close();
 	}
 
 	return std::move(db_);
@@ -0,0 +1,149 @@
+#include <concurrent_reader.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "block_cache.h"
+#include "execution_index.h"
+#include "transition_index.h"
+
+namespace reven {
+namespace block {
+namespace reader {
+
+namespace {
+
+// Number of pools of idle Readers. The threads are spread over the slots, so that they rarely contend for a slot.
+constexpr std::size_t SLOT_COUNT = 64;
+
+//! The slot of the calling thread: the threads take the slots in turn, the first time they use any ConcurrentReader
+std::size_t thread_slot()
+{
+	static std::atomic<std::size_t> next_slot{0};
+	thread_local const std::size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % SLOT_COUNT;
+	return slot;
+}
+
+} // anonymous namespace
+
+struct ConcurrentReader::State {
+	struct Slot {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<Reader>> idle;
+	};
+
+	State(const char* filename_, ReaderOptions options_, std::size_t cache_shards) :
+	    filename(filename_),
+	    options(options_),
+	    cache(std::make_shared<detail::BlockCache>(options.cache_bytes, cache_shards))
+	{
+		std::unique_ptr<Reader> reader(new Reader(Reader::open(filename.c_str(), options, cache, nullptr, nullptr)));
+		// the other Readers share the indices loaded by the first one
+		transition_index = reader->transition_index_;
+		execution_index = reader->execution_index_;
+		slots[thread_slot()].idle.push_back(std::move(reader));
+		connections = 1;
+	}
+
+	std::unique_ptr<Reader> take(std::size_t slot)
+	{
+		{
+			std::lock_guard<std::mutex> lock(slots[slot].mutex);
+			auto& idle = slots[slot].idle;
+			if (not idle.empty()) {
+				auto reader = std::move(idle.back());
+				idle.pop_back();
+				return reader;
+			}
+		}
+
+		// Rather than waiting for a busy Reader, open a new connection. Opening is outside of the lock, as it
+		// queries the database.
+		std::unique_ptr<Reader> reader(new Reader(Reader::open(filename.c_str(), options, cache, transition_index,
+		                                                       execution_index)));
+		++connections;
+		return reader;
+	}
+
+	void give_back(std::size_t slot, std::unique_ptr<Reader> reader)
+	{
+		std::lock_guard<std::mutex> lock(slots[slot].mutex);
+		slots[slot].idle.push_back(std::move(reader));
+	}
+
+	const std::string filename;
+	const ReaderOptions options;
+	std::shared_ptr<detail::BlockCache> cache;
+	// Immutable once loaded: the Readers of the pool are never refreshed
+	std::shared_ptr<detail::TransitionIndex> transition_index;
+	std::shared_ptr<detail::ExecutionIndex> execution_index;
+
+	Slot slots[SLOT_COUNT];
+	std::atomic<std::size_t> connections{0};
+};
+
+ConcurrentReader::Lease::~Lease()
+{
+	if (reader_) {
+		state_->give_back(slot_, std::move(reader_));
+	}
+}
+
+ConcurrentReader::ConcurrentReader(const char* filename, ReaderOptions options, std::size_t cache_shards) :
+    state_(new State(filename, options, cache_shards))
+{}
+
+ConcurrentReader::~ConcurrentReader() = default;
+ConcurrentReader::ConcurrentReader(ConcurrentReader&&) = default;
+ConcurrentReader& ConcurrentReader::operator=(ConcurrentReader&&) = default;
+
+ConcurrentReader::Lease ConcurrentReader::lease() const
+{
+	const auto slot = thread_slot();
+	return Lease(*state_, slot, state_->take(slot));
+}
+
+std::shared_ptr<const InstructionBlock> ConcurrentReader::block(BlockHandle handle) const
+{
+	return lease()->pinned_block(handle);
+}
+
+BlockInstructions ConcurrentReader::block_with_instructions(BlockHandle handle,
+                                                            std::vector<std::uint32_t> instruction_indexes) const
+{
+	return lease()->block_with_instructions(handle, std::move(instruction_indexes));
+}
+
+std::experimental::optional<BlockExecutionEvent> ConcurrentReader::event_at(std::uint64_t transition_id) const
+{
+	return lease()->event_at(transition_id);
+}
+
+void ConcurrentReader::events_at(const std::uint64_t* transition_ids, std::size_t count,
+                                 std::vector<BlockExecutionEvent>& events) const
+{
+	lease()->events_at(transition_ids, count, events);
+}
+
+std::experimental::optional<Interrupt> ConcurrentReader::interrupt_at(std::uint64_t transition_id) const
+{
+	return lease()->interrupt_at(transition_id);
+}
+
+void ConcurrentReader::clear_cache() const
+{
+	state_->cache->clear();
+}
+
+BlockCacheStats ConcurrentReader::cache_stats() const
+{
+	return state_->cache->stats();
+}
+
+std::size_t ConcurrentReader::connection_count() const
+{
+	return state_->connections;
+}
+
+}}} // namespace reven::block::reader
@@ -0,0 +1,45 @@
+#include "execution_chunks.h"
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "varint.h"
+
+namespace reven {
+namespace block {
+namespace detail {
+
+void ExecutionChunkEncoder::push(std::uint64_t transition_id, std::int64_t block_id)
+{
+	if (transition_id <= end_transition_id_) {
+		throw std::runtime_error("Execution rows are not in transition order at transition " +
+		                         std::to_string(transition_id));
+	}
+
+	encode_execution_row(data_, end_transition_id_, transition_id, block_id);
+	end_transition_id_ = transition_id;
+	++rows_;
+}
+
+void encode_execution_row(std::vector<std::uint8_t>& data, std::uint64_t previous_transition_id,
+                          std::uint64_t transition_id, std::int64_t block_id)
+{
+	put_varint(data, transition_id - previous_transition_id);
+	put_varint(data, (static_cast<std::uint64_t>(block_id) << 1) ^ static_cast<std::uint64_t>(block_id >> 63));
+}
+
+void decode_execution_row(const std::uint8_t*& cursor, const std::uint8_t* end,
+                          std::uint64_t& transition_id, std::int32_t& block_id)
+{
+	transition_id += get_varint(cursor, end, "Malformed execution chunk");
+
+	const auto zigzag = get_varint(cursor, end, "Malformed execution chunk");
+	const auto value = static_cast<std::int64_t>(zigzag >> 1) ^ -static_cast<std::int64_t>(zigzag & 1);
+	if (value < std::numeric_limits<std::int32_t>::min() or value > std::numeric_limits<std::int32_t>::max()) {
+		throw std::runtime_error("Malformed execution chunk");
+	}
+	block_id = static_cast<std::int32_t>(value);
+}
+
+}}} // namespace reven::block::detail
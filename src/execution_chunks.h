@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Maximum number of execution rows stored in a chunk of the execution_chunks table
+constexpr std::size_t EXECUTION_CHUNK_ROWS = 1024;
+
+//! Accumulates the rows of the execution table into the data of a chunk of the execution_chunks table.
+//!
+//! Each row is encoded as the varint of the number of transitions since the end of the previous row, followed by the
+//! zigzag varint of its block_id. The first row is relative to the beginning of the chunk, which is the end of the
+//! last row of the previous chunk.
+class ExecutionChunkEncoder {
+public:
+	//! Append a row to the chunk.
+	//!
+	//! Throws RuntimeError if the row does not end after the previous row.
+	void push(std::uint64_t transition_id, std::int64_t block_id);
+
+	bool full() const {
+		return rows_ == EXECUTION_CHUNK_ROWS;
+	}
+
+	bool empty() const {
+		return rows_ == 0;
+	}
+
+	//! Transition at which the first row of the chunk begins
+	std::uint64_t begin_transition_id() const {
+		return begin_transition_id_;
+	}
+
+	Span data() const {
+		return Span{data_.size(), data_.data()};
+	}
+
+	//! Start the next chunk, at the end of the last row of this chunk
+	void clear() {
+		data_.clear();
+		rows_ = 0;
+		begin_transition_id_ = end_transition_id_;
+	}
+
+private:
+	std::vector<std::uint8_t> data_;
+	std::size_t rows_ = 0;
+	std::uint64_t begin_transition_id_ = 0;
+	std::uint64_t end_transition_id_ = 0;
+};
+
+//! Append the encoding of a row of a chunk to data.
+//!
+//! - previous_transition_id: end of the previous row, before transition_id.
+void encode_execution_row(std::vector<std::uint8_t>& data, std::uint64_t previous_transition_id,
+                          std::uint64_t transition_id, std::int64_t block_id);
+
+//! Decode the row of a chunk at cursor, and advance cursor past it.
+//!
+//! - transition_id: end of the previous row, updated to the end of the decoded row.
+//!
+//! Throws RuntimeError if the chunk is malformed.
+void decode_execution_row(const std::uint8_t*& cursor, const std::uint8_t* end,
+                          std::uint64_t& transition_id, std::int32_t& block_id);
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,179 @@
+#include "execution_index.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "varint.h"
+
+namespace reven {
+namespace block {
+namespace detail {
+
+namespace {
+
+const char* const MALFORMED_EXECUTIONS = "Malformed execution index";
+
+//! Decode the next execution at cursor. begin_transition_id is the beginning of the previous execution, or 0 at a
+//! sample.
+void decode_execution(const std::uint8_t*& cursor, const std::uint8_t* end, std::uint64_t& begin_transition_id,
+                      std::uint64_t& length)
+{
+	begin_transition_id += get_varint(cursor, end, MALFORMED_EXECUTIONS);
+	length = get_varint(cursor, end, MALFORMED_EXECUTIONS);
+}
+
+} // anonymous namespace
+
+void ExecutionIndex::push(std::int32_t block_id, std::uint64_t begin_transition_id, std::uint64_t length)
+{
+	if (begin_transition_id < end_transition_id_) {
+		throw std::runtime_error("Executions are not in transition order at transition " +
+		                         std::to_string(begin_transition_id));
+	}
+
+	if (static_cast<std::size_t>(block_id) >= blocks_.size()) {
+		blocks_.resize(block_id + 1);
+	}
+	auto& block = blocks_[block_id];
+
+	std::uint64_t previous_begin = block.last_begin;
+	if (block.count % EXECUTION_INDEX_SAMPLE_EXECUTIONS == 0) {
+		block.sample_begins.push_back(begin_transition_id);
+		block.sample_offsets.push_back(block.data.size());
+		previous_begin = 0;
+	}
+	put_varint(block.data, begin_transition_id - previous_begin);
+	put_varint(block.data, length);
+	block.last_begin = begin_transition_id;
+	++block.count;
+
+	end_transition_id_ = begin_transition_id + length;
+}
+
+void ExecutionIndex::add_block(std::int32_t block_id, std::uint64_t first_pc, std::uint64_t size)
+{
+	if (static_cast<std::size_t>(block_id) >= blocks_.size()) {
+		blocks_.resize(block_id + 1);
+	}
+	blocks_[block_id].has_block = true;
+
+	addresses_.emplace(first_pc, std::make_pair(first_pc + size, block_id));
+	max_block_size_ = std::max(max_block_size_, size);
+}
+
+void ExecutionIndex::blocks_at(std::uint64_t pc, std::vector<std::int32_t>& block_ids) const
+{
+	block_ids.clear();
+
+	// the blocks that contain pc begin at most max_block_size_ addresses before it, possibly at address 0
+	const auto first = pc >= max_block_size_ ? pc - max_block_size_ : 0;
+	for (auto it = addresses_.lower_bound(first), end = addresses_.upper_bound(pc); it != end; ++it) {
+		if (pc < it->second.first) {
+			block_ids.push_back(it->second.second);
+		}
+	}
+}
+
+void ExecutionIndex::sample_range(const Block& block, std::size_t sample, const std::uint8_t*& begin,
+                                  const std::uint8_t*& end) const
+{
+	begin = block.data.data() + block.sample_offsets[sample];
+	end = block.data.data() + (sample + 1 < block.sample_offsets.size() ? block.sample_offsets[sample + 1] :
+	                                                                      block.data.size());
+}
+
+bool ExecutionIndex::next(std::int32_t block_id, std::uint32_t instruction_index, std::uint64_t transition_id,
+                          std::uint64_t& result) const
+{
+	if (static_cast<std::size_t>(block_id) >= blocks_.size() or blocks_[block_id].count == 0) {
+		return false;
+	}
+	const auto& block = blocks_[block_id];
+
+	// The first execution that begins at or after target and is long enough to execute the instruction. The
+	// executions of the samples before the last one that begins at or before target begin before target.
+	const auto target = transition_id > instruction_index ? transition_id - instruction_index : 0;
+	auto sample = std::upper_bound(block.sample_begins.begin(), block.sample_begins.end(), target) -
+	              block.sample_begins.begin();
+	if (sample != 0) {
+		--sample;
+	}
+
+	for (; static_cast<std::size_t>(sample) < block.sample_begins.size(); ++sample) {
+		const std::uint8_t* cursor;
+		const std::uint8_t* end;
+		sample_range(block, sample, cursor, end);
+		std::uint64_t begin_transition_id = 0;
+		std::uint64_t length;
+		while (cursor != end) {
+			decode_execution(cursor, end, begin_transition_id, length);
+			if (begin_transition_id >= target and length > instruction_index) {
+				result = begin_transition_id + instruction_index;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool ExecutionIndex::previous(std::int32_t block_id, std::uint32_t instruction_index, std::uint64_t transition_id,
+                              std::uint64_t& result) const
+{
+	if (static_cast<std::size_t>(block_id) >= blocks_.size() or transition_id <= instruction_index) {
+		return false;
+	}
+	const auto& block = blocks_[block_id];
+
+	// The last execution that begins before target and is long enough to execute the instruction, from the last
+	// sample that begins before target
+	const auto target = transition_id - instruction_index;
+	auto sample = std::lower_bound(block.sample_begins.begin(), block.sample_begins.end(), target) -
+	              block.sample_begins.begin();
+
+	while (sample != 0) {
+		--sample;
+		const std::uint8_t* cursor;
+		const std::uint8_t* end;
+		sample_range(block, sample, cursor, end);
+		std::uint64_t begin_transition_id = 0;
+		std::uint64_t length;
+		bool found = false;
+		while (cursor != end) {
+			decode_execution(cursor, end, begin_transition_id, length);
+			if (begin_transition_id >= target) {
+				break;
+			}
+			if (length > instruction_index) {
+				result = begin_transition_id + instruction_index;
+				found = true;
+			}
+		}
+		if (found) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ExecutionIndex::shrink_to_fit()
+{
+	blocks_.shrink_to_fit();
+	for (auto& block : blocks_) {
+		block.data.shrink_to_fit();
+		block.sample_begins.shrink_to_fit();
+		block.sample_offsets.shrink_to_fit();
+	}
+}
+
+std::size_t ExecutionIndex::memory_usage() const
+{
+	std::size_t bytes = blocks_.capacity() * sizeof(Block);
+	for (const auto& block : blocks_) {
+		bytes += block.data.capacity() + block.sample_begins.capacity() * sizeof(std::uint64_t) +
+		         block.sample_offsets.capacity() * sizeof(std::uint64_t);
+	}
+	return bytes;
+}
+
+}}} // namespace reven::block::detail
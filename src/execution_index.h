@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Number of executions of a block between two samples of an ExecutionIndex
+constexpr std::uint64_t EXECUTION_INDEX_SAMPLE_EXECUTIONS = 64;
+
+//! In-memory index of the executions of each block, to find when an instruction is executed without scanning the
+//! execution table.
+//!
+//! The executions of each block are a sampled delta array, like the rows of a TransitionIndex: each execution is
+//! encoded as the varint of the difference between its beginning and the beginning of the previous execution of the
+//! block, followed by the varint of its length. Every EXECUTION_INDEX_SAMPLE_EXECUTIONS-th execution is sampled, and
+//! its beginning is encoded as is.
+//!
+//! The index also keeps the addresses of the blocks, to find the blocks that contain an address.
+class ExecutionIndex {
+public:
+	//! Append an execution of the block, that begins at begin_transition_id and executes length transitions.
+	//!
+	//! Throws RuntimeError if the execution does not begin after the previous one.
+	void push(std::int32_t block_id, std::uint64_t begin_transition_id, std::uint64_t length);
+
+	//! Record the addresses [first_pc, first_pc + size) of the instructions of the block
+	void add_block(std::int32_t block_id, std::uint64_t first_pc, std::uint64_t size);
+
+	//! Whether add_block was called for the block
+	bool has_block(std::int32_t block_id) const {
+		return static_cast<std::size_t>(block_id) < blocks_.size() and blocks_[block_id].has_block;
+	}
+
+	//! Replace the content of block_ids with the blocks whose addresses contain pc
+	void blocks_at(std::uint64_t pc, std::vector<std::int32_t>& block_ids) const;
+
+	//! Retrieve the first transition at or after transition_id at which the instruction_index-th instruction of the
+	//! block is executed, returning false if there is none.
+	bool next(std::int32_t block_id, std::uint32_t instruction_index, std::uint64_t transition_id,
+	          std::uint64_t& result) const;
+
+	//! Retrieve the last transition before transition_id at which the instruction_index-th instruction of the block
+	//! is executed, returning false if there is none.
+	bool previous(std::int32_t block_id, std::uint32_t instruction_index, std::uint64_t transition_id,
+	              std::uint64_t& result) const;
+
+	//! End of the last pushed execution
+	std::uint64_t end_transition_id() const {
+		return end_transition_id_;
+	}
+
+	//! Release the memory reserved for future executions
+	void shrink_to_fit();
+
+	//! Memory allocated by the index, in bytes, not counting the addresses of the blocks
+	std::size_t memory_usage() const;
+
+private:
+	struct Block {
+		std::vector<std::uint8_t> data;
+		// Beginning of each sampled execution, and the offset of its encoding in data
+		std::vector<std::uint64_t> sample_begins;
+		std::vector<std::uint64_t> sample_offsets;
+		std::uint64_t last_begin = 0;
+		std::uint64_t count = 0;
+		bool has_block = false;
+	};
+
+	//! The encoded executions of a sample of the block
+	void sample_range(const Block& block, std::size_t sample, const std::uint8_t*& begin,
+	                  const std::uint8_t*& end) const;
+
+	// Indexed by block id
+	std::vector<Block> blocks_;
+	// First address of each block, to the end of its addresses and its id
+	std::multimap<std::uint64_t, std::pair<std::uint64_t, std::int32_t>> addresses_;
+	// Largest number of addresses of a block, which bounds the blocks that may contain an address
+	std::uint64_t max_block_size_ = 0;
+	std::uint64_t end_transition_id_ = 0;
+};
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,193 @@
+#include "execution_runs.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+namespace {
+
+// A run is only worth a row when it replaces at least this number of rows. Requiring them before starting the run
+// keeps a block executed twice in a row from hiding the longer cycle it is part of.
+constexpr std::size_t MIN_RUN_ROWS = 4;
+
+constexpr std::size_t STEP_SIZE = 8;
+
+void put_u32(std::string& out, std::uint32_t value)
+{
+	for (int i = 0; i < 4; ++i) {
+		out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+	}
+}
+
+std::uint32_t get_u32(const std::uint8_t* data)
+{
+	return std::uint32_t(data[0]) | std::uint32_t(data[1]) << 8 | std::uint32_t(data[2]) << 16 |
+	       std::uint32_t(data[3]) << 24;
+}
+
+} // anonymous namespace
+
+std::string encode_run_pattern(const RunStep* steps, std::size_t period)
+{
+	std::string pattern;
+	pattern.reserve(period * STEP_SIZE);
+	for (std::size_t i = 0; i < period; ++i) {
+		put_u32(pattern, static_cast<std::uint32_t>(steps[i].block_id));
+		put_u32(pattern, steps[i].length);
+	}
+	return pattern;
+}
+
+std::vector<RunStep> decode_run_pattern(const std::uint8_t* data, std::size_t size)
+{
+	if (size == 0 or size % STEP_SIZE != 0 or size / STEP_SIZE > MAX_RUN_PERIOD) {
+		throw std::runtime_error("Malformed execution run pattern");
+	}
+
+	std::vector<RunStep> steps;
+	for (const auto* step = data; step != data + size; step += STEP_SIZE) {
+		steps.push_back(RunStep{static_cast<std::int32_t>(get_u32(step)), get_u32(step + 4)});
+		if (steps.back().length == 0) {
+			throw std::runtime_error("Malformed execution run pattern");
+		}
+	}
+	return steps;
+}
+
+void RunCompressor::push(ExecutionRow row)
+{
+	if (not run_active_) {
+		push_window(row);
+		return;
+	}
+
+	const auto& step = run_[run_phase_];
+	if (row.block_id == step.block_id and row.transition_id - run_cursor_ == step.length) {
+		run_cursor_ = row.transition_id;
+		if (++run_phase_ == run_.size()) {
+			run_phase_ = 0;
+			run_end_ = run_cursor_;
+			++run_iterations_;
+			if (run_iterations_ * run_.size() >= MAX_RUN_EXECUTIONS) {
+				close_run();
+			}
+		}
+		return;
+	}
+
+	// The cycle is broken: the unfinished iteration and this row may start another run
+	const auto pending = unfinished_iteration();
+	close_run();
+	for (const auto& pending_row : pending) {
+		push(pending_row);
+	}
+	push(row);
+}
+
+void RunCompressor::finish()
+{
+	if (run_active_) {
+		const auto pending = unfinished_iteration();
+		close_run();
+		window_.insert(window_.end(), pending.begin(), pending.end());
+	}
+
+	rows_.insert(rows_.end(), window_.begin(), window_.end());
+	if (not window_.empty()) {
+		window_begin_ = window_.back().transition_id;
+	}
+	window_.clear();
+}
+
+std::size_t RunCompressor::cycle_rows(std::size_t period)
+{
+	// At least two iterations
+	return std::max(2 * period, (MIN_RUN_ROWS + period - 1) / period * period);
+}
+
+bool RunCompressor::is_cycle(std::size_t period) const
+{
+	const auto first = window_.size() - cycle_rows(period);
+	for (std::size_t i = first; i < window_.size() - period; ++i) {
+		const auto length = window_length(i);
+		if (window_[i].block_id == excluded_block_id_ or
+		    window_[i].block_id != window_[i + period].block_id or
+		    length == 0 or length > std::numeric_limits<std::uint32_t>::max() or
+		    length != window_length(i + period)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void RunCompressor::push_window(ExecutionRow row)
+{
+	window_.push_back(row);
+
+	for (std::size_t period = 1; period <= MAX_RUN_PERIOD; ++period) {
+		if (cycle_rows(period) <= window_.size() and is_cycle(period)) {
+			start_run(period);
+			return;
+		}
+	}
+
+	// The oldest row can no longer start a run
+	while (window_.size() >= 2 * MAX_RUN_PERIOD) {
+		window_begin_ = window_.front().transition_id;
+		rows_.push_back(window_.front());
+		window_.pop_front();
+	}
+}
+
+void RunCompressor::start_run(std::size_t period)
+{
+	const auto first = window_.size() - cycle_rows(period);
+
+	run_.clear();
+	for (std::size_t i = window_.size() - period; i < window_.size(); ++i) {
+		run_.push_back(RunStep{static_cast<std::int32_t>(window_[i].block_id),
+		                       static_cast<std::uint32_t>(window_length(i))});
+	}
+
+	for (std::size_t i = 0; i < first; ++i) {
+		rows_.push_back(window_[i]);
+	}
+	run_begin_ = first == 0 ? window_begin_ : window_[first - 1].transition_id;
+	run_end_ = window_.back().transition_id;
+	run_cursor_ = run_end_;
+	run_iterations_ = cycle_rows(period) / period;
+	run_phase_ = 0;
+	run_active_ = true;
+	window_.clear();
+}
+
+std::vector<ExecutionRow> RunCompressor::unfinished_iteration() const
+{
+	std::vector<ExecutionRow> rows;
+	auto transition_id = run_end_;
+	for (std::size_t i = 0; i < run_phase_; ++i) {
+		transition_id += run_[i].length;
+		rows.push_back(ExecutionRow{transition_id, run_[i].block_id});
+	}
+	return rows;
+}
+
+void RunCompressor::close_run()
+{
+	auto pattern = encode_run_pattern(run_.data(), run_.size());
+	const auto next_id = static_cast<std::int64_t>(pattern_ids_.size()) + 1;
+	const auto itbool = pattern_ids_.emplace(pattern, next_id);
+	if (itbool.second) {
+		patterns_.emplace_back(next_id, std::move(pattern));
+	}
+	rows_.push_back(ExecutionRow{run_end_, -itbool.first->second});
+
+	window_begin_ = run_end_;
+	run_active_ = false;
+}
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Longest cycle of blocks that is stored as a run
+constexpr std::size_t MAX_RUN_PERIOD = 8;
+
+//! Most executions stored as a single run: a longer cycle is split into several runs, so that its rows do not wait
+//! for the end of the cycle to be output
+constexpr std::uint64_t MAX_RUN_EXECUTIONS = 65536;
+
+//! Execution of a block in one iteration of a run
+struct RunStep {
+	std::int32_t block_id;
+	//! Number of transitions of the execution
+	std::uint32_t length;
+};
+
+//! Encode the steps of one iteration of a run, as stored in the pattern column of the execution_runs table.
+std::string encode_run_pattern(const RunStep* steps, std::size_t period);
+
+//! Decode the pattern column of the execution_runs table.
+//!
+//! Throws RuntimeError if the pattern is malformed.
+std::vector<RunStep> decode_run_pattern(const std::uint8_t* data, std::size_t size);
+
+//! A row of the execution table: either the execution of a block, or the end of a run if block_id is negative.
+struct ExecutionRow {
+	std::uint64_t transition_id;
+	std::int64_t block_id;
+};
+
+//! Detects the repeating cycles of executed blocks in the rows of the execution table, and replaces them with runs.
+//!
+//! A run is a cycle of at most MAX_RUN_PERIOD executions, each with the same block and the same number of
+//! transitions in every iteration. It is stored as a single execution row at the end of its last complete iteration,
+//! whose block_id is minus the id of its pattern in the execution_runs table. Identical patterns share the same id.
+//!
+//! Rows are pushed in transition order, and come out in the same order once they cannot be part of a run anymore.
+class RunCompressor {
+public:
+	//! - excluded_block_id: block that is never part of a run, e.g. the interrupt block.
+	explicit RunCompressor(std::int64_t excluded_block_id) : excluded_block_id_(excluded_block_id) {}
+
+	void push(ExecutionRow row);
+
+	//! Output all the rows that are still pending. Rows pushed afterwards may not be part of the same runs.
+	void finish();
+
+	//! Rows to insert into the execution table, in order. The caller clears it after inserting them.
+	std::vector<ExecutionRow>& rows() {
+		return rows_;
+	}
+
+	//! Patterns to insert into the execution_runs table, as (id, pattern), before the rows that reference them. The
+	//! caller clears it after inserting them.
+	std::vector<std::pair<std::int64_t, std::string>>& patterns() {
+		return patterns_;
+	}
+
+private:
+	std::uint64_t window_length(std::size_t index) const {
+		return window_[index].transition_id - (index == 0 ? window_begin_ : window_[index - 1].transition_id);
+	}
+
+	//! Number of rows at the end of the window that must repeat with the period to start a run
+	static std::size_t cycle_rows(std::size_t period);
+	bool is_cycle(std::size_t period) const;
+	void push_window(ExecutionRow row);
+	void start_run(std::size_t period);
+	//! Rows of the iteration of the active run that is not complete
+	std::vector<ExecutionRow> unfinished_iteration() const;
+	void close_run();
+
+	const std::int64_t excluded_block_id_;
+
+	// Rows that could still start a run. window_begin_ is the end of the row before them.
+	std::deque<ExecutionRow> window_;
+	std::uint64_t window_begin_ = 0;
+
+	// Active run: its iterations are [run_begin_, run_end_), and the following steps matched up to cursor_
+	bool run_active_ = false;
+	std::vector<RunStep> run_;
+	std::uint64_t run_begin_ = 0;
+	std::uint64_t run_end_ = 0;
+	std::uint64_t run_iterations_ = 0;
+	std::size_t run_phase_ = 0;
+	std::uint64_t run_cursor_ = 0;
+
+	std::unordered_map<std::string, std::int64_t> pattern_ids_;
+
+	std::vector<ExecutionRow> rows_;
+	std::vector<std::pair<std::int64_t, std::string>> patterns_;
+};
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <block_writer.h>
+
+// Get the SHA1 implementation from boost details.
+// As of today this is the easiest way of getting a SHA1 implementation without adding a dedicated dependency.
+// Note that sha1.hpp is an implementation detail of Boost's UUID, and so subject to change/removal, etc.
+#include <boost/uuid/detail/sha1.hpp>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+using writer::ExecutedBlock;
+
+inline std::uint64_t rotl64(std::uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline std::uint64_t fmix64(std::uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+//! MurmurHash3 x64 128 bits (public domain, Austin Appleby), with a 128-bit seed.
+//!
+//! The result is only ever used in memory, so reading the input in host byte order is fine.
+inline Fingerprint murmur3_128(const std::uint8_t* data, std::size_t size,
+                               std::uint64_t seed1, std::uint64_t seed2)
+{
+	constexpr std::uint64_t c1 = 0x87c37b91114253d5ULL;
+	constexpr std::uint64_t c2 = 0x4cf5ad432745937fULL;
+
+	std::uint64_t h1 = seed1;
+	std::uint64_t h2 = seed2;
+
+	const std::size_t block_count = size / 16;
+	for (std::size_t i = 0; i < block_count; ++i) {
+		std::uint64_t k1;
+		std::uint64_t k2;
+		std::memcpy(&k1, data + i * 16, sizeof(k1));
+		std::memcpy(&k2, data + i * 16 + 8, sizeof(k2));
+
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	const std::size_t tail_size = size % 16;
+	if (tail_size != 0) {
+		std::uint8_t tail[16] = {};
+		std::memcpy(tail, data + block_count * 16, tail_size);
+
+		std::uint64_t k1;
+		std::uint64_t k2;
+		std::memcpy(&k1, tail, sizeof(k1));
+		std::memcpy(&k2, tail + 8, sizeof(k2));
+
+		if (tail_size > 8) {
+			k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		}
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= size;
+	h2 ^= size;
+
+	h1 += h2;
+	h2 += h1;
+
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+
+	h1 += h2;
+	h2 += h1;
+
+	return Fingerprint{h1, h2};
+}
+
+//! Fast non-cryptographic fingerprint of a block and its instruction data.
+//!
+//! The fields of the block are used as the seed rather than hashing the struct, so that padding bytes never
+//! contribute to the fingerprint.
+inline Fingerprint murmur_fingerprint(const ExecutedBlock& block, Span instruction_data)
+{
+	const std::uint64_t header = block.block_instruction_count |
+	                             (static_cast<std::uint64_t>(block.mode) << 16) |
+	                             (static_cast<std::uint64_t>(instruction_data.size) << 24);
+	return murmur3_128(instruction_data.data, instruction_data.size, block.pc, header);
+}
+
+//! SHA1 fingerprint of a block and its instruction data, truncated to 128 bits.
+inline Fingerprint sha1_fingerprint(const ExecutedBlock& block, Span instruction_data)
+{
+	// see boost::uuids::sha1::digest_type
+	unsigned int digest[5];
+
+	const auto mode = static_cast<std::uint8_t>(block.mode);
+	auto sha1 = boost::uuids::detail::sha1();
+	sha1.process_bytes(&block.pc, sizeof(block.pc));
+	sha1.process_bytes(&block.block_instruction_count, sizeof(block.block_instruction_count));
+	sha1.process_bytes(&mode, sizeof(mode));
+	sha1.process_bytes(instruction_data.data, instruction_data.size);
+	sha1.get_digest(digest);
+
+	return Fingerprint{
+		(static_cast<std::uint64_t>(digest[0]) << 32) | digest[1],
+		(static_cast<std::uint64_t>(digest[2]) << 32) | digest[3],
+	};
+}
+
+//! Fingerprint used to deduplicate blocks, selected at compile time by RVNBLOCK_SHA1_FINGERPRINT.
+inline Fingerprint fingerprint(const ExecutedBlock& block, Span instruction_data)
+{
+#ifdef RVNBLOCK_SHA1_FINGERPRINT
+	return sha1_fingerprint(block, instruction_data);
+#else
+	return murmur_fingerprint(block, instruction_data);
+#endif
+}
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,244 @@
+#include "flat_trace.h"
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+namespace {
+
+constexpr char FLAT_TRACE_MAGIC[8] = {'R', 'V', 'N', 'B', 'F', 'L', 'A', 'T'};
+
+// The sizes described in trace-format.md
+static_assert(sizeof(FlatTrace::Header) == 96, "Unexpected size of the flat trace header");
+static_assert(sizeof(FlatTrace::Event) == 16, "Unexpected size of a flat trace event");
+static_assert(sizeof(FlatTrace::Interrupt) == 32, "Unexpected size of a flat trace interrupt");
+static_assert(sizeof(FlatTrace::Block) == 40, "Unexpected size of a flat trace block");
+
+//! Whether the section of count entries of size bytes at offset is aligned and within the file
+bool is_valid_section(std::uint64_t offset, std::uint64_t count, std::size_t size, std::uint64_t file_size)
+{
+	if (offset % 8 != 0 or offset > file_size) {
+		return false;
+	}
+	return count <= (file_size - offset) / size;
+}
+
+} // anonymous namespace
+
+bool FlatTrace::is_flat_trace(const char* filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	char magic[sizeof(FLAT_TRACE_MAGIC)];
+	if (not file.read(magic, sizeof(magic))) {
+		return false;
+	}
+	return std::memcmp(magic, FLAT_TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+FlatTrace::FlatTrace(const char* filename)
+{
+	const int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error(std::string("Cannot open flat trace ") + filename);
+	}
+
+	struct stat status;
+	if (::fstat(fd, &status) != 0 or static_cast<std::size_t>(status.st_size) < sizeof(Header)) {
+		::close(fd);
+		throw std::runtime_error(std::string("Not a flat trace: ") + filename);
+	}
+	size_ = status.st_size;
+
+	mapping_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping keeps the file open
+	::close(fd);
+	if (mapping_ == MAP_FAILED) {
+		mapping_ = nullptr;
+		throw std::runtime_error(std::string("Cannot map flat trace ") + filename);
+	}
+
+	const auto& header = this->header();
+	try {
+		if (std::memcmp(header.magic, FLAT_TRACE_MAGIC, sizeof(FLAT_TRACE_MAGIC)) != 0) {
+			throw std::runtime_error(std::string("Not a flat trace: ") + filename);
+		}
+		if (header.version != FLAT_TRACE_VERSION) {
+			throw std::runtime_error("Incompatible flat trace version " + std::to_string(header.version));
+		}
+		if (not is_valid_section(header.events_offset, header.event_count, sizeof(Event), size_) or
+		    not is_valid_section(header.interrupts_offset, header.interrupt_count, sizeof(Interrupt), size_) or
+		    not is_valid_section(header.data_offset, header.data_size, 1, size_) or
+		    not is_valid_section(header.blocks_offset, header.block_count, sizeof(Block), size_) or
+		    not is_valid_section(header.instruction_offsets_offset, header.instruction_offset_count,
+		                         sizeof(std::uint32_t), size_)) {
+			throw std::runtime_error(std::string("Truncated flat trace: ") + filename);
+		}
+	} catch (...) {
+		::munmap(mapping_, size_);
+		throw;
+	}
+
+	const auto* base = static_cast<const std::uint8_t*>(mapping_);
+	events_ = reinterpret_cast<const Event*>(base + header.events_offset);
+	interrupts_ = reinterpret_cast<const Interrupt*>(base + header.interrupts_offset);
+	data_ = base + header.data_offset;
+	blocks_ = reinterpret_cast<const Block*>(base + header.blocks_offset);
+	instruction_offsets_ = reinterpret_cast<const std::uint32_t*>(base + header.instruction_offsets_offset);
+}
+
+FlatTrace::~FlatTrace()
+{
+	::munmap(mapping_, size_);
+}
+
+const FlatTrace::Interrupt* FlatTrace::find_interrupt(std::uint64_t transition_id) const
+{
+	const auto index = interrupt_index(transition_id);
+	if (index == interrupt_count() or interrupts_[index].transition_id != transition_id) {
+		return nullptr;
+	}
+	return &interrupts_[index];
+}
+
+std::uint64_t FlatTrace::interrupt_index(std::uint64_t transition_id) const
+{
+	return std::lower_bound(interrupts_, interrupts_ + interrupt_count(), transition_id,
+	                        [](const Interrupt& interrupt, std::uint64_t transition_id) {
+	                            return interrupt.transition_id < transition_id;
+	                        }) - interrupts_;
+}
+
+FlatTraceWriter::FlatTraceWriter(const char* filename) :
+    file_(filename, std::ios::binary | std::ios::trunc),
+    header_()
+{
+	if (not file_) {
+		throw std::runtime_error(std::string("Cannot create flat trace ") + filename);
+	}
+
+	std::memcpy(header_.magic, FLAT_TRACE_MAGIC, sizeof(FLAT_TRACE_MAGIC));
+	header_.version = FLAT_TRACE_VERSION;
+
+	// the header is rewritten by finish
+	write(&header_, sizeof(header_));
+	header_.events_offset = position_;
+
+	// the block ids begin at 1
+	blocks_.push_back(FlatTrace::Block());
+}
+
+void FlatTraceWriter::add_event(std::uint64_t end_transition_id, std::int32_t block_id)
+{
+	if (section_ != Section::Events) {
+		throw std::logic_error("Cannot add an event after the interrupts or blocks");
+	}
+	if (end_transition_id <= last_transition_id_) {
+		throw std::logic_error("The events must end in increasing order");
+	}
+	last_transition_id_ = end_transition_id;
+
+	const FlatTrace::Event event{end_transition_id, block_id, 0};
+	write(&event, sizeof(event));
+	++header_.event_count;
+}
+
+void FlatTraceWriter::add_interrupt(const FlatTrace::Interrupt& interrupt)
+{
+	enter(Section::Interrupts);
+	if (header_.interrupt_count != 0 and interrupt.transition_id <= last_transition_id_) {
+		throw std::logic_error("The interrupts must be in increasing transition order");
+	}
+	last_transition_id_ = interrupt.transition_id;
+
+	write(&interrupt, sizeof(interrupt));
+	++header_.interrupt_count;
+}
+
+void FlatTraceWriter::add_block(const reader::InstructionBlock& block,
+                                const std::vector<std::uint32_t>& instruction_offsets)
+{
+	if (block.instruction_data.size() > std::numeric_limits<std::uint32_t>::max()) {
+		throw std::logic_error("The instruction data of a block must not exceed 4 GiB");
+	}
+	enter(Section::Data);
+
+	FlatTrace::Block entry = FlatTrace::Block();
+	entry.first_pc = block.first_pc;
+	entry.data_offset = header_.data_size;
+	entry.instruction_offsets_begin = instruction_offsets_.size();
+	entry.data_size = block.instruction_data.size();
+	entry.instruction_offset_count = instruction_offsets.size();
+	entry.instruction_count = block.instruction_count;
+	entry.mode = static_cast<std::uint8_t>(block.mode);
+	blocks_.push_back(entry);
+	instruction_offsets_.insert(instruction_offsets_.end(), instruction_offsets.begin(), instruction_offsets.end());
+
+	write(block.instruction_data.data(), block.instruction_data.size());
+	header_.data_size += block.instruction_data.size();
+}
+
+void FlatTraceWriter::finish()
+{
+	enter(Section::Data);
+
+	align();
+	header_.block_count = blocks_.size();
+	header_.blocks_offset = position_;
+	write(blocks_.data(), blocks_.size() * sizeof(FlatTrace::Block));
+
+	header_.instruction_offset_count = instruction_offsets_.size();
+	header_.instruction_offsets_offset = position_;
+	write(instruction_offsets_.data(), instruction_offsets_.size() * sizeof(std::uint32_t));
+
+	file_.seekp(0);
+	file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+	file_.flush();
+	if (not file_) {
+		throw std::runtime_error("Cannot write flat trace");
+	}
+}
+
+void FlatTraceWriter::enter(Section section)
+{
+	if (section < section_) {
+		throw std::logic_error("Cannot add interrupts after the blocks");
+	}
+
+	// the sections that were skipped are empty
+	while (section_ < section) {
+		section_ = static_cast<Section>(static_cast<int>(section_) + 1);
+		align();
+		if (section_ == Section::Interrupts) {
+			header_.interrupts_offset = position_;
+		} else {
+			header_.data_offset = position_;
+		}
+	}
+}
+
+void FlatTraceWriter::write(const void* data, std::size_t size)
+{
+	file_.write(static_cast<const char*>(data), size);
+	if (not file_) {
+		throw std::runtime_error("Cannot write flat trace");
+	}
+	position_ += size;
+}
+
+void FlatTraceWriter::align()
+{
+	static const char padding[8] = {};
+	write(padding, (8 - position_ % 8) % 8);
+}
+
+}}} // namespace reven::block::detail
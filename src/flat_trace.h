@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <block_reader.h>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Version of the flat trace format written by FlatTraceWriter, see the "Flat traces" section of trace-format.md
+constexpr std::uint32_t FLAT_TRACE_VERSION = 1;
+
+//! Memory mapping of a flat trace, see the "Flat traces" section of trace-format.md.
+//!
+//! Opening a flat trace maps the file and validates its header without reading the rest of it. The events, blocks,
+//! instruction offsets and interrupts are then read in place from the mapping, which is read-only: a FlatTrace can be
+//! shared between threads.
+class FlatTrace {
+public:
+	//! The header at the beginning of the file
+	struct Header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t reserved;
+		// Number of entries and position of each section in the file
+		std::uint64_t event_count;
+		std::uint64_t events_offset;
+		std::uint64_t interrupt_count;
+		std::uint64_t interrupts_offset;
+		std::uint64_t data_size;
+		std::uint64_t data_offset;
+		std::uint64_t block_count;
+		std::uint64_t blocks_offset;
+		std::uint64_t instruction_offset_count;
+		std::uint64_t instruction_offsets_offset;
+	};
+
+	//! An execution event, that begins at the end of the previous one
+	struct Event {
+		std::uint64_t end_transition_id;
+		std::int32_t block_id;
+		std::uint32_t reserved;
+	};
+
+	struct Interrupt {
+		std::uint64_t transition_id;
+		std::uint64_t pc;
+		std::uint32_t number;
+		//! 0 if the interrupt has no related instruction
+		std::int32_t related_block_id;
+		std::uint8_t mode;
+		std::uint8_t is_hw;
+		std::uint8_t reserved[6];
+	};
+
+	//! An entry of the block table, indexed by block id
+	struct Block {
+		std::uint64_t first_pc;
+		//! Position of the instruction data in the data section
+		std::uint64_t data_offset;
+		//! Index of the first instruction offset in the instruction offsets section
+		std::uint64_t instruction_offsets_begin;
+		std::uint32_t data_size;
+		std::uint32_t instruction_offset_count;
+		std::uint16_t instruction_count;
+		std::uint8_t mode;
+		std::uint8_t reserved[5];
+	};
+
+	//! Whether the file begins with the magic of a flat trace. false if the file cannot be read.
+	static bool is_flat_trace(const char* filename);
+
+	//! Map the file.
+	//!
+	//! Throws RuntimeError if the file cannot be mapped, is not a flat trace or not in the supported version.
+	explicit FlatTrace(const char* filename);
+	~FlatTrace();
+	FlatTrace(const FlatTrace&) = delete;
+	FlatTrace& operator=(const FlatTrace&) = delete;
+
+	std::uint64_t event_count() const { return header().event_count; }
+	const Event& event(std::uint64_t index) const { return events_[index]; }
+
+	//! Transition at which the event at index begins
+	std::uint64_t event_begin(std::uint64_t index) const {
+		return index == 0 ? 0 : events_[index - 1].end_transition_id;
+	}
+
+	//! Index of the event that contains transition_id, or event_count if the transition is past the last event
+	std::uint64_t find_event(std::uint64_t transition_id) const {
+		return std::upper_bound(events_, events_ + event_count(), transition_id,
+		                        [](std::uint64_t transition_id, const Event& event) {
+		                            return transition_id < event.end_transition_id;
+		                        }) - events_;
+	}
+
+	std::uint64_t interrupt_count() const { return header().interrupt_count; }
+	const Interrupt& interrupt(std::uint64_t index) const { return interrupts_[index]; }
+
+	//! The interrupt at transition_id, or nullptr if there is none
+	const Interrupt* find_interrupt(std::uint64_t transition_id) const;
+
+	//! Index of the first interrupt at or after transition_id, or interrupt_count if there is none
+	std::uint64_t interrupt_index(std::uint64_t transition_id) const;
+
+	//! Number of entries of the block table: the block ids are in [1, block_count)
+	std::uint64_t block_count() const { return header().block_count; }
+
+	//! The entry of the block, or nullptr if the block id is not in the table
+	//!
+	//! Throws RuntimeError if the instruction data or the instruction offsets of the block are not within their
+	//! sections, which are within the file.
+	const Block* block(std::int32_t block_id) const {
+		if (block_id < 1 or static_cast<std::uint64_t>(block_id) >= block_count()) {
+			return nullptr;
+		}
+		const auto& block = blocks_[block_id];
+		if (not is_within(block.data_offset, block.data_size, header().data_size) or
+		    not is_within(block.instruction_offsets_begin, block.instruction_offset_count,
+		                  header().instruction_offset_count)) {
+			throw std::runtime_error("Corrupt flat trace: block " + std::to_string(block_id) +
+			                         " is out of its sections");
+		}
+		return &block;
+	}
+
+	const std::uint8_t* block_data(const Block& block) const { return data_ + block.data_offset; }
+
+	const std::uint32_t* block_instruction_offsets(const Block& block) const {
+		return instruction_offsets_ + block.instruction_offsets_begin;
+	}
+
+private:
+	const Header& header() const { return *reinterpret_cast<const Header*>(mapping_); }
+
+	//! Whether the count entries at begin are within a section of section_count entries
+	static bool is_within(std::uint64_t begin, std::uint64_t count, std::uint64_t section_count) {
+		return begin <= section_count and count <= section_count - begin;
+	}
+
+	void* mapping_ = nullptr;
+	std::size_t size_ = 0;
+
+	const Event* events_;
+	const Interrupt* interrupts_;
+	const std::uint8_t* data_;
+	const Block* blocks_;
+	const std::uint32_t* instruction_offsets_;
+};
+
+//! Write a flat trace, see FlatTrace.
+//!
+//! The sections are written one after the other: all the events in order, then all the interrupts in order, then the
+//! blocks in order of id, and finally finish writes the header. The block table and the instruction offsets are kept
+//! in memory until then.
+class FlatTraceWriter {
+public:
+	//! Throws RuntimeError if the file cannot be created
+	explicit FlatTraceWriter(const char* filename);
+
+	//! The next event, that begins at the end of the previous one
+	//!
+	//! Throws LogicError if called after add_interrupt or add_block, or if the events do not end in increasing order
+	void add_event(std::uint64_t end_transition_id, std::int32_t block_id);
+
+	//! Throws LogicError if called after add_block, or if the interrupts are not in increasing transition order
+	void add_interrupt(const FlatTrace::Interrupt& interrupt);
+
+	//! The block whose id is the number of blocks added so far plus one
+	//!
+	//! Throws LogicError if the block has more than 4 GiB of instruction data.
+	void add_block(const reader::InstructionBlock& block, const std::vector<std::uint32_t>& instruction_offsets);
+
+	//! Write the remaining sections and the header.
+	//!
+	//! Throws RuntimeError if the file could not be written.
+	void finish();
+
+private:
+	enum class Section { Events, Interrupts, Data };
+
+	//! Move on to the specified section, which must not be before the current one
+	void enter(Section section);
+	void write(const void* data, std::size_t size);
+	//! Pad the file to a multiple of 8 bytes, so that the next section is aligned
+	void align();
+
+	std::ofstream file_;
+	std::uint64_t position_ = 0;
+	Section section_ = Section::Events;
+	FlatTrace::Header header_;
+	// End of the last event, or transition of the last interrupt
+	std::uint64_t last_transition_id_ = 0;
+
+	std::vector<FlatTrace::Block> blocks_;
+	std::vector<std::uint32_t> instruction_offsets_;
+};
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,39 @@
+#include "instruction_offsets.h"
+
+#include <limits>
+#include <stdexcept>
+
+#include "varint.h"
+
+namespace reven {
+namespace block {
+namespace detail {
+
+// Offsets are not necessarily increasing if the caller reported instructions out of order, so the differences are
+// computed modulo 2^32 to always round-trip.
+
+void encode_instruction_offsets(const std::vector<std::uint32_t>& offsets, std::vector<std::uint8_t>& out)
+{
+	out.clear();
+	std::uint32_t previous = 0;
+	for (auto offset : offsets) {
+		put_varint(out, static_cast<std::uint32_t>(offset - previous));
+		previous = offset;
+	}
+}
+
+void decode_instruction_offsets(const std::uint8_t* data, std::size_t size, std::vector<std::uint32_t>& offsets)
+{
+	offsets.clear();
+	std::uint32_t previous = 0;
+	for (const auto* cursor = data; cursor != data + size;) {
+		const auto delta = get_varint(cursor, data + size, "Malformed instruction offsets");
+		if (delta > std::numeric_limits<std::uint32_t>::max()) {
+			throw std::runtime_error("Malformed instruction offsets");
+		}
+		previous += static_cast<std::uint32_t>(delta);
+		offsets.push_back(previous);
+	}
+}
+
+}}} // namespace reven::block::detail
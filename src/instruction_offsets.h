@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Encode the offsets of the instructions of a block, as stored in the instruction_offsets column of the blocks table.
+//!
+//! Each offset is stored as the varint of its difference with the previous offset, which fits in a single byte for
+//! x86 instructions.
+void encode_instruction_offsets(const std::vector<std::uint32_t>& offsets, std::vector<std::uint8_t>& out);
+
+//! Decode the instruction_offsets column of the blocks table into offsets, replacing its content.
+//!
+//! Throws RuntimeError if the data is malformed.
+void decode_instruction_offsets(const std::uint8_t* data, std::size_t size, std::vector<std::uint32_t>& offsets);
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,56 @@
+#include "known_block_data.h"
+
+#include <cstring>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+namespace {
+
+// Estimate of the bookkeeping of a copy: the node of the map, the allocation of the data and the slot of the order
+constexpr std::size_t ENTRY_OVERHEAD = 80;
+
+} // anonymous namespace
+
+bool KnownBlockData::compare(std::uint32_t id, const writer::ExecutedBlock& block, Span instruction_data,
+                             bool& is_same) const
+{
+	const auto it = entries_.find(id);
+	if (it == entries_.end()) {
+		return false;
+	}
+
+	const auto& entry = it->second;
+	is_same = entry.block == block and entry.data.size() == instruction_data.size and
+	          (instruction_data.size == 0 or
+	           std::memcmp(entry.data.data(), instruction_data.data, instruction_data.size) == 0);
+	return true;
+}
+
+void KnownBlockData::insert(std::uint32_t id, const writer::ExecutedBlock& block, Span instruction_data)
+{
+	const auto bytes = entry_bytes(instruction_data.size);
+	if (bytes > max_bytes_ or entries_.count(id) != 0) {
+		return;
+	}
+
+	while (bytes_ + bytes > max_bytes_) {
+		const auto oldest = entries_.find(order_.front());
+		bytes_ -= entry_bytes(oldest->second.data.size());
+		entries_.erase(oldest);
+		order_.pop_front();
+	}
+
+	entries_.emplace(id, Entry{block, std::vector<std::uint8_t>(instruction_data.data,
+	                                                            instruction_data.data + instruction_data.size)});
+	order_.push_back(id);
+	bytes_ += bytes;
+}
+
+std::size_t KnownBlockData::entry_bytes(std::size_t data_size)
+{
+	return ENTRY_OVERHEAD + data_size;
+}
+
+}}} // namespace reven::block::detail
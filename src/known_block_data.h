@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <block_writer.h>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Copies of the known blocks of a Writer and of their instruction data, to confirm a fingerprint match without
+//! reading the block back from the database.
+//!
+//! The copies take at most a budget of bytes. Once it is reached, the oldest copies are evicted first: the evicted
+//! blocks are read back from the database when they are matched, and can then be added again.
+class KnownBlockData {
+public:
+	//! - max_bytes: budget of the copies, including an estimate of the bookkeeping of each copy
+	explicit KnownBlockData(std::size_t max_bytes) : max_bytes_(max_bytes) {}
+
+	//! Compare the copy of the block with the id to block and its instruction data.
+	//!
+	//! Returns false if the block has no copy, otherwise sets is_same to the result of the comparison and returns true.
+	bool compare(std::uint32_t id, const writer::ExecutedBlock& block, Span instruction_data, bool& is_same) const;
+
+	//! Add a copy of the block, evicting the oldest copies to stay within the budget.
+	//!
+	//! Does nothing if the block alone exceeds the budget.
+	void insert(std::uint32_t id, const writer::ExecutedBlock& block, Span instruction_data);
+
+	//! Bytes taken by the copies, as counted against the budget
+	std::size_t size_bytes() const {
+		return bytes_;
+	}
+
+private:
+	struct Entry {
+		writer::ExecutedBlock block;
+		std::vector<std::uint8_t> data;
+	};
+
+	//! Bytes counted against the budget for a copy of instruction data of the specified size
+	static std::size_t entry_bytes(std::size_t data_size);
+
+	std::size_t max_bytes_;
+	std::size_t bytes_ = 0;
+	std::unordered_map<std::uint32_t, Entry> entries_;
+	// Ids of the copies, oldest first
+	std::deque<std::uint32_t> order_;
+};
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,227 @@
+#include <sharded_writer.h>
+
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <unordered_set>
+#include <utility>
+
+#include <block_reader.h>
+
+namespace reven {
+namespace block {
+namespace writer {
+
+namespace {
+
+// The transitions that the Writer of a shard did not record, as [begin, end) pairs in transition order
+std::vector<std::pair<std::uint64_t, std::uint64_t>> read_execution_gaps(sqlite::Database& db)
+{
+	std::vector<std::pair<std::uint64_t, std::uint64_t>> gaps;
+	sqlite::Statement table(db, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'execution_gaps';");
+	if (table.step() != sqlite::Statement::StepResult::Row) {
+		return gaps;
+	}
+
+	sqlite::Statement stmt(db, "SELECT begin_transition_id, end_transition_id FROM execution_gaps "
+	                           "ORDER BY begin_transition_id;");
+	while (stmt.step() == sqlite::Statement::StepResult::Row) {
+		gaps.emplace_back(stmt.column_u64(0), stmt.column_u64(1));
+	}
+	return gaps;
+}
+
+// Position of the merge in the events of a shard
+struct ShardCursor {
+	ShardCursor(sqlite::ResourceDatabase db) :
+	    gaps(read_execution_gaps(db)),
+	    reader(std::move(db)),
+	    query(reader.query_events()),
+	    it(query.begin()),
+	    end(query.end())
+	{}
+
+	// The beginning of the event in the execution, rather than in the shard: an event that follows a gap of the
+	// shard begins at the end of the gap.
+	std::uint64_t begin_transition_id(const reader::BlockExecutionEvent& event) {
+		if (next_gap < gaps.size() and gaps[next_gap].first == event.begin_transition_id) {
+			return gaps[next_gap++].second;
+		}
+		return event.begin_transition_id;
+	}
+
+	std::vector<std::pair<std::uint64_t, std::uint64_t>> gaps;
+	std::size_t next_gap = 0;
+	reader::Reader reader;
+	reader::Reader::EventQuery query;
+	decltype(query.begin()) it;
+	decltype(query.end()) end;
+};
+
+struct HeapEntry {
+	std::uint64_t end_transition_id;
+	std::size_t shard;
+
+	bool operator>(const HeapEntry& o) const {
+		return end_transition_id > o.end_transition_id;
+	}
+};
+
+// Key of a block of a shard, for the set of blocks whose instruction offsets were already reported
+std::uint64_t shard_block_key(std::size_t shard, reader::BlockHandle handle)
+{
+	return (static_cast<std::uint64_t>(shard) << 32) | static_cast<std::uint32_t>(handle.handle());
+}
+
+} // anonymous namespace
+
+void merge_shards(std::vector<sqlite::ResourceDatabase> shards, Writer& output)
+{
+	// The cursors are never moved, as the queries reference their reader
+	std::vector<std::unique_ptr<ShardCursor>> cursors;
+	std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+	for (auto& shard : shards) {
+		cursors.emplace_back(new ShardCursor(std::move(shard)));
+		const auto& cursor = *cursors.back();
+		if (cursor.it != cursor.end) {
+			heap.push(HeapEntry{cursor.it->end_transition_id, cursors.size() - 1});
+		}
+	}
+
+	std::unordered_set<std::uint64_t> reported_offsets;
+	std::vector<std::uint32_t> instruction_indexes;
+	// The block of a shard that was last reported to output, which is the related instruction of an interrupt
+	std::uint64_t last_block_key = std::numeric_limits<std::uint64_t>::max();
+
+	auto add_block = [&](std::size_t shard, ShardCursor& cursor, std::uint64_t transition_id,
+	                     reader::BlockHandle handle) {
+		const auto& block = cursor.reader.block(handle);
+		output.add_block(transition_id, ExecutedBlock{block.first_pc, block.instruction_count, block.mode},
+		                 Span{block.instruction_data.size(), block.instruction_data.data()});
+		last_block_key = shard_block_key(shard, handle);
+
+		// All the instruction offsets known to the shard are reported the first time its block is merged
+		if (reported_offsets.insert(last_block_key).second) {
+			auto instructions = cursor.reader.block_with_instructions(handle, std::move(instruction_indexes));
+			for (std::uint32_t i = 0; i < instructions.instruction_count(); ++i) {
+				output.add_block_instruction(instructions.instruction(i)->pc);
+			}
+			instruction_indexes = std::move(instructions).take_instruction_indexes();
+		}
+	};
+
+	std::uint64_t begin_transition_id = 0;
+	bool has_events = false;
+
+	while (not heap.empty()) {
+		const auto entry = heap.top();
+		heap.pop();
+
+		auto& cursor = *cursors[entry.shard];
+		const auto event = *cursor.it;
+		++cursor.it;
+		if (cursor.it != cursor.end) {
+			heap.push(HeapEntry{cursor.it->end_transition_id, entry.shard});
+		}
+
+		// The events are merged in the order of their end, so each event must begin at the end of the previous one
+		const auto event_begin = cursor.begin_transition_id(event);
+		if (event_begin < begin_transition_id) {
+			throw std::runtime_error("Shards overlap at transition " + std::to_string(event_begin));
+		}
+		if (event_begin > begin_transition_id) {
+			throw std::runtime_error("No shard records transition " + std::to_string(begin_transition_id));
+		}
+
+		if (event.has_instructions()) {
+			add_block(entry.shard, cursor, begin_transition_id, event.block_handle);
+		} else {
+			const auto shard_interrupt = cursor.reader.interrupt_at(begin_transition_id);
+			if (not shard_interrupt) {
+				throw std::runtime_error("Missing interrupt in shard at transition " +
+				                         std::to_string(begin_transition_id));
+			}
+			// The related instruction is the last block reported to output. The related block may have no execution
+			// event of its own, e.g. when the interrupt occurs at its first instruction, so it is reported at the
+			// transition of the interrupt: output inserts it without an execution, like the Writer of the shard did.
+			if (shard_interrupt->has_related_instruction() and
+			    shard_block_key(entry.shard, shard_interrupt->related_block()) != last_block_key) {
+				add_block(entry.shard, cursor, begin_transition_id, shard_interrupt->related_block());
+			}
+
+			Interrupt interrupt;
+			interrupt.pc = shard_interrupt->pc;
+			interrupt.mode = shard_interrupt->mode;
+			interrupt.number = shard_interrupt->number;
+			interrupt.is_hw = shard_interrupt->is_hw;
+			interrupt.has_related_instruction = shard_interrupt->has_related_instruction();
+			output.add_interrupt(begin_transition_id, interrupt);
+		}
+
+		begin_transition_id = event.end_transition_id;
+		has_events = true;
+	}
+
+	if (has_events) {
+		output.finalize_execution(begin_transition_id);
+	}
+}
+
+ShardedWriter::ShardedWriter(const char* filename, const char* tool_name, const char* tool_version,
+                             const char* tool_info, std::size_t shard_count, WriterOptions options) :
+    filename_(filename),
+    tool_name_(tool_name),
+    tool_version_(tool_version),
+    tool_info_(tool_info),
+    options_(options)
+{
+	if (shard_count == 0) {
+		throw std::logic_error("ShardedWriter requires at least one shard");
+	}
+
+	shards_.reserve(shard_count);
+	for (std::size_t i = 0; i < shard_count; ++i) {
+		auto shard_filename = filename_ == ":memory:" ? filename_ : filename_ + ".shard" + std::to_string(i);
+		std::remove(shard_filename.c_str());
+		shards_.emplace_back(shard_filename.c_str(), tool_name, tool_version, tool_info, options);
+		shard_filenames_.push_back(std::move(shard_filename));
+	}
+}
+
+ShardedWriter::~ShardedWriter()
+{
+	// Shards that were never merged are discarded
+	shards_.clear();
+	remove_shard_files();
+}
+
+sqlite::ResourceDatabase ShardedWriter::merge() &&
+{
+	std::vector<sqlite::ResourceDatabase> shard_dbs;
+	for (auto& shard : shards_) {
+		shard_dbs.push_back(std::move(shard).take());
+	}
+	// The shard writers must be destroyed before their databases
+	shards_.clear();
+
+	Writer output(filename_.c_str(), tool_name_.c_str(), tool_version_.c_str(), tool_info_.c_str(), options_);
+	merge_shards(std::move(shard_dbs), output);
+	auto db = std::move(output).take();
+
+	remove_shard_files();
+	return db;
+}
+
+void ShardedWriter::remove_shard_files()
+{
+	for (const auto& shard_filename : shard_filenames_) {
+		if (shard_filename != ":memory:") {
+			std::remove(shard_filename.c_str());
+		}
+	}
+	shard_filenames_.clear();
+}
+
+}}} // namespace reven::block::writer
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Bounded lock-free ring of variable-size records, for exactly one producer thread and one consumer thread.
+//!
+//! Each record is stored contiguously, prefixed by its size, and padded to 8 bytes. A record that would wrap
+//! around the end of the buffer is preceded by a padding marker and stored at the beginning instead.
+class SpscRing {
+public:
+	//! Create a ring able to hold capacity bytes, rounded up to a power of two.
+	explicit SpscRing(std::size_t capacity) :
+	    buffer_(round_capacity(capacity)),
+	    mask_(buffer_.size() - 1)
+	{}
+
+	SpscRing(const SpscRing&) = delete;
+	SpscRing& operator=(const SpscRing&) = delete;
+
+	//! Largest record that can be pushed in this ring.
+	std::size_t max_record_size() const {
+		return buffer_.size() / 2 - sizeof(std::uint64_t);
+	}
+
+	//! Producer: attempt to reserve contiguous storage for a record of size bytes.
+	//!
+	//! Returns nullptr if the ring is currently too full, otherwise a pointer to fill before calling commit.
+	std::uint8_t* try_reserve(std::size_t size) {
+		if (size > max_record_size()) {
+			throw std::length_error("Record too large for the ring");
+		}
+
+		const auto total = record_size(size);
+		auto position = producer_.value.head & mask_;
+		const auto contiguous = buffer_.size() - position;
+		const auto needed = total > contiguous ? total + contiguous : total;
+
+		if (free_space() < needed) {
+			producer_.value.cached_tail = tail_.value.load(std::memory_order_acquire);
+			if (free_space() < needed) {
+				return nullptr;
+			}
+		}
+
+		if (total > contiguous) {
+			write_size(position, PADDING);
+			producer_.value.head += contiguous;
+			position = 0;
+		}
+
+		write_size(position, size);
+		producer_.value.reserved = total;
+		return buffer_.data() + position + sizeof(std::uint64_t);
+	}
+
+	//! Producer: publish the record obtained from the last successful try_reserve.
+	void commit() {
+		producer_.value.head += producer_.value.reserved;
+		producer_.value.reserved = 0;
+		published_head_.value.store(producer_.value.head, std::memory_order_release);
+	}
+
+	//! Consumer: access the oldest record, or return nullptr if the ring is empty.
+	const std::uint8_t* front(std::size_t& size) {
+		while (true) {
+			if (consumer_.value.tail == consumer_.value.cached_head) {
+				consumer_.value.cached_head = published_head_.value.load(std::memory_order_acquire);
+				if (consumer_.value.tail == consumer_.value.cached_head) {
+					return nullptr;
+				}
+			}
+
+			const auto position = consumer_.value.tail & mask_;
+			std::uint64_t record;
+			std::memcpy(&record, buffer_.data() + position, sizeof(record));
+			if (record == PADDING) {
+				consumer_.value.tail += buffer_.size() - position;
+				continue;
+			}
+
+			size = record;
+			return buffer_.data() + position + sizeof(std::uint64_t);
+		}
+	}
+
+	//! Consumer: release the record obtained from front, making its storage available to the producer.
+	void pop(std::size_t size) {
+		consumer_.value.tail += record_size(size);
+		tail_.value.store(consumer_.value.tail, std::memory_order_release);
+	}
+
+private:
+	static constexpr std::uint64_t PADDING = ~std::uint64_t(0);
+
+	static std::size_t round_capacity(std::size_t capacity) {
+		std::size_t rounded = 4096;
+		while (rounded < capacity) {
+			rounded *= 2;
+		}
+		return rounded;
+	}
+
+	static std::size_t record_size(std::size_t size) {
+		return (sizeof(std::uint64_t) + size + 7) & ~std::size_t(7);
+	}
+
+	std::size_t free_space() const {
+		return buffer_.size() - (producer_.value.head - producer_.value.cached_tail);
+	}
+
+	void write_size(std::size_t position, std::uint64_t size) {
+		std::memcpy(buffer_.data() + position, &size, sizeof(size));
+	}
+
+	struct ProducerState {
+		std::uint64_t head = 0;
+		std::uint64_t cached_tail = 0;
+		std::size_t reserved = 0;
+	};
+
+	struct ConsumerState {
+		std::uint64_t tail = 0;
+		std::uint64_t cached_head = 0;
+	};
+
+	// Keeps its value alone on its cache line, so that the producer and the consumer do not false-share.
+	// Explicit padding rather than alignas, which would require C++17 aligned new to allocate the ring.
+	template <typename T>
+	struct CacheLine {
+		T value{};
+		char padding[64];
+	};
+
+	std::vector<std::uint8_t> buffer_;
+	const std::size_t mask_;
+
+	CacheLine<ProducerState> producer_;
+	CacheLine<std::atomic<std::uint64_t>> published_head_;
+	CacheLine<ConsumerState> consumer_;
+	CacheLine<std::atomic<std::uint64_t>> tail_;
+};
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,92 @@
+#include "transition_index.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "execution_chunks.h"
+
+namespace reven {
+namespace block {
+namespace detail {
+
+void TransitionIndex::push(std::uint64_t transition_id, std::int32_t block_id)
+{
+	if (rows_ != 0 and transition_id <= end_transition_id_) {
+		throw std::runtime_error("Execution rows are not in transition order at transition " +
+		                         std::to_string(transition_id));
+	}
+
+	if (rows_ % TRANSITION_INDEX_SAMPLE_ROWS == 0) {
+		sample_begins_.push_back(end_transition_id_);
+		sample_offsets_.push_back(data_.size());
+	}
+	encode_execution_row(data_, end_transition_id_, transition_id, block_id);
+	end_transition_id_ = transition_id;
+	++rows_;
+}
+
+bool TransitionIndex::find(std::uint64_t transition_id, Row& row) const
+{
+	if (transition_id >= end_transition_id_) {
+		return false;
+	}
+
+	// the last sample that begins at or before the transition
+	const auto sample = std::upper_bound(sample_begins_.begin(), sample_begins_.end(), transition_id) -
+	                    sample_begins_.begin() - 1;
+	const auto* cursor = data_.data() + sample_offsets_[sample];
+	const auto* end = data_.data() + data_.size();
+
+	row.end_transition_id = sample_begins_[sample];
+	do {
+		row.begin_transition_id = row.end_transition_id;
+		decode_execution_row(cursor, end, row.end_transition_id, row.block_id);
+	} while (row.end_transition_id <= transition_id);
+	return true;
+}
+
+TransitionIndex::Cursor TransitionIndex::seek(std::uint64_t transition_id, std::uint64_t& begin_transition_id) const
+{
+	const auto* end = data_.data() + data_.size();
+	if (sample_begins_.empty()) {
+		begin_transition_id = 0;
+		return Cursor(end, end, 0);
+	}
+
+	const auto sample = sample_at(transition_id);
+	begin_transition_id = sample_begins_[sample];
+	return Cursor(data_.data() + sample_offsets_[sample], end, begin_transition_id);
+}
+
+std::size_t TransitionIndex::sample_at(std::uint64_t transition_id) const
+{
+	// the first sample begins at 0
+	return std::upper_bound(sample_begins_.begin(), sample_begins_.end(), transition_id) - sample_begins_.begin() - 1;
+}
+
+TransitionIndex::Cursor TransitionIndex::sample_rows(std::size_t sample, std::uint64_t& begin_transition_id) const
+{
+	begin_transition_id = sample_begins_[sample];
+	const auto end_offset = sample + 1 < sample_offsets_.size() ? sample_offsets_[sample + 1] : data_.size();
+	return Cursor(data_.data() + sample_offsets_[sample], data_.data() + end_offset, begin_transition_id);
+}
+
+bool TransitionIndex::Cursor::next(std::uint64_t& transition_id, std::int32_t& block_id)
+{
+	if (cursor_ == end_) {
+		return false;
+	}
+	decode_execution_row(cursor_, end_, transition_id_, block_id);
+	transition_id = transition_id_;
+	return true;
+}
+
+void TransitionIndex::shrink_to_fit()
+{
+	data_.shrink_to_fit();
+	sample_begins_.shrink_to_fit();
+	sample_offsets_.shrink_to_fit();
+}
+
+}}} // namespace reven::block::detail
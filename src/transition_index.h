@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Number of rows between two samples of a TransitionIndex
+constexpr std::uint64_t TRANSITION_INDEX_SAMPLE_ROWS = 64;
+
+//! In-memory index of the rows of the execution table, to find the row that contains a transition without a query.
+//!
+//! A sampled delta array: the rows are encoded back to back as in the chunks of the execution_chunks table, and the
+//! transition at which every TRANSITION_INDEX_SAMPLE_ROWS-th row begins is sampled along with its offset in the
+//! encoded rows. A lookup is a binary search in the samples, followed by the decoding of at most
+//! TRANSITION_INDEX_SAMPLE_ROWS rows.
+class TransitionIndex {
+public:
+	//! A row of the execution table, with the transition at which it begins
+	struct Row {
+		std::uint64_t begin_transition_id;
+		std::uint64_t end_transition_id;
+		std::int32_t block_id;
+	};
+
+	//! Append the next row of the execution table.
+	//!
+	//! Throws RuntimeError if the row does not end after the previous row.
+	void push(std::uint64_t transition_id, std::int32_t block_id);
+
+	//! Sequential reader of the rows of the index
+	class Cursor {
+	public:
+		//! Read the next row, returning false after the last row.
+		bool next(std::uint64_t& transition_id, std::int32_t& block_id);
+	private:
+		Cursor(const std::uint8_t* cursor, const std::uint8_t* end, std::uint64_t transition_id) :
+		    cursor_(cursor), end_(end), transition_id_(transition_id) {}
+
+		const std::uint8_t* cursor_;
+		const std::uint8_t* end_;
+		std::uint64_t transition_id_;
+
+		friend class TransitionIndex;
+	};
+
+	//! Retrieve the row that contains transition_id, returning false if the transition is past the last row.
+	bool find(std::uint64_t transition_id, Row& row) const;
+
+	//! A cursor on the rows from the sampled row at or before the one that contains transition_id.
+	//!
+	//! - begin_transition_id: set to the transition at which the first row of the cursor begins.
+	Cursor seek(std::uint64_t transition_id, std::uint64_t& begin_transition_id) const;
+
+	std::size_t sample_count() const {
+		return sample_begins_.size();
+	}
+
+	//! The sample that contains transition_id, or the last sample if the transition is past the last row.
+	//!
+	//! The index must not be empty.
+	std::size_t sample_at(std::uint64_t transition_id) const;
+
+	//! A cursor on the rows of the specified sample only.
+	//!
+	//! - begin_transition_id: set to the transition at which the first row of the sample begins.
+	Cursor sample_rows(std::size_t sample, std::uint64_t& begin_transition_id) const;
+
+	//! End of the last row
+	std::uint64_t end_transition_id() const {
+		return end_transition_id_;
+	}
+
+	std::uint64_t size() const {
+		return rows_;
+	}
+
+	//! Release the memory reserved for future rows
+	void shrink_to_fit();
+
+	//! Memory allocated by the index, in bytes
+	std::size_t memory_usage() const {
+		return data_.capacity() + sample_begins_.capacity() * sizeof(std::uint64_t) +
+		       sample_offsets_.capacity() * sizeof(std::uint64_t);
+	}
+
+private:
+	std::vector<std::uint8_t> data_;
+	// Transition at which each sampled row begins, and the offset of its encoding in data_
+	std::vector<std::uint64_t> sample_begins_;
+	std::vector<std::uint64_t> sample_offsets_;
+	std::uint64_t end_transition_id_ = 0;
+	std::uint64_t rows_ = 0;
+};
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Append value to out as an unsigned LEB128 varint
+inline void put_varint(std::vector<std::uint8_t>& out, std::uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(static_cast<std::uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<std::uint8_t>(value));
+}
+
+//! Read an unsigned LEB128 varint at cursor, and advance cursor past it.
+//!
+//! Throws RuntimeError with the specified message if the varint is truncated or too large.
+inline std::uint64_t get_varint(const std::uint8_t*& cursor, const std::uint8_t* end, const char* error)
+{
+	std::uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (cursor == end) {
+			break;
+		}
+		const auto byte = *cursor++;
+		value |= std::uint64_t(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			return value;
+		}
+	}
+	throw std::runtime_error(error);
+}
+
+}}} // namespace reven::block::detail
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include <block_writer.h>
+
+namespace reven {
+namespace block {
+namespace detail {
+
+//! Records the WriterStats of a Writer.
+//!
+//! Unless the library is built with RVNBLOCK_WRITER_STATS, all the methods are empty and inline, so that the
+//! instrumentation of the Writer compiles to nothing.
+class WriterStatsRecorder {
+public:
+	using Clock = std::chrono::steady_clock;
+	using Counter = std::uint64_t writer::WriterStats::*;
+	using Histogram = writer::LatencyHistogram writer::WriterStats::*;
+
+	WriterStatsRecorder() {
+#ifdef RVNBLOCK_WRITER_STATS
+		stats_.enabled = true;
+#endif
+	}
+
+	void count(Counter counter, std::uint64_t value = 1) {
+#ifdef RVNBLOCK_WRITER_STATS
+		stats_.*counter += value;
+#else
+		static_cast<void>(counter);
+		static_cast<void>(value);
+#endif
+	}
+
+	//! Start of a measured operation, to pass to record
+	Clock::time_point start() const {
+#ifdef RVNBLOCK_WRITER_STATS
+		return Clock::now();
+#else
+		return Clock::time_point{};
+#endif
+	}
+
+	void record(Histogram histogram, Clock::time_point start) {
+#ifdef RVNBLOCK_WRITER_STATS
+		const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+		(stats_.*histogram).add(static_cast<std::uint64_t>(duration));
+#else
+		static_cast<void>(histogram);
+		static_cast<void>(start);
+#endif
+	}
+
+	//! Whether the stats should be reported again, at most once per interval. The clock is only read every few
+	//! hundred calls.
+	bool report_due(std::chrono::milliseconds interval) {
+#ifdef RVNBLOCK_WRITER_STATS
+		if (++report_checks_ % REPORT_CHECK_CALLS != 0) {
+			return false;
+		}
+		const auto now = Clock::now();
+		if (now - last_report_ < interval) {
+			return false;
+		}
+		last_report_ = now;
+		return true;
+#else
+		static_cast<void>(interval);
+		return false;
+#endif
+	}
+
+	const writer::WriterStats& stats() const {
+		return stats_;
+	}
+
+private:
+	writer::WriterStats stats_;
+#ifdef RVNBLOCK_WRITER_STATS
+	static constexpr std::uint64_t REPORT_CHECK_CALLS = 256;
+	std::uint64_t report_checks_ = 0;
+	Clock::time_point last_report_ = Clock::now();
+#endif
+};
+
+}}} // namespace reven::block::detail
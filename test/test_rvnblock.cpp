@@ -1,11 +1,22 @@
 #define BOOST_TEST_MODULE RVN_BINARY_TRACE_READER
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <chrono>
 #include <cstdint>
+#include <fstream>
+#include <map>
+#include <thread>
 
 #include <block_writer.h>
+#include <async_writer.h>
+#include <sharded_writer.h>
 #include <block_reader.h>
+#include <concurrent_reader.h>
+
+#include "block_table.h"
 
 using namespace reven::block;
 using Writer = writer::Writer;
@@ -226,3 +237,1898 @@ BOOST_AUTO_TEST_CASE(test_reader_interrupt)
 		BOOST_CHECK(not reader.related_instruction_data(reader.interrupt_at(9).value()));
 	}
 }
+
+BOOST_AUTO_TEST_CASE(test_reader_unsorted_instruction_offsets)
+{
+	Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST");
+	std::vector<std::uint8_t> data = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+	const ExecutedBlock block{0x1000, 3, ExecutionMode::x86_64_bits};
+
+	// the offsets are stored in the reported order, 8 then 4
+	writer.add_block(0, block, Span{data.size(), data.data()});
+	writer.add_block_instruction(0x1008);
+	writer.add_block_instruction(0x1004);
+	writer.add_block(3, block, Span{data.size(), data.data()});
+	writer::Interrupt interrupt;
+	interrupt.has_related_instruction = true;
+	interrupt.number = 14;
+	interrupt.pc = 0x1004;
+	writer.add_interrupt(5, interrupt);
+	writer.finalize_execution(6);
+
+	Reader reader(std::move(writer).take());
+	BOOST_CHECK_EQUAL(reader.next_execution(0x1008, 0).value(), 1);
+	BOOST_CHECK_EQUAL(reader.next_execution(0x1004, 0).value(), 2);
+	BOOST_CHECK_EQUAL(reader.prev_execution(0x1008, 6).value(), 4);
+	BOOST_CHECK(not reader.next_execution(0x1002, 0));
+
+	// the instruction ends at the next offset in the block, not at the next reported one
+	const auto related = reader.related_instruction_data(reader.interrupt_at(5).value()).value();
+	BOOST_CHECK_EQUAL(related.size, 4);
+	BOOST_CHECK_EQUAL(related.data[0], 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_dedup)
+{
+	auto db = []()
+	{
+		Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST");
+
+		ExecutedBlock block;
+		block.block_instruction_count = 2;
+		block.mode = ExecutionMode::x86_64_bits;
+		block.pc = 0x1000;
+		std::vector<std::uint8_t> data = {0x90, 0xc3};
+		std::vector<std::uint8_t> other_data = {0xcc, 0xc3};
+
+		writer.add_block(0, block, Span{data.size(), data.data()});
+		writer.add_block(2, block, Span{other_data.size(), other_data.data()});
+		writer.add_block(4, block, Span{data.size(), data.data()});
+
+		writer.finalize_execution(6);
+
+		return std::move(writer).take();
+	}();
+
+	Reader reader(std::move(db));
+
+	const auto first = reader.event_at(0).value().block_handle;
+	const auto second = reader.event_at(2).value().block_handle;
+	const auto third = reader.event_at(4).value().block_handle;
+
+	// same pc, count and mode but different bytes must not be merged
+	BOOST_CHECK(first != second);
+	BOOST_CHECK(first == third);
+	BOOST_CHECK_EQUAL(reader.block(second).instruction_data[0], 0xcc);
+
+	// enough distinct blocks to grow the table of known blocks several times, with the copies of all the blocks, of
+	// some of them, or of none of them
+	const std::uint64_t block_count = 5000;
+	for (std::uint64_t known_block_bytes : {std::uint64_t(64 * 1024 * 1024), std::uint64_t(100 * 1024),
+	                                        std::uint64_t(0)}) {
+		auto many_db = [block_count, known_block_bytes]()
+		{
+			writer::WriterOptions options;
+			options.known_block_bytes = known_block_bytes;
+			Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+			std::vector<std::uint8_t> data = {0x90, 0xc3};
+			std::vector<std::uint8_t> other_data = {0xcc, 0xc3};
+			std::uint64_t transition = 0;
+			for (int pass = 0; pass < 3; ++pass) {
+				for (std::uint64_t i = 0; i < block_count; ++i) {
+					// the last pass changes the data of some blocks
+					const auto& block_data = pass == 2 and i % 3 == 0 ? other_data : data;
+					writer.add_block(transition, ExecutedBlock{0x1000 + i * 2, 2, ExecutionMode::x86_64_bits},
+					                 Span{block_data.size(), block_data.data()});
+					transition += 2;
+				}
+			}
+			writer.finalize_execution(transition);
+
+			return std::move(writer).take();
+		}();
+
+		Reader many_reader(std::move(many_db));
+		for (std::uint64_t i = 0; i < block_count; i += 97) {
+			const auto handle = many_reader.event_at(i * 2).value().block_handle;
+			BOOST_CHECK(handle == many_reader.event_at((block_count + i) * 2).value().block_handle);
+			BOOST_CHECK_EQUAL(many_reader.block(handle).first_pc, 0x1000 + i * 2);
+			const auto last_handle = many_reader.event_at((2 * block_count + i) * 2).value().block_handle;
+			BOOST_CHECK_EQUAL(handle == last_handle, i % 3 != 0);
+			BOOST_CHECK_EQUAL(many_reader.block(last_handle).instruction_data[0], i % 3 == 0 ? 0xcc : 0x90);
+		}
+	}
+
+	// blocks whose fingerprints collide have distinct entries, told apart by the comparison of the blocks
+	detail::BlockTable table;
+	const detail::Fingerprint fingerprint{42, 43};
+	table.insert(fingerprint, 2);
+	table.insert(fingerprint, 3);
+	auto is_block = [](std::uint32_t id) {
+		return [id](const detail::KnownBlock& entry) { return entry.id == id; };
+	};
+	BOOST_CHECK_EQUAL(table.find(fingerprint, is_block(2))->id, 2);
+	BOOST_CHECK_EQUAL(table.find(fingerprint, is_block(3))->id, 3);
+	BOOST_CHECK(table.find(fingerprint, is_block(4)) == nullptr);
+	BOOST_CHECK_EQUAL(table.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_async_writer)
+{
+	// small ring to exercise wrap-around and backpressure
+	reven::block::writer::AsyncWriter writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", {}, 4096);
+
+	std::vector<std::uint8_t> data;
+	std::uint64_t transition = 0;
+	for (std::uint64_t i = 0; i < 5000; ++i) {
+		ExecutedBlock block;
+		block.block_instruction_count = 2;
+		block.mode = ExecutionMode::x86_64_bits;
+		block.pc = 0x1000 + (i % 7) * 0x100;
+		data.assign(3 + i % 7, static_cast<std::uint8_t>(i % 7));
+		writer.add_block(transition, block, Span{data.size(), data.data()});
+		writer.add_block_instruction(block.pc);
+		writer.add_block_instruction(block.pc + 1);
+		transition += 2;
+
+		if (i % 1000 == 999) {
+			reven::block::writer::Interrupt interrupt;
+			interrupt.number = 14;
+			interrupt.pc = block.pc + 1;
+			interrupt.has_related_instruction = true;
+			writer.add_interrupt(transition, interrupt);
+			transition += 1;
+			writer.flush();
+		}
+	}
+	writer.finalize_execution(transition);
+
+	Reader reader(std::move(writer).take());
+
+	const auto event = reader.event_at(2 * 12 + 1).value();
+	BOOST_CHECK_EQUAL(event.begin_transition_id, 24);
+	BOOST_CHECK_EQUAL(event.end_transition_id, 26);
+	BOOST_CHECK_EQUAL(reader.block(event.block_handle).first_pc, 0x1000 + 5 * 0x100);
+	BOOST_CHECK_EQUAL(reader.block(event.block_handle).instruction_data.size(), 3 + 5);
+	BOOST_CHECK_EQUAL(reader.block_with_instructions(event.block_handle, {}).instruction(1).value().pc,
+	                  0x1000 + 5 * 0x100 + 1);
+
+	BOOST_CHECK_EQUAL(reader.interrupt_at(2000).value().number, 14);
+	BOOST_CHECK(not reader.event_at(2000).value().has_instructions());
+	BOOST_CHECK(not reader.event_at(transition));
+	BOOST_CHECK(static_cast<bool>(reader.event_at(transition - 1)));
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_add_events)
+{
+	using Event = reven::block::writer::Event;
+
+	std::vector<std::uint8_t> block1_data = {0, 1, 2, 3, 4, 42};
+	std::vector<std::uint8_t> block2_data = {0, 1, 2, 3, 4, 5};
+	const ExecutedBlock block1{0, 5, ExecutionMode::x86_64_bits};
+	const ExecutedBlock block2{200, 2, ExecutionMode::x86_32_bits};
+
+	reven::block::writer::Interrupt interrupt;
+	interrupt.has_related_instruction = true;
+	interrupt.number = 14;
+	interrupt.pc = 200;
+
+	std::vector<Event> events;
+	// enough events to fill several multi-row batches
+	std::uint64_t transition = 0;
+	for (int i = 0; i < 2000; ++i) {
+		events.push_back(Event::executed_block(transition, block1, Span{block1_data.size(), block1_data.data()}));
+		events.push_back(Event::executed_instruction(0));
+		events.push_back(Event::executed_instruction(2));
+		transition += 5;
+		events.push_back(Event::executed_block(transition, block2, Span{block2_data.size(), block2_data.data()}));
+		events.push_back(Event::executed_instruction(200));
+		transition += 1;
+		events.push_back(Event::executed_interrupt(transition, interrupt));
+		transition += 1;
+	}
+
+	Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST");
+	writer.add_events(events.data(), events.size() / 2);
+	writer.add_events(events.data() + events.size() / 2, events.size() - events.size() / 2);
+	writer.finalize_execution(transition);
+
+	Reader reader(std::move(writer).take());
+
+	std::uint64_t event_count = 0;
+	for (const auto& event : reader.query_events()) {
+		(void)event;
+		++event_count;
+	}
+	BOOST_CHECK_EQUAL(event_count, 3 * 2000);
+
+	const auto event = reader.event_at(7 * 1500 + 5).value();
+	BOOST_CHECK_EQUAL(event.begin_transition_id, 7 * 1500 + 5);
+	BOOST_CHECK_EQUAL(event.end_transition_id, 7 * 1500 + 6);
+	BOOST_CHECK_EQUAL(reader.block(event.block_handle).first_pc, 200);
+	BOOST_CHECK(reader.block(event.block_handle).mode == ExecutionMode::x86_32_bits);
+
+	const auto interrupt_event = reader.interrupt_at(7 * 1500 + 6).value();
+	BOOST_CHECK_EQUAL(interrupt_event.number, 14);
+	BOOST_CHECK_EQUAL(reader.related_instruction_data(interrupt_event).value().size, block2_data.size());
+
+	const auto first = reader.event_at(1).value();
+	BOOST_CHECK_EQUAL(reader.block_with_instructions(first.block_handle, {}).instruction(1).value().pc, 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_borrowed_data)
+{
+	using Event = reven::block::writer::Event;
+
+	Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST");
+
+	// each buffer only remains valid until the next call returns
+	std::vector<std::uint8_t> buffers[2] = {std::vector<std::uint8_t>(4), std::vector<std::uint8_t>(4)};
+	std::uint64_t transition = 0;
+	for (std::uint64_t i = 0; i < 100; ++i) {
+		auto& buffer = buffers[i % 2];
+		std::fill(buffer.begin(), buffer.end(), static_cast<std::uint8_t>(i % 20));
+		writer.add_block_borrowed(transition, ExecutedBlock{i % 20, 1, ExecutionMode::x86_64_bits},
+		                          Span{buffer.size(), buffer.data()});
+		transition += 1;
+	}
+
+	// the data of the events only remains valid for the duration of the call, including for the last block
+	{
+		std::vector<std::uint8_t> data = {0xaa, 0xbb};
+		const auto event = Event::executed_block(transition, ExecutedBlock{0x1000, 1, ExecutionMode::x86_64_bits},
+		                                         Span{data.size(), data.data()});
+		writer.add_events(&event, 1);
+		std::fill(data.begin(), data.end(), 0);
+	}
+	std::fill(buffers[0].begin(), buffers[0].end(), 0xff);
+	std::fill(buffers[1].begin(), buffers[1].end(), 0xff);
+
+	// same when add_events throws after the last block
+	{
+		std::vector<std::uint8_t> data = {0xcc, 0xdd};
+		Event events[] = {
+			Event::executed_block(transition + 1, ExecutedBlock{0x2000, 1, ExecutionMode::x86_64_bits},
+			                      Span{data.size(), data.data()}),
+			Event::executed_instruction(0x2000),
+		};
+		// an event of an unknown type
+		events[1].type = static_cast<Event::Type>(42);
+		BOOST_CHECK_THROW(writer.add_events(events, 2), std::logic_error);
+		std::fill(data.begin(), data.end(), 0);
+	}
+	writer.finalize_execution(transition + 2);
+	// a new finalization does not insert the last block again
+	writer.finalize_execution(transition + 3);
+
+	Reader reader(std::move(writer).take());
+	for (std::uint64_t i = 0; i < 100; ++i) {
+		const auto& block = reader.block(reader.event_at(i).value().block_handle);
+		BOOST_CHECK_EQUAL(block.first_pc, i % 20);
+		BOOST_CHECK(block.instruction_data == std::vector<std::uint8_t>(4, i % 20));
+	}
+	const auto before_last = reader.event_at(transition).value().block_handle;
+	BOOST_CHECK(reader.block(before_last).instruction_data == std::vector<std::uint8_t>({0xaa, 0xbb}));
+	const auto last = reader.event_at(transition + 1).value().block_handle;
+	BOOST_CHECK_EQUAL(reader.block(last).first_pc, 0x2000);
+	BOOST_CHECK(reader.block(last).instruction_data == std::vector<std::uint8_t>({0xcc, 0xdd}));
+	BOOST_CHECK(reader.event_at(transition + 2).value().block_handle == last);
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_options)
+{
+	// an in-memory database cannot use a write-ahead log
+	const std::string filename = "test_writer_options.sqlite";
+	std::remove(filename.c_str());
+
+	auto options = reven::block::writer::WriterOptions::crash_safe();
+	// commit very often to exercise the thresholds
+	options.commit_rows = 3;
+	options.commit_bytes = 50;
+	// not sqlite's default
+	options.page_size = 8192;
+
+	Writer writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+	std::vector<std::uint8_t> data = {0, 1, 2, 3, 4, 5};
+	for (std::uint64_t i = 0; i < 100; ++i) {
+		ExecutedBlock block{i % 10, 2, ExecutionMode::x86_64_bits};
+		writer.add_block(2 * i, block, Span{data.size(), data.data()});
+		writer.add_block_instruction(i % 10 + 3);
+	}
+	writer.finalize_execution(200);
+
+	auto db = std::move(writer).take();
+	auto pragma = [](reven::sqlite::ResourceDatabase& db, const char* name) {
+		reven::sqlite::Statement stmt(db, (std::string("PRAGMA ") + name + ";").c_str());
+		BOOST_REQUIRE(stmt.step() == reven::sqlite::Statement::StepResult::Row);
+		return stmt.column_string(0);
+	};
+	BOOST_CHECK_EQUAL(pragma(db, "journal_mode"), "wal");
+	BOOST_CHECK_EQUAL(pragma(db, "page_size"), "8192");
+	// 1 is NORMAL
+	BOOST_CHECK_EQUAL(pragma(db, "synchronous"), "1");
+
+	Reader reader(std::move(db));
+	const auto event = reader.event_at(151).value();
+	BOOST_CHECK_EQUAL(event.begin_transition_id, 150);
+	BOOST_CHECK_EQUAL(reader.block(event.block_handle).first_pc, 5);
+	BOOST_CHECK_EQUAL(reader.block_with_instructions(event.block_handle, {}).instruction(1).value().pc, 8);
+
+	// the journal mode and the page size are stored in the file
+	auto reopened = reven::sqlite::ResourceDatabase::open(filename.c_str(), true);
+	BOOST_CHECK_EQUAL(pragma(reopened, "journal_mode"), "wal");
+	BOOST_CHECK_EQUAL(pragma(reopened, "page_size"), "8192");
+
+	for (const char* suffix : {"", "-journal", "-wal", "-shm"}) {
+		std::remove((filename + suffix).c_str());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_sharded_writer)
+{
+	std::vector<std::uint8_t> data_a = {0x90, 0x90};
+	std::vector<std::uint8_t> data_b = {0x90, 0x90, 0xcc};
+	ExecutedBlock block_a{0x1000, 2, ExecutionMode::x86_64_bits};
+	ExecutedBlock block_b{0x2000, 3, ExecutionMode::x86_64_bits};
+
+	writer::ShardedWriter sharded(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", 2);
+	BOOST_CHECK_EQUAL(sharded.shard_count(), 2);
+
+	// vCPU 0 executes [0, 2) and [5, 7), vCPU 1 executes [2, 5)
+	sharded.shard(0).add_block(0, block_a, Span{data_a.size(), data_a.data()});
+	sharded.shard(0).add_block_instruction(0x1001);
+	sharded.shard(0).suspend_execution(2);
+
+	sharded.shard(1).add_block(2, block_b, Span{data_b.size(), data_b.data()});
+	sharded.shard(1).add_block_instruction(0x2001);
+	sharded.shard(1).add_block_instruction(0x2002);
+	writer::Interrupt interrupt;
+	interrupt.pc = 0x2002;
+	interrupt.number = 3;
+	interrupt.has_related_instruction = true;
+	sharded.shard(1).add_interrupt(4, interrupt);
+	sharded.shard(1).suspend_execution(5);
+
+	sharded.shard(0).add_block(5, block_a, Span{data_a.size(), data_a.data()});
+	// a fault at the first instruction of a block, which is never executed
+	std::vector<std::uint8_t> data_c = {0xcc};
+	sharded.shard(0).add_block(7, ExecutedBlock{0x3000, 1, ExecutionMode::x86_64_bits},
+	                           Span{data_c.size(), data_c.data()});
+	writer::Interrupt fault;
+	fault.pc = 0x3000;
+	fault.number = 14;
+	fault.has_related_instruction = true;
+	sharded.shard(0).add_interrupt(7, fault);
+	sharded.shard(0).finalize_execution(8);
+
+	Reader reader(std::move(sharded).merge());
+
+	const auto first = reader.event_at(1).value();
+	BOOST_CHECK_EQUAL(first.begin_transition_id, 0);
+	BOOST_CHECK_EQUAL(first.end_transition_id, 2);
+
+	const auto second = reader.event_at(3).value();
+	BOOST_CHECK_EQUAL(second.begin_transition_id, 2);
+	BOOST_CHECK_EQUAL(reader.block(second.block_handle).first_pc, 0x2000);
+
+	BOOST_CHECK(not reader.event_at(4).value().has_instructions());
+	const auto merged_interrupt = reader.interrupt_at(4).value();
+	BOOST_CHECK_EQUAL(merged_interrupt.number, 3);
+	BOOST_CHECK_EQUAL(reader.related_instruction_data(merged_interrupt).value().data[0], 0xcc);
+
+	// the blocks of all shards share a single dictionary
+	const auto last = reader.event_at(6).value();
+	BOOST_CHECK_EQUAL(last.begin_transition_id, 5);
+	BOOST_CHECK(last.block_handle == first.block_handle);
+	BOOST_CHECK_EQUAL(reader.block_with_instructions(last.block_handle, {}).instruction(1).value().pc, 0x1001);
+	BOOST_CHECK_EQUAL(last.end_transition_id, 7);
+
+	const auto merged_fault = reader.interrupt_at(7).value();
+	BOOST_CHECK_EQUAL(merged_fault.number, 14);
+	BOOST_CHECK(reader.related_instruction_data(merged_fault).value().data[0] == 0xcc);
+	BOOST_CHECK(not reader.event_at(8));
+}
+
+BOOST_AUTO_TEST_CASE(test_sharded_writer_overlap)
+{
+	std::vector<std::uint8_t> data = {0x90};
+	ExecutedBlock block{0x1000, 1, ExecutionMode::x86_64_bits};
+
+	writer::ShardedWriter sharded(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", 2);
+	sharded.shard(0).add_block(0, block, Span{data.size(), data.data()});
+	sharded.shard(0).finalize_execution(1);
+	sharded.shard(1).add_block(0, block, Span{data.size(), data.data()});
+	sharded.shard(1).finalize_execution(1);
+
+	BOOST_CHECK_THROW(std::move(sharded).merge(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_sharded_writer_partial_overlap)
+{
+	std::vector<std::uint8_t> data = {0x90};
+	ExecutedBlock block{0x1000, 1, ExecutionMode::x86_64_bits};
+
+	// shard 0 records [0, 10), shard 1 records [5, 15), with interleaving ends
+	writer::ShardedWriter sharded(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", 2);
+	for (std::uint64_t transition = 0; transition < 10; transition += 2) {
+		sharded.shard(0).add_block(transition, block, Span{data.size(), data.data()});
+	}
+	sharded.shard(0).suspend_execution(10);
+	for (std::uint64_t transition = 5; transition < 15; transition += 2) {
+		sharded.shard(1).add_block(transition, block, Span{data.size(), data.data()});
+	}
+	sharded.shard(1).finalize_execution(15);
+
+	BOOST_CHECK_THROW(std::move(sharded).merge(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_sharded_writer_gap)
+{
+	std::vector<std::uint8_t> data = {0x90};
+	ExecutedBlock block{0x1000, 1, ExecutionMode::x86_64_bits};
+
+	// no shard records [3, 5)
+	writer::ShardedWriter sharded(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", 2);
+	sharded.shard(0).add_block(0, block, Span{data.size(), data.data()});
+	sharded.shard(0).suspend_execution(3);
+	sharded.shard(1).add_block(5, block, Span{data.size(), data.data()});
+	sharded.shard(1).finalize_execution(7);
+
+	BOOST_CHECK_THROW(std::move(sharded).merge(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_loop_compression)
+{
+	// Cycles of blocks of various periods, repeated a various number of times, sometimes broken in the middle of an
+	// iteration, and sometimes containing interrupts
+	auto record = [](bool loop_compression) {
+		writer::WriterOptions options;
+		options.loop_compression = loop_compression;
+		Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+		std::vector<std::uint8_t> data = {0x90, 0x90, 0x90, 0x90};
+		writer::Interrupt interrupt;
+		interrupt.number = 14;
+
+		std::uint32_t seed = 1;
+		auto random = [&seed](std::uint32_t max) {
+			seed = seed * 1103515245 + 12345;
+			return (seed >> 16) % max;
+		};
+
+		std::uint64_t transition = 0;
+		for (int segment = 0; segment < 200; ++segment) {
+			const auto period = 1 + random(8);
+			std::vector<std::uint64_t> pcs;
+			for (std::uint32_t i = 0; i < period; ++i) {
+				pcs.push_back(random(11));
+			}
+			const auto executions = random(32) * period + random(period);
+			for (std::uint32_t i = 0; i < executions; ++i) {
+				if (random(64) == 0) {
+					writer.add_interrupt(transition, interrupt);
+					transition += 1;
+				}
+				const auto pc = pcs[i % period];
+				ExecutedBlock block{pc, static_cast<std::uint16_t>(1 + pc % 4), ExecutionMode::x86_64_bits};
+				writer.add_block(transition, block, Span{data.size(), data.data()});
+				transition += block.block_instruction_count;
+			}
+		}
+		writer.finalize_execution(transition);
+		return std::move(writer).take();
+	};
+
+	auto execution_rows = [](reven::sqlite::ResourceDatabase& db) {
+		reven::sqlite::Statement stmt(db, "SELECT count(*) FROM execution;");
+		stmt.step();
+		return stmt.column_u64(0);
+	};
+
+	auto compressed_db = record(true);
+	auto plain_db = record(false);
+	BOOST_CHECK_LT(execution_rows(compressed_db), execution_rows(plain_db) / 2);
+
+	Reader compressed(std::move(compressed_db));
+	Reader plain(std::move(plain_db));
+
+	std::uint64_t event_count = 0;
+	auto compressed_events = compressed.query_events();
+	auto it = compressed_events.begin();
+	for (const auto& event : plain.query_events()) {
+		BOOST_REQUIRE(it != compressed_events.end());
+		BOOST_CHECK_EQUAL(it->begin_transition_id, event.begin_transition_id);
+		BOOST_CHECK_EQUAL(it->end_transition_id, event.end_transition_id);
+		BOOST_CHECK_EQUAL(compressed.block(it->block_handle).first_pc, plain.block(event.block_handle).first_pc);
+		BOOST_CHECK_EQUAL(it->has_instructions(), event.has_instructions());
+
+		for (auto transition = event.begin_transition_id; transition < event.end_transition_id; ++transition) {
+			const auto at = compressed.event_at(transition).value();
+			BOOST_CHECK_EQUAL(at.begin_transition_id, event.begin_transition_id);
+			BOOST_CHECK_EQUAL(at.end_transition_id, event.end_transition_id);
+			BOOST_CHECK(at.block_handle == it->block_handle);
+		}
+		++it;
+		++event_count;
+	}
+	BOOST_CHECK(it == compressed_events.end());
+	BOOST_CHECK_GT(event_count, 1000);
+
+	std::uint64_t non_instructions = 0;
+	for (auto transition : compressed.query_non_instructions()) {
+		BOOST_CHECK(not compressed.event_at(transition).value().has_instructions());
+		++non_instructions;
+	}
+	BOOST_CHECK_GT(non_instructions, 0);
+
+	// a long cycle is split into several runs
+	writer::WriterOptions options;
+	options.loop_compression = true;
+	Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+	std::vector<std::uint8_t> data = {0x90, 0x90};
+	for (std::uint64_t i = 0; i < 200000; ++i) {
+		ExecutedBlock block{0x1000 + 2 * (i % 2), 1, ExecutionMode::x86_64_bits};
+		writer.add_block(i, block, Span{data.size(), data.data()});
+	}
+	writer.finalize_execution(200000);
+	auto db = std::move(writer).take();
+	BOOST_CHECK_GE(execution_rows(db), 4);
+	BOOST_CHECK_LE(execution_rows(db), 10);
+
+	Reader reader(std::move(db));
+	for (std::uint64_t transition : {0, 65535, 65536, 131071, 131072, 199999}) {
+		const auto event = reader.event_at(transition).value();
+		BOOST_CHECK_EQUAL(event.begin_transition_id, transition);
+		BOOST_CHECK_EQUAL(reader.block(event.block_handle).first_pc, 0x1000 + 2 * (transition % 2));
+	}
+	BOOST_CHECK(not reader.event_at(200000));
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_close_on_destruction)
+{
+	BOOST_CHECK(not writer::WriterOptions().loop_compression);
+	BOOST_CHECK(not writer::WriterOptions::crash_safe().loop_compression);
+
+	const std::string filename = "test_writer_close_on_destruction.sqlite";
+	std::remove(filename.c_str());
+	{
+		// rows retained in memory until close
+		writer::WriterOptions options;
+		options.loop_compression = true;
+		options.chunked_execution = true;
+		Writer writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+		std::vector<std::uint8_t> data = {0x90, 0x90};
+		for (std::uint64_t i = 0; i < 100; ++i) {
+			ExecutedBlock block{0x1000 + 2 * (i % 2), 1, ExecutionMode::x86_64_bits};
+			writer.add_block(i, block, Span{data.size(), data.data()});
+		}
+		writer.finalize_execution(100);
+	}
+
+	{
+		Reader reader(filename.c_str());
+		std::uint64_t events = 0;
+		for (const auto& event : reader.query_events()) {
+			BOOST_CHECK_EQUAL(event.begin_transition_id, events);
+			++events;
+		}
+		BOOST_CHECK_EQUAL(events, 100);
+	}
+	for (const char* suffix : {"", "-journal", "-wal", "-shm"}) {
+		std::remove((filename + suffix).c_str());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_chunked_execution)
+{
+	// Enough events for several chunks, including interrupts and runs
+	auto record = [](bool chunked_execution) {
+		writer::WriterOptions options;
+		options.chunked_execution = chunked_execution;
+		Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+		std::vector<std::uint8_t> data = {0x90, 0x90, 0x90, 0x90};
+		writer::Interrupt interrupt;
+		interrupt.number = 14;
+
+		std::uint64_t transition = 0;
+		for (std::uint64_t i = 0; i < 5000; ++i) {
+			if (i % 97 == 0) {
+				writer.add_interrupt(transition, interrupt);
+				transition += 1;
+			}
+			// a tight loop every 1000 blocks
+			const auto pc = i % 1000 < 100 ? i % 3 : (i * 7919) % 251;
+			ExecutedBlock block{pc, static_cast<std::uint16_t>(1 + pc % 5), ExecutionMode::x86_64_bits};
+			writer.add_block(transition, block, Span{data.size(), data.data()});
+			transition += block.block_instruction_count;
+		}
+		writer.finalize_execution(transition);
+		return std::move(writer).take();
+	};
+
+	Reader plain(record(false));
+	Reader chunked(record(true));
+
+	auto chunked_events = chunked.query_events();
+	auto it = chunked_events.begin();
+	std::uint64_t end_transition_id = 0;
+	for (const auto& event : plain.query_events()) {
+		BOOST_REQUIRE(it != chunked_events.end());
+		BOOST_CHECK_EQUAL(it->begin_transition_id, event.begin_transition_id);
+		BOOST_CHECK_EQUAL(it->end_transition_id, event.end_transition_id);
+		BOOST_CHECK_EQUAL(chunked.block(it->block_handle).first_pc, plain.block(event.block_handle).first_pc);
+
+		for (auto transition = event.begin_transition_id; transition < event.end_transition_id; ++transition) {
+			const auto at = chunked.event_at(transition).value();
+			BOOST_CHECK_EQUAL(at.begin_transition_id, event.begin_transition_id);
+			BOOST_CHECK_EQUAL(at.end_transition_id, event.end_transition_id);
+			BOOST_CHECK(at.block_handle == it->block_handle);
+		}
+		end_transition_id = event.end_transition_id;
+		++it;
+	}
+	BOOST_CHECK(it == chunked_events.end());
+	BOOST_CHECK(not chunked.event_at(end_transition_id));
+
+	std::vector<std::uint64_t> plain_non_instructions;
+	for (auto transition : plain.query_non_instructions()) {
+		plain_non_instructions.push_back(transition);
+	}
+	std::vector<std::uint64_t> chunked_non_instructions;
+	for (auto transition : chunked.query_non_instructions()) {
+		chunked_non_instructions.push_back(transition);
+	}
+	BOOST_CHECK_EQUAL(chunked_non_instructions.size(), 52);
+	BOOST_CHECK(chunked_non_instructions == plain_non_instructions);
+}
+
+BOOST_AUTO_TEST_CASE(test_packed_instruction_offsets)
+{
+	auto record = []() {
+		writer::WriterOptions options;
+		// the offsets of block 0 grow while its row is still waiting in its batch, then after it was committed
+		options.commit_rows = 20;
+		Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+		std::vector<std::uint8_t> data(64, 0x90);
+		std::uint64_t transition = 0;
+		for (std::uint64_t i = 0; i < 100; ++i) {
+			const auto pc = (i % 2) * 0x1000;
+			const auto count = static_cast<std::uint16_t>(1 + (i / 2) % 16);
+			writer.add_block(transition, ExecutedBlock{pc, 16, ExecutionMode::x86_64_bits},
+			                 Span{data.size(), data.data()});
+			for (std::uint64_t instruction = 0; instruction < count; ++instruction) {
+				writer.add_block_instruction(pc + instruction * 3);
+			}
+			transition += count;
+		}
+		writer.finalize_execution(transition);
+		return std::move(writer).take();
+	};
+
+	auto db = record();
+	reven::sqlite::Statement stmt(db, "SELECT rowid, instruction_offsets FROM blocks;");
+	std::vector<std::pair<std::int64_t, std::vector<std::uint8_t>>> packed;
+	while (stmt.step() == reven::sqlite::Statement::StepResult::Row) {
+		const auto blob = stmt.column_blob(1);
+		const auto* bytes = reinterpret_cast<const std::uint8_t*>(std::get<0>(blob));
+		packed.emplace_back(stmt.column_i32(0), std::vector<std::uint8_t>(bytes, bytes + std::get<1>(blob)));
+	}
+
+	for (const auto& block : packed) {
+		// the packed offsets are varint deltas of 3, all single bytes
+		BOOST_CHECK_EQUAL(block.second.size(), block.first == 1 ? 0 : 15);
+		for (auto delta : block.second) {
+			BOOST_CHECK_EQUAL(delta, 3);
+		}
+	}
+
+	// Databases before version 1.3 store the offsets in the instruction_indices table
+	auto legacy_db = record();
+	legacy_db.exec("CREATE TABLE instruction_indices("
+	               "block_id INTEGER NOT NULL,"
+	               "instruction_id INTEGER NOT NULL,"
+	               "instruction_index INTEGER NOT NULL,"
+	               "PRIMARY KEY (block_id, instruction_id)"
+	               ") WITHOUT ROWID;", "Can't create table instruction_indices");
+	for (const auto& block : packed) {
+		for (std::size_t i = 0; i < block.second.size(); ++i) {
+			legacy_db.exec(("INSERT INTO instruction_indices VALUES (" + std::to_string(block.first) + ", " +
+			                std::to_string(i) + ", " + std::to_string(3 * (i + 1)) + ");").c_str(), "Can't insert");
+		}
+	}
+
+	for (auto* db_to_read : {&db, &legacy_db}) {
+		Reader reader(std::move(*db_to_read));
+		const auto event = reader.event_at(0).value();
+		const auto instructions = reader.block_with_instructions(event.block_handle, {});
+		BOOST_CHECK_EQUAL(instructions.instruction_count(), 16);
+		BOOST_CHECK_EQUAL(instructions.instruction(15).value().pc, 45);
+		BOOST_CHECK_EQUAL(instructions.instruction(15).value().data.size, 15);
+		BOOST_CHECK_EQUAL(reader.block_with_instructions(reader.event_at(1).value().block_handle, {})
+		                  .instruction(15).value().pc, 0x1000 + 45);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_stats)
+{
+	writer::WriterOptions options;
+	options.commit_rows = 10;
+	options.loop_compression = false;
+	options.stats_interval = std::chrono::milliseconds(1);
+	std::uint64_t reports = 0;
+	options.stats_callback = [&reports](const writer::WriterStats&) { ++reports; };
+
+	Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+	// let the first report interval expire
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	std::vector<std::uint8_t> data = {0, 1, 2, 3, 4, 5};
+	std::uint64_t transition = 0;
+	for (std::uint64_t i = 0; i < 1000; ++i) {
+		ExecutedBlock block{i % 10, 2, ExecutionMode::x86_64_bits};
+		writer.add_block(transition, block, Span{data.size(), data.data()});
+		writer.add_block_instruction(i % 10 + 3);
+		transition += 2;
+		if (i % 100 == 99) {
+			writer.add_interrupt(transition, writer::Interrupt{});
+			++transition;
+		}
+	}
+	writer.finalize_execution(transition);
+	writer.flush();
+
+	const auto stats = writer.stats();
+#ifndef RVNBLOCK_WRITER_STATS
+	// the instrumentation is compiled out, see the RVNBLOCK_WRITER_STATS build of the CI for the recorded stats
+	BOOST_CHECK(not stats.enabled);
+	BOOST_CHECK_EQUAL(stats.blocks_added, 0);
+	BOOST_CHECK_EQUAL(stats.add_block_latency.count, 0);
+	BOOST_CHECK_EQUAL(reports, 0);
+#else
+	BOOST_REQUIRE(stats.enabled);
+
+	BOOST_CHECK_EQUAL(stats.blocks_added, 1000);
+	BOOST_CHECK_EQUAL(stats.instructions_added, 1000);
+	BOOST_CHECK_EQUAL(stats.interrupts, 10);
+	// 10 distinct blocks plus the interrupt block, which is known from the start
+	BOOST_CHECK_EQUAL(stats.dedup_misses, 10);
+	BOOST_CHECK_EQUAL(stats.dedup_hits, 1000);
+	BOOST_CHECK_EQUAL(stats.executions, 1010);
+	BOOST_CHECK_EQUAL(stats.execution_rows, 1010);
+	BOOST_CHECK_EQUAL(stats.collapsed_executions(), 0);
+	BOOST_CHECK(stats.commits > 50);
+	BOOST_CHECK_EQUAL(stats.commit_latency.count, stats.commits);
+	BOOST_CHECK_EQUAL(stats.add_block_latency.count, 1010);
+	BOOST_CHECK(stats.add_block_latency.percentile(0.5) <= stats.add_block_latency.percentile(0.99));
+	BOOST_CHECK(stats.add_block_latency.percentile(1) <= stats.add_block_latency.max_ns);
+	BOOST_CHECK(reports > 0);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_live_tail)
+{
+	// chunked execution, transition index
+	const std::pair<bool, bool> variants[] = {{false, false}, {true, false}, {false, true}, {true, true}};
+	for (const auto& variant : variants) {
+		const bool chunked = variant.first;
+		reader::ReaderOptions reader_options;
+		reader_options.transition_index = variant.second;
+		const std::string filename = "test_reader_live_tail.sqlite";
+		std::remove(filename.c_str());
+
+		{
+			auto options = writer::WriterOptions::live_tail();
+			options.chunked_execution = chunked;
+			std::unique_ptr<Writer> writer(new Writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST", options));
+
+			std::vector<std::uint8_t> data = {0, 1};
+			std::uint64_t transition = 0;
+			auto record = [&](std::uint64_t count) {
+				for (std::uint64_t i = 0; i < count; ++i) {
+					writer->add_block(transition, ExecutedBlock{i % 10, 2, ExecutionMode::x86_64_bits},
+					                  Span{data.size(), data.data()});
+					transition += 2;
+				}
+			};
+
+			Reader reader(filename.c_str(), reader_options);
+			BOOST_CHECK_EQUAL(reader.refresh(), 0);
+
+			auto events = reader.query_events();
+			std::uint64_t event_count = 0;
+			std::uint64_t end = 0;
+			auto follow = [&]() {
+				for (const auto& event : events) {
+					BOOST_CHECK_EQUAL(event.begin_transition_id, end);
+					end = event.end_transition_id;
+					++event_count;
+				}
+			};
+			follow();
+			BOOST_CHECK_EQUAL(event_count, 0);
+
+			record(3000);
+			writer->flush();
+			// the last block is pending, and so is the last chunk if chunked
+			const auto committed = reader.refresh();
+			BOOST_CHECK_EQUAL(committed, chunked ? 2 * 2048 : 2 * 2999);
+			BOOST_CHECK(reader.event_at(committed - 1));
+			BOOST_CHECK(not reader.event_at(committed));
+			follow();
+			BOOST_CHECK_EQUAL(end, committed);
+			BOOST_CHECK_EQUAL(event_count, committed / 2);
+
+			record(500);
+			writer->finalize_execution(transition);
+			writer->close();
+			writer.reset();
+
+			BOOST_CHECK_EQUAL(reader.refresh(), 2 * 3500);
+			BOOST_CHECK_EQUAL(reader.event_at(2 * 3500 - 1).value().begin_transition_id, 2 * 3499);
+			follow();
+			BOOST_CHECK_EQUAL(event_count, 3500);
+			BOOST_CHECK_EQUAL(end, 2 * 3500);
+		}
+
+		for (const char* suffix : {"", "-wal", "-shm"}) {
+			std::remove((filename + suffix).c_str());
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_transition_index)
+{
+	for (bool chunked : {false, true}) {
+		auto record = [chunked]() {
+			writer::WriterOptions options;
+			options.chunked_execution = chunked;
+			Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+			std::vector<std::uint8_t> data = {0, 1, 2, 3};
+			std::uint64_t transition = 0;
+			for (std::uint64_t i = 0; i < 5000; ++i) {
+				// loops stored as runs, between blocks of various lengths
+				const auto pc = (i / 100) % 2 == 0 ? i % 3 : i % 17;
+				writer.add_block(transition, ExecutedBlock{pc, 4, ExecutionMode::x86_64_bits},
+				                 Span{data.size(), data.data()});
+				transition += 1 + pc % 4;
+				if (i % 97 == 0) {
+					writer.add_interrupt(transition, writer::Interrupt{});
+					++transition;
+				}
+			}
+			writer.finalize_execution(transition);
+			return std::move(writer).take();
+		};
+
+		reader::ReaderOptions options;
+		options.transition_index = true;
+		Reader indexed(record(), options);
+		Reader reader(record());
+
+		const auto end = indexed.refresh();
+		BOOST_CHECK_EQUAL(end, reader.refresh());
+		for (std::uint64_t transition = 0; transition < end + 2; ++transition) {
+			const auto expected = reader.event_at(transition);
+			const auto event = indexed.event_at(transition);
+			BOOST_REQUIRE_EQUAL(static_cast<bool>(event), static_cast<bool>(expected));
+			if (expected) {
+				BOOST_CHECK_EQUAL(event->begin_transition_id, expected->begin_transition_id);
+				BOOST_CHECK_EQUAL(event->end_transition_id, expected->end_transition_id);
+				BOOST_CHECK(event->block_handle == expected->block_handle);
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_block_cache)
+{
+	auto db = []() {
+		Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST");
+		std::uint64_t transition = 0;
+		for (std::uint64_t i = 0; i < 200; ++i) {
+			std::vector<std::uint8_t> data(64, static_cast<std::uint8_t>(i));
+			writer.add_block(transition, ExecutedBlock{i * 0x100, 2, ExecutionMode::x86_64_bits},
+			                 Span{data.size(), data.data()});
+			writer.add_block_instruction(i * 0x100 + 32);
+			transition += 2;
+		}
+		writer.finalize_execution(transition);
+		return std::move(writer).take();
+	}();
+
+	reader::ReaderOptions options;
+	// room for about 10 blocks
+	options.cache_bytes = 10 * 256;
+	Reader reader(std::move(db), options);
+
+	auto handle_of = [&reader](std::uint64_t i) { return reader.event_at(2 * i).value().block_handle; };
+	const auto pinned = reader.pinned_block(handle_of(0));
+	const auto instructions = reader.block_with_instructions(handle_of(1), {});
+
+	for (int pass = 0; pass < 2; ++pass) {
+		for (std::uint64_t i = 0; i < 200; ++i) {
+			BOOST_CHECK_EQUAL(reader.block(handle_of(i)).first_pc, i * 0x100);
+			// the block that was just requested is cached
+			BOOST_CHECK_EQUAL(reader.block(handle_of(i)).instruction_data[0], i);
+		}
+		BOOST_CHECK(reader.cache_size() < 20);
+	}
+
+	const auto stats = reader.cache_stats();
+	BOOST_CHECK(stats.evictions > 300);
+	BOOST_CHECK(stats.hits >= 400);
+	BOOST_CHECK_EQUAL(stats.hits + stats.misses, 4 * 200 + 2 + 1);
+	BOOST_CHECK_EQUAL(stats.misses - stats.evictions, stats.blocks);
+	BOOST_CHECK(stats.bytes <= options.cache_bytes);
+
+	reader.clear_cache();
+	BOOST_CHECK_EQUAL(reader.cache_size(), 0);
+	BOOST_CHECK_EQUAL(reader.cache_stats().bytes, 0);
+
+	// the evicted blocks remain valid while they are in use
+	BOOST_CHECK(pinned->instruction_data == std::vector<std::uint8_t>(64, 0));
+	BOOST_CHECK_EQUAL(instructions.instruction(1).value().pc, 0x100 + 32);
+	BOOST_CHECK_EQUAL(instructions.instruction(1).value().data.data[0], 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_cached_instruction_offsets)
+{
+	auto db = []() {
+		Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST");
+		std::uint64_t transition = 0;
+		for (std::uint64_t i = 0; i < 1000; ++i) {
+			const auto pc = (i % 100) * 0x100;
+			std::vector<std::uint8_t> data(12, static_cast<std::uint8_t>(i % 100));
+			writer.add_block(transition, ExecutedBlock{pc, 3, ExecutionMode::x86_64_bits},
+			                 Span{data.size(), data.data()});
+			writer.add_block_instruction(pc + 4);
+			writer.add_block_instruction(pc + 9);
+			transition += 3;
+		}
+		writer.finalize_execution(transition);
+		return std::move(writer).take();
+	};
+
+	for (std::size_t cache_bytes : {std::size_t(0), std::size_t(20 * 512)}) {
+		reader::ReaderOptions options;
+		options.cache_bytes = cache_bytes;
+		Reader reader(db(), options);
+
+		std::vector<std::uint32_t> spare;
+		spare.reserve(64);
+		const auto* spare_data = spare.data();
+		for (const auto& event : reader.query_events()) {
+			auto instructions = reader.block_with_instructions(event.block_handle, std::move(spare));
+			BOOST_REQUIRE_EQUAL(instructions.instruction_count(), 3);
+			BOOST_CHECK_EQUAL(instructions.instruction(1).value().pc, instructions.block().first_pc + 4);
+			BOOST_CHECK_EQUAL(instructions.instruction(1).value().data.size, 5);
+			BOOST_CHECK_EQUAL(instructions.instruction(2).value().data.size, 3);
+			// the spare vector is handed back untouched
+			spare = std::move(instructions).take_instruction_indexes();
+			BOOST_CHECK(spare.data() == spare_data);
+		}
+
+		const auto stats = reader.cache_stats();
+		BOOST_CHECK_EQUAL(stats.offsets_hits + stats.offsets_misses, 1000);
+		if (cache_bytes == 0) {
+			// decoded once per block
+			BOOST_CHECK_EQUAL(stats.offsets_misses, 100);
+		} else {
+			BOOST_CHECK(stats.offsets_misses > 100);
+			BOOST_CHECK(stats.bytes <= cache_bytes);
+		}
+	}
+
+	// a Writer that is still recording adds offsets to a committed block when it executes further
+	const std::string filename = "test_reader_cached_instruction_offsets.sqlite";
+	std::remove(filename.c_str());
+	{
+		Writer writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST", writer::WriterOptions::live_tail());
+		std::vector<std::uint8_t> data(12, 0x90);
+		const ExecutedBlock block{0x1000, 3, ExecutionMode::x86_64_bits};
+		const ExecutedBlock other{0x2000, 1, ExecutionMode::x86_64_bits};
+
+		// interrupted after its first instruction
+		writer.add_block(0, block, Span{data.size(), data.data()});
+		writer.add_block(1, other, Span{data.size(), data.data()});
+		writer.flush();
+
+		Reader reader(filename.c_str());
+		const auto handle = reader.event_at(0).value().block_handle;
+		BOOST_CHECK_EQUAL(reader.block_with_instructions(handle, {}).instruction_count(), 1);
+
+		writer.add_block(2, block, Span{data.size(), data.data()});
+		writer.add_block_instruction(0x1004);
+		writer.add_block_instruction(0x1009);
+		writer.add_block(5, other, Span{data.size(), data.data()});
+		writer.flush();
+
+		BOOST_CHECK_EQUAL(reader.refresh(), 5);
+		BOOST_CHECK_EQUAL(reader.block_with_instructions(handle, {}).instruction_count(), 3);
+		BOOST_CHECK_EQUAL(Reader(filename.c_str()).block_with_instructions(handle, {}).instruction_count(), 3);
+
+		writer.finalize_execution(6);
+		writer.close();
+	}
+	for (const char* suffix : {"", "-journal", "-wal", "-shm"}) {
+		std::remove((filename + suffix).c_str());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_events_at)
+{
+	for (bool chunked : {false, true}) {
+		std::uint64_t end = 0;
+		auto record = [chunked, &end]() {
+			writer::WriterOptions options;
+			options.chunked_execution = chunked;
+			Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+			std::vector<std::uint8_t> data = {0, 1, 2, 3};
+			std::uint64_t transition = 0;
+			for (std::uint64_t i = 0; i < 5000; ++i) {
+				// loops stored as runs, between blocks of various lengths
+				const auto pc = (i / 100) % 2 == 0 ? i % 3 : i % 17;
+				writer.add_block(transition, ExecutedBlock{pc, 4, ExecutionMode::x86_64_bits},
+				                 Span{data.size(), data.data()});
+				transition += 1 + pc % 4;
+				if (i % 97 == 0) {
+					writer.add_interrupt(transition, writer::Interrupt{});
+					++transition;
+				}
+			}
+			writer.finalize_execution(transition);
+			end = transition;
+			return std::move(writer).take();
+		};
+
+		for (bool transition_index : {false, true}) {
+			reader::ReaderOptions options;
+			options.transition_index = transition_index;
+			Reader reader(record(), options);
+
+			// every 7th transition from 1000, with repetitions, then transitions past the end of the trace
+			std::vector<std::uint64_t> transitions;
+			for (std::uint64_t t = 1000; t < end + 10; t += 7) {
+				transitions.push_back(t);
+				if (t % 3 == 0) {
+					transitions.push_back(t);
+				}
+			}
+
+			std::vector<reader::BlockExecutionEvent> events;
+			reader.events_at(transitions.data(), transitions.size(), events);
+			BOOST_REQUIRE(events.size() < transitions.size());
+			for (std::size_t i = 0; i < transitions.size(); ++i) {
+				const auto expected = reader.event_at(transitions[i]);
+				BOOST_REQUIRE_EQUAL(static_cast<bool>(expected), i < events.size());
+				if (expected) {
+					BOOST_CHECK_EQUAL(events[i].begin_transition_id, expected->begin_transition_id);
+					BOOST_CHECK_EQUAL(events[i].end_transition_id, expected->end_transition_id);
+					BOOST_CHECK(events[i].block_handle == expected->block_handle);
+				}
+			}
+
+			const std::uint64_t first[] = {0, 0, 1};
+			reader.events_at(first, 3, events);
+			BOOST_REQUIRE_EQUAL(events.size(), 3);
+			BOOST_CHECK_EQUAL(events[0].begin_transition_id, 0);
+			BOOST_CHECK_EQUAL(events[2].end_transition_id, reader.event_at(1)->end_transition_id);
+
+			reader.events_at(transitions.data(), 0, events);
+			BOOST_CHECK(events.empty());
+
+			const std::uint64_t unsorted[] = {5, 4};
+			BOOST_CHECK_THROW(reader.events_at(unsorted, 2, events), std::logic_error);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_query_ranges)
+{
+	using Event = std::array<std::uint64_t, 3>;
+	auto as_array = [](const reader::BlockExecutionEvent& event) {
+		return Event{{event.begin_transition_id, event.end_transition_id,
+		              static_cast<std::uint64_t>(event.block_handle.handle())}};
+	};
+
+	for (bool chunked : {false, true}) {
+		auto record = [chunked]() {
+			writer::WriterOptions options;
+			options.chunked_execution = chunked;
+			Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+			std::vector<std::uint8_t> data = {0, 1, 2, 3};
+			std::uint64_t transition = 0;
+			for (std::uint64_t i = 0; i < 5000; ++i) {
+				// loops stored as runs, between blocks of various lengths
+				const auto pc = (i / 100) % 2 == 0 ? i % 3 : i % 17;
+				writer.add_block(transition, ExecutedBlock{pc, 4, ExecutionMode::x86_64_bits},
+				                 Span{data.size(), data.data()});
+				transition += 1 + pc % 4;
+				if (i % 97 == 0) {
+					writer.add_interrupt(transition, writer::Interrupt{});
+					++transition;
+				}
+			}
+			writer.finalize_execution(transition);
+			return std::move(writer).take();
+		};
+
+		for (bool transition_index : {false, true}) {
+			reader::ReaderOptions options;
+			options.transition_index = transition_index;
+			Reader reader(record(), options);
+
+			std::vector<Event> all;
+			for (const auto& event : reader.query_events()) {
+				all.push_back(as_array(event));
+			}
+			const auto end = all.back()[1];
+
+			const std::pair<std::uint64_t, std::uint64_t> ranges[] = {
+				{0, 1}, {0, end}, {5, 6}, {1234, 1300}, {3000, 3001}, {end - 3, end + 10}, {end, end + 10}, {7, 7},
+			};
+			for (const auto& range : ranges) {
+				std::vector<Event> expected;
+				for (const auto& event : all) {
+					if (event[1] > range.first and event[0] < range.second) {
+						expected.push_back(event);
+					}
+				}
+				std::vector<Event> events;
+				for (const auto& event : reader.query_events(range.first, range.second)) {
+					events.push_back(as_array(event));
+				}
+				BOOST_CHECK(events == expected);
+			}
+
+			for (std::uint64_t from : {std::uint64_t(0), std::uint64_t(1), std::uint64_t(2500), end - 1, end, end + 100}) {
+				std::vector<Event> expected;
+				for (auto it = all.rbegin(); it != all.rend(); ++it) {
+					if ((*it)[0] <= from) {
+						expected.push_back(*it);
+					}
+				}
+				std::vector<Event> events;
+				for (const auto& event : reader.query_events_reverse(from)) {
+					events.push_back(as_array(event));
+				}
+				BOOST_CHECK(events == expected);
+			}
+
+			// stepping back from every transition
+			for (std::uint64_t from = 0; from < end; from += 13) {
+				auto events = reader.query_events_reverse(from);
+				auto it = events.begin();
+				BOOST_REQUIRE(it != events.end());
+				const auto event = reader.event_at(from).value();
+				BOOST_CHECK_EQUAL(it->begin_transition_id, event.begin_transition_id);
+				BOOST_CHECK_EQUAL(it->end_transition_id, event.end_transition_id);
+				if (event.begin_transition_id != 0) {
+					++it;
+					BOOST_REQUIRE(it != events.end());
+					BOOST_CHECK_EQUAL(it->end_transition_id, event.begin_transition_id);
+				}
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_query_instructions)
+{
+	for (bool chunked : {false, true}) {
+		std::uint64_t end = 0;
+		auto db = [chunked, &end]() {
+			writer::WriterOptions options;
+			options.chunked_execution = chunked;
+			Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST", options);
+
+			std::uint64_t transition = 0;
+			for (std::uint64_t i = 0; i < 2000; ++i) {
+				// 3 instructions of 4, 5 and 3 bytes
+				const auto pc = (i % 50) * 0x100;
+				std::vector<std::uint8_t> data(12, static_cast<std::uint8_t>(i % 50));
+				writer.add_block(transition, ExecutedBlock{pc, 3, ExecutionMode::x86_32_bits},
+				                 Span{data.size(), data.data()});
+				writer.add_block_instruction(pc + 4);
+				if (i % 7 == 0) {
+					// interrupted after the first instruction
+					writer.add_interrupt(transition + 1, writer::Interrupt{});
+					transition += 2;
+					continue;
+				}
+				writer.add_block_instruction(pc + 9);
+				transition += 3;
+			}
+			writer.finalize_execution(transition);
+			end = transition;
+			return std::move(writer).take();
+		}();
+		Reader reader(std::move(db));
+
+		const std::pair<std::uint64_t, std::uint64_t> ranges[] = {{0, end}, {500, 3000}, {1, 2}, {end - 1, end + 5}};
+		for (const auto& range : ranges) {
+			std::uint64_t expected_transition = range.first;
+			for (const auto& transition : reader.query_instructions(range.first, range.second)) {
+				BOOST_REQUIRE_EQUAL(transition.transition_id, expected_transition);
+				const auto event = reader.event_at(transition.transition_id).value();
+				BOOST_REQUIRE_EQUAL(transition.is_instruction, event.has_instructions());
+				if (transition.is_instruction) {
+					const auto instructions = reader.block_with_instructions(event.block_handle, {});
+					const auto instruction =
+					    instructions.instruction(transition.transition_id - event.begin_transition_id).value();
+					BOOST_CHECK_EQUAL(transition.instruction.pc, instruction.pc);
+					BOOST_CHECK_EQUAL(transition.instruction.data.size, instruction.data.size);
+					BOOST_CHECK_EQUAL(transition.instruction.data.data[0], instruction.data.data[0]);
+					BOOST_CHECK(transition.mode == ExecutionMode::x86_32_bits);
+				}
+				++expected_transition;
+			}
+			BOOST_CHECK_EQUAL(expected_transition, std::min(range.second, end));
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_reader)
+{
+	const std::string filename = "test_concurrent_reader.sqlite";
+	std::remove(filename.c_str());
+	{
+		Writer writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST");
+		std::uint64_t transition = 0;
+		for (std::uint64_t i = 0; i < 3000; ++i) {
+			std::vector<std::uint8_t> data(16, static_cast<std::uint8_t>(i % 300));
+			writer.add_block(transition, ExecutedBlock{(i % 300) * 0x100, 3, ExecutionMode::x86_64_bits},
+			                 Span{data.size(), data.data()});
+			transition += 1 + i % 3;
+			if (i % 50 == 0) {
+				writer::Interrupt interrupt;
+				interrupt.number = i;
+				writer.add_interrupt(transition, interrupt);
+				++transition;
+			}
+		}
+		writer.finalize_execution(transition);
+		writer.close();
+	}
+
+	// The expected results of each transition, from a single-threaded Reader: begin and end of the event, pc of its
+	// block and number of the interrupt, or -1 if there is none.
+	std::vector<std::array<std::int64_t, 4>> expected;
+	// the executions of the first instruction of the block at 0x1700
+	std::vector<std::uint64_t> expected_executions;
+	{
+		Reader reader(filename.c_str());
+		for (auto transition : reader.executions_of(0x1700)) {
+			expected_executions.push_back(transition);
+		}
+		BOOST_REQUIRE_EQUAL(expected_executions.size(), 10);
+		const auto end = reader.refresh();
+		for (std::uint64_t transition = 0; transition < end + 2; ++transition) {
+			std::array<std::int64_t, 4> result{{-1, -1, -1, -1}};
+			if (const auto event = reader.event_at(transition)) {
+				result[0] = event->begin_transition_id;
+				result[1] = event->end_transition_id;
+				result[2] = reader.block(event->block_handle).first_pc;
+			}
+			if (const auto interrupt = reader.interrupt_at(transition)) {
+				result[3] = interrupt->number;
+			}
+			expected.push_back(result);
+		}
+	}
+
+	for (bool indices : {false, true}) {
+		reader::ReaderOptions options;
+		options.transition_index = indices;
+		// the Readers of the pool share the execution index instead of loading one each
+		options.execution_index = indices;
+		// room for about 50 blocks, so that the threads evict each other's blocks
+		options.cache_bytes = 50 * 256;
+		reader::ConcurrentReader reader(filename.c_str(), options, 8);
+
+		const std::size_t thread_count = 8;
+		std::vector<std::uint64_t> errors(thread_count, 0);
+		std::vector<std::thread> threads;
+		for (std::size_t t = 0; t < thread_count; ++t) {
+			threads.emplace_back([&, t]() {
+				for (std::uint64_t transition = t; transition < expected.size(); transition += 3) {
+					std::array<std::int64_t, 4> result{{-1, -1, -1, -1}};
+					if (const auto event = reader.event_at(transition)) {
+						result[0] = event->begin_transition_id;
+						result[1] = event->end_transition_id;
+						result[2] = reader.block(event->block_handle)->first_pc;
+					}
+					if (const auto interrupt = reader.interrupt_at(transition)) {
+						result[3] = interrupt->number;
+					}
+					errors[t] += result == expected[transition] ? 0 : 1;
+				}
+
+				// a leased Reader runs the other queries
+				auto lease = reader.lease();
+				std::uint64_t event_count = 0;
+				for (const auto& event : lease->query_events()) {
+					event_count += event.execution_count() > 0 ? 1 : 0;
+				}
+				errors[t] += event_count == 3000 + 60 ? 0 : 1;
+
+				std::vector<std::uint64_t> executions;
+				for (auto transition : lease->executions_of(0x1700)) {
+					executions.push_back(transition);
+				}
+				errors[t] += executions == expected_executions ? 0 : 1;
+			});
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		for (std::size_t t = 0; t < thread_count; ++t) {
+			BOOST_CHECK_EQUAL(errors[t], 0);
+		}
+
+		BOOST_CHECK(reader.connection_count() >= 1);
+		BOOST_CHECK(reader.connection_count() <= thread_count + 1);
+		const auto stats = reader.cache_stats();
+		BOOST_CHECK(stats.evictions > 0);
+		BOOST_CHECK(stats.bytes <= options.cache_bytes);
+	}
+
+	for (const char* suffix : {"", "-journal", "-wal", "-shm"}) {
+		std::remove((filename + suffix).c_str());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_query_events_prefetched)
+{
+	const std::string filename = "test_reader_query_events_prefetched.sqlite";
+
+	for (bool chunked : {false, true}) {
+		std::remove(filename.c_str());
+		{
+			writer::WriterOptions options;
+			options.chunked_execution = chunked;
+			Writer writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST", options);
+			std::uint64_t transition = 0;
+			for (std::uint64_t i = 0; i < 3000; ++i) {
+				const auto pc = (i % 400) * 0x100;
+				std::vector<std::uint8_t> data(8, static_cast<std::uint8_t>(i % 400));
+				writer.add_block(transition, ExecutedBlock{pc, 2, ExecutionMode::x86_64_bits},
+				                 Span{data.size(), data.data()});
+				writer.add_block_instruction(pc + 4);
+				transition += 2;
+				if (i % 50 == 0) {
+					writer.add_interrupt(transition, writer::Interrupt{});
+					++transition;
+				}
+			}
+			writer.finalize_execution(transition);
+			writer.close();
+		}
+
+		using Event = std::array<std::uint64_t, 3>;
+		auto as_array = [](const reader::BlockExecutionEvent& event) {
+			return Event{{event.begin_transition_id, event.end_transition_id,
+			              static_cast<std::uint64_t>(event.block_handle.handle())}};
+		};
+
+		std::vector<Event> expected;
+		{
+			Reader reader(filename.c_str());
+			for (const auto& event : reader.query_events()) {
+				expected.push_back(as_array(event));
+			}
+		}
+
+		for (std::size_t window : {std::size_t(1), std::size_t(16), Reader::DEFAULT_PREFETCH_WINDOW}) {
+			Reader reader(filename.c_str());
+			std::vector<Event> events;
+			std::uint64_t first_pc_errors = 0;
+			for (const auto& event : reader.query_events_prefetched(window)) {
+				events.push_back(as_array(event));
+				if (event.has_instructions()) {
+					const auto instructions = reader.block_with_instructions(event.block_handle, {});
+					const auto instruction = instructions.instruction(1).value();
+					first_pc_errors += instruction.pc == instructions.block().first_pc + 4 ? 0 : 1;
+				}
+			}
+			BOOST_CHECK(events == expected);
+			BOOST_CHECK_EQUAL(first_pc_errors, 0);
+
+			// the blocks and their offsets were loaded by the background thread before being requested
+			const auto stats = reader.cache_stats();
+			BOOST_CHECK(stats.blocks >= 400);
+			BOOST_CHECK(stats.offsets_hits > 0);
+		}
+
+		// stopping the iteration early stops the background thread
+		{
+			Reader reader(filename.c_str());
+			auto query = reader.query_events_prefetched(16);
+			auto it = query.begin();
+			BOOST_REQUIRE(it != query.end());
+			BOOST_CHECK(as_array(*it) == expected.front());
+		}
+	}
+
+	// the background thread needs a file to connect to
+	{
+		Writer writer(":memory:", "tester", "1.0.0", "BOOST AUTOTEST");
+		writer.finalize_execution(0);
+		Reader reader(std::move(writer).take());
+		BOOST_CHECK_THROW(reader.query_events_prefetched(), std::logic_error);
+	}
+
+	for (const char* suffix : {"", "-journal", "-wal", "-shm"}) {
+		std::remove((filename + suffix).c_str());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_execution_index)
+{
+	const std::string filename = "test_reader_execution_index.sqlite";
+	const std::string flat_filename = "test_reader_execution_index.flat";
+
+	// the transitions at which each pc is executed, from all the instructions of the trace
+	using Executions = std::map<std::uint64_t, std::vector<std::uint64_t>>;
+	auto all_executions = [](const Reader& reader) {
+		Executions executions;
+		for (const auto& transition : reader.query_instructions(0, std::numeric_limits<std::uint64_t>::max())) {
+			if (transition.is_instruction) {
+				executions[transition.instruction.pc].push_back(transition.transition_id);
+			}
+		}
+		return executions;
+	};
+
+	// pcs at the beginning of blocks, in the middle of blocks, between instructions and outside of the blocks
+	const std::uint64_t pcs[] = {0x1000, 0x1004, 0x1009, 0x1001, 0x100c, 0x2000, 0x2004, 0x3000, 0, 2, 4};
+
+	auto check = [&pcs](const Reader& reader, const Executions& executions, std::uint64_t end) {
+		for (const auto pc : pcs) {
+			const auto found = executions.find(pc);
+			const auto expected = found == executions.end() ? std::vector<std::uint64_t>() : found->second;
+
+			std::vector<std::uint64_t> transitions;
+			for (const auto transition : reader.executions_of(pc)) {
+				transitions.push_back(transition);
+			}
+			BOOST_CHECK(transitions == expected);
+
+			transitions.clear();
+			for (const auto transition : reader.executions_of(pc, 1000, 2000)) {
+				transitions.push_back(transition);
+			}
+			BOOST_CHECK(transitions == std::vector<std::uint64_t>(
+			                               std::lower_bound(expected.begin(), expected.end(), 1000),
+			                               std::lower_bound(expected.begin(), expected.end(), 2000)));
+
+			std::uint64_t errors = 0;
+			for (std::uint64_t transition = 0; transition < end + 2; transition += 7) {
+				const auto next = std::lower_bound(expected.begin(), expected.end(), transition);
+				const auto execution = reader.next_execution(pc, transition);
+				errors += next == expected.end() ? bool(execution) : execution != *next;
+
+				const auto previous = reader.prev_execution(pc, transition);
+				errors += next == expected.begin() ? bool(previous) : previous != *(next - 1);
+			}
+			BOOST_CHECK_EQUAL(errors, 0);
+		}
+	};
+
+	for (bool chunked : {false, true}) {
+		std::remove(filename.c_str());
+		std::uint64_t end = 0;
+		{
+			writer::WriterOptions options;
+			options.chunked_execution = chunked;
+			Writer writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST", options);
+			std::vector<std::uint8_t> data(12, 0x90);
+			std::uint64_t transition = 0;
+			for (std::uint64_t i = 0; i < 3000; ++i) {
+				if (i % 5 == 4) {
+					// entering the middle of the first block, 2 instructions of 5 and 3 bytes
+					writer.add_block(transition, ExecutedBlock{0x1004, 2, ExecutionMode::x86_64_bits},
+					                 Span{8, data.data()});
+					writer.add_block_instruction(0x1009);
+					transition += 2;
+				} else if (i % 7 == 6) {
+					// a block at address 0, 2 instructions of 2 bytes
+					writer.add_block(transition, ExecutedBlock{0, 2, ExecutionMode::x86_64_bits},
+					                 Span{4, data.data()});
+					writer.add_block_instruction(2);
+					transition += 2;
+				} else if (i % 3 == 0) {
+					// a loop on a single instruction, executed many times
+					writer.add_block(transition, ExecutedBlock{0x2000, 1, ExecutionMode::x86_64_bits},
+					                 Span{4, data.data()});
+					transition += 1;
+				} else {
+					// 3 instructions of 4, 5 and 3 bytes
+					writer.add_block(transition, ExecutedBlock{0x1000, 3, ExecutionMode::x86_64_bits},
+					                 Span{data.size(), data.data()});
+					writer.add_block_instruction(0x1004);
+					if (i % 11 == 0) {
+						// interrupted after the first instruction
+						writer.add_interrupt(transition + 1, writer::Interrupt{});
+						transition += 2;
+						continue;
+					}
+					writer.add_block_instruction(0x1009);
+					transition += 3;
+				}
+			}
+			writer.finalize_execution(transition);
+			writer.close();
+			end = transition;
+		}
+
+		Reader reader(filename.c_str());
+		const auto executions = all_executions(reader);
+		BOOST_REQUIRE(executions.at(0x2000).size() > 2 * 64);
+		BOOST_REQUIRE(executions.at(0).size() > 2 * 64);
+		check(reader, executions, end);
+
+		reader::ReaderOptions options;
+		options.execution_index = true;
+		options.transition_index = true;
+		check(Reader(filename.c_str(), options), executions, end);
+
+		reader.export_flat_trace(flat_filename.c_str());
+		check(Reader(flat_filename.c_str()), executions, end);
+	}
+
+	// refresh extends the index with the events recorded since it was loaded
+	{
+		std::remove(filename.c_str());
+		std::unique_ptr<Writer> writer(new Writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST",
+		                                          writer::WriterOptions::live_tail()));
+		std::vector<std::uint8_t> data = {0, 1};
+		std::uint64_t transition = 0;
+		auto record = [&](std::uint64_t count) {
+			for (std::uint64_t i = 0; i < count; ++i) {
+				writer->add_block(transition, ExecutedBlock{i % 10, 1, ExecutionMode::x86_64_bits},
+				                  Span{data.size(), data.data()});
+				transition += 1;
+			}
+		};
+
+		record(1000);
+		writer->flush();
+		reader::ReaderOptions options;
+		options.execution_index = true;
+		Reader reader(filename.c_str(), options);
+		// the last block is pending
+		BOOST_CHECK_EQUAL(reader.prev_execution(5, 2000).value(), 995);
+
+		record(1000);
+		writer->finalize_execution(transition);
+		writer->close();
+		writer.reset();
+		BOOST_CHECK_EQUAL(reader.refresh(), 2000);
+		BOOST_CHECK_EQUAL(reader.prev_execution(5, 2000).value(), 1995);
+		BOOST_CHECK_EQUAL(reader.next_execution(9, 996).value(), 999);
+		BOOST_CHECK(not reader.next_execution(9, 2000));
+	}
+
+	for (const char* suffix : {"", "-journal", "-wal", "-shm"}) {
+		std::remove((filename + suffix).c_str());
+	}
+	std::remove(flat_filename.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_query_interrupts)
+{
+	const std::string filename = "test_reader_query_interrupts.sqlite";
+	const std::string flat_filename = "test_reader_query_interrupts.flat";
+
+	using Row = std::array<std::uint64_t, 6>;
+	auto as_array = [](std::uint64_t transition_id, const reader::Interrupt& interrupt) {
+		return Row{{transition_id, interrupt.pc, static_cast<std::uint64_t>(interrupt.mode), interrupt.number,
+		            interrupt.is_hw, interrupt.has_related_instruction()}};
+	};
+
+	const std::pair<std::uint64_t, std::uint64_t> ranges[] = {
+		{0, std::numeric_limits<std::uint64_t>::max()}, {1000, 5000}, {3, 4}, {10000, 10000}};
+	reader::InterruptFilter filters[6];
+	filters[1].number = 14;
+	filters[2].is_hw = true;
+	filters[3].mode = ExecutionMode::x86_32_bits;
+	filters[4].number = 14;
+	filters[4].is_hw = false;
+	filters[4].mode = ExecutionMode::x86_64_bits;
+	filters[5].number = 1000;
+
+	auto check = [&](const Reader& reader) {
+		// the interrupts of all the non-instructions
+		std::vector<Row> interrupts;
+		std::uint64_t long_events = 0;
+		for (auto transition : reader.query_non_instructions()) {
+			interrupts.push_back(as_array(transition, reader.interrupt_at(transition).value()));
+			// an interrupt is at the beginning of its event, even if the event spans several transitions
+			const auto event = reader.event_at(transition).value();
+			BOOST_CHECK_EQUAL(event.begin_transition_id, transition);
+			long_events += event.end_transition_id - event.begin_transition_id > 1 ? 1 : 0;
+		}
+		BOOST_REQUIRE_EQUAL(interrupts.size(), 400);
+		BOOST_CHECK_EQUAL(long_events, 134);
+
+		for (const auto& range : ranges) {
+			for (const auto& filter : filters) {
+				std::vector<Row> expected;
+				for (const auto& row : interrupts) {
+					if (row[0] >= range.first and row[0] < range.second and
+					    (not filter.number or row[3] == *filter.number) and
+					    (not filter.is_hw or row[4] == *filter.is_hw) and
+					    (not filter.mode or row[2] == static_cast<std::uint64_t>(*filter.mode))) {
+						expected.push_back(row);
+					}
+				}
+
+				std::vector<Row> rows;
+				for (const auto& interrupt : reader.query_interrupts(range.first, range.second, filter)) {
+					rows.push_back(as_array(interrupt.transition_id, interrupt.interrupt));
+				}
+				BOOST_CHECK(rows == expected);
+			}
+		}
+
+		// related instruction data of an interrupt from the query
+		for (const auto& interrupt : reader.query_interrupts(0, 100)) {
+			BOOST_CHECK_EQUAL(reader.related_instruction_data(interrupt.interrupt).value().size, 5);
+		}
+		return interrupts;
+	};
+
+	for (bool chunked : {false, true}) {
+		std::remove(filename.c_str());
+		{
+			writer::WriterOptions options;
+			options.chunked_execution = chunked;
+			Writer writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST", options);
+			std::vector<std::uint8_t> data(12, 0x90);
+			std::uint64_t transition = 0;
+			for (std::uint64_t i = 0; i < 2000; ++i) {
+				// 3 instructions of 4, 5 and 3 bytes
+				const auto mode = i % 3 == 0 ? ExecutionMode::x86_32_bits : ExecutionMode::x86_64_bits;
+				writer.add_block(transition, ExecutedBlock{0x1000, 3, mode}, Span{data.size(), data.data()});
+				writer.add_block_instruction(0x1004);
+				writer.add_block_instruction(0x1009);
+				transition += 3;
+				if (i % 5 == 0) {
+					writer::Interrupt interrupt;
+					interrupt.pc = 0x1004;
+					interrupt.mode = mode;
+					interrupt.number = i % 4 == 0 ? 14 : i % 32;
+					interrupt.is_hw = i % 7 == 0;
+					interrupt.has_related_instruction = true;
+					writer.add_interrupt(transition, interrupt);
+					// some non-instructions span several transitions
+					transition += i % 15 == 0 ? 3 : 1;
+				}
+			}
+			writer.finalize_execution(transition);
+			writer.close();
+		}
+
+		Reader reader(filename.c_str());
+		const auto interrupts = check(reader);
+
+		// the number is filtered with the index
+		auto db = reven::sqlite::ResourceDatabase::open(filename.c_str(), true);
+		reven::sqlite::Statement plan(db, "EXPLAIN QUERY PLAN SELECT transition_id FROM interrupts "
+		                                  "WHERE transition_id >= 0 AND transition_id < 100 AND number = 14 "
+		                                  "ORDER BY transition_id ASC;");
+		BOOST_REQUIRE(plan.step() == reven::sqlite::Statement::StepResult::Row);
+		BOOST_CHECK(plan.column_string(3).find("interrupts_number") != std::string::npos);
+
+		reader.export_flat_trace(flat_filename.c_str());
+		BOOST_CHECK(check(Reader(flat_filename.c_str())) == interrupts);
+	}
+
+	for (const char* suffix : {"", "-journal", "-wal", "-shm"}) {
+		std::remove((filename + suffix).c_str());
+	}
+	std::remove(flat_filename.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_reader_flat_trace)
+{
+	const std::string filename = "test_reader_flat_trace.sqlite";
+	const std::string flat_filename = "test_reader_flat_trace.flat";
+
+	using Event = std::array<std::uint64_t, 3>;
+	auto as_array = [](const reader::BlockExecutionEvent& event) {
+		return Event{{event.begin_transition_id, event.end_transition_id,
+		              static_cast<std::uint64_t>(event.block_handle.handle())}};
+	};
+	auto all_events = [&as_array](const Reader& reader) {
+		std::vector<Event> events;
+		for (const auto& event : reader.query_events()) {
+			events.push_back(as_array(event));
+		}
+		return events;
+	};
+
+	for (bool chunked : {false, true}) {
+		std::remove(filename.c_str());
+		std::uint64_t end = 0;
+		{
+			writer::WriterOptions options;
+			options.chunked_execution = chunked;
+			Writer writer(filename.c_str(), "tester", "1.0.0", "BOOST AUTOTEST", options);
+			std::uint64_t transition = 0;
+			for (std::uint64_t i = 0; i < 3000; ++i) {
+				// loops stored as runs, between blocks of 3 instructions of 4, 5 and 3 bytes
+				const auto pc = (i / 100) % 2 == 0 ? (i % 3) * 0x100 : (i % 70) * 0x100;
+				std::vector<std::uint8_t> data(12, static_cast<std::uint8_t>(pc >> 8));
+				writer.add_block(transition, ExecutedBlock{pc, 3, ExecutionMode::x86_32_bits},
+				                 Span{data.size(), data.data()});
+				writer.add_block_instruction(pc + 4);
+				writer.add_block_instruction(pc + 9);
+				transition += 3;
+				if (i % 41 == 0) {
+					writer::Interrupt interrupt;
+					interrupt.pc = pc + 4;
+					interrupt.number = i;
+					interrupt.is_hw = i % 2 == 0;
+					interrupt.has_related_instruction = true;
+					writer.add_interrupt(transition, interrupt);
+					++transition;
+				}
+			}
+			writer.finalize_execution(transition);
+			writer.close();
+			end = transition;
+		}
+
+		Reader db_reader(filename.c_str());
+		db_reader.export_flat_trace(flat_filename.c_str());
+		Reader flat_reader(flat_filename.c_str());
+
+		const auto expected = all_events(db_reader);
+		BOOST_CHECK(all_events(flat_reader) == expected);
+		BOOST_CHECK_EQUAL(flat_reader.refresh(), end);
+
+		for (std::uint64_t transition = 0; transition < end + 2; ++transition) {
+			const auto event = db_reader.event_at(transition);
+			const auto flat_event = flat_reader.event_at(transition);
+			BOOST_REQUIRE_EQUAL(bool(event), bool(flat_event));
+			if (event) {
+				BOOST_CHECK(as_array(*event) == as_array(*flat_event));
+				const auto& block = db_reader.block(event->block_handle);
+				const auto& flat_block = flat_reader.block(flat_event->block_handle);
+				BOOST_CHECK(block.instruction_data == flat_block.instruction_data);
+				BOOST_CHECK_EQUAL(block.first_pc, flat_block.first_pc);
+				BOOST_CHECK_EQUAL(block.instruction_count, flat_block.instruction_count);
+				BOOST_CHECK(block.mode == flat_block.mode);
+			}
+
+			const auto interrupt = db_reader.interrupt_at(transition);
+			const auto flat_interrupt = flat_reader.interrupt_at(transition);
+			BOOST_REQUIRE_EQUAL(bool(interrupt), bool(flat_interrupt));
+			if (interrupt) {
+				BOOST_CHECK_EQUAL(interrupt->pc, flat_interrupt->pc);
+				BOOST_CHECK_EQUAL(interrupt->number, flat_interrupt->number);
+				BOOST_CHECK_EQUAL(interrupt->is_hw, flat_interrupt->is_hw);
+				BOOST_CHECK(interrupt->mode == flat_interrupt->mode);
+				const auto data = flat_reader.related_instruction_data(*flat_interrupt).value();
+				BOOST_CHECK_EQUAL(data.size, db_reader.related_instruction_data(*interrupt).value().size);
+			}
+		}
+
+		std::vector<Event> range;
+		for (const auto& event : flat_reader.query_events(1000, 2000)) {
+			range.push_back(as_array(event));
+		}
+		std::vector<Event> expected_range;
+		for (const auto& event : db_reader.query_events(1000, 2000)) {
+			expected_range.push_back(as_array(event));
+		}
+		BOOST_CHECK(range == expected_range);
+
+		std::vector<Event> reverse;
+		for (const auto& event : flat_reader.query_events_reverse(5000)) {
+			reverse.push_back(as_array(event));
+		}
+		std::vector<Event> expected_reverse;
+		for (const auto& event : db_reader.query_events_reverse(5000)) {
+			expected_reverse.push_back(as_array(event));
+		}
+		BOOST_CHECK(reverse == expected_reverse);
+
+		const std::uint64_t transitions[] = {0, 1, 1, 700, 4001, end - 1, end, end + 5};
+		std::vector<reader::BlockExecutionEvent> events;
+		flat_reader.events_at(transitions, 8, events);
+		BOOST_REQUIRE_EQUAL(events.size(), 6);
+		for (std::size_t i = 0; i < events.size(); ++i) {
+			BOOST_CHECK(as_array(events[i]) == as_array(db_reader.event_at(transitions[i]).value()));
+		}
+
+		std::uint64_t instruction_errors = 0;
+		auto instructions = db_reader.query_instructions(0, end);
+		auto it = instructions.begin();
+		for (const auto& transition : flat_reader.query_instructions(0, end)) {
+			BOOST_REQUIRE(it != instructions.end());
+			instruction_errors += transition.transition_id == it->transition_id and
+			                      transition.is_instruction == it->is_instruction and
+			                      transition.instruction.pc == it->instruction.pc and
+			                      transition.instruction.data.size == it->instruction.data.size ? 0 : 1;
+			++it;
+		}
+		BOOST_CHECK(it == instructions.end());
+		BOOST_CHECK_EQUAL(instruction_errors, 0);
+
+		std::vector<std::uint64_t> non_instructions;
+		for (auto transition : flat_reader.query_non_instructions()) {
+			non_instructions.push_back(transition);
+		}
+		std::vector<std::uint64_t> expected_non_instructions;
+		for (auto transition : db_reader.query_non_instructions()) {
+			expected_non_instructions.push_back(transition);
+		}
+		BOOST_CHECK(non_instructions == expected_non_instructions);
+
+		// a flat trace exports to the same flat trace
+		const std::string copy_filename = flat_filename + ".copy";
+		flat_reader.export_flat_trace(copy_filename.c_str());
+		BOOST_CHECK(all_events(Reader(copy_filename.c_str())) == expected);
+		std::remove(copy_filename.c_str());
+
+		reader::ConcurrentReader concurrent_reader(flat_filename.c_str());
+		BOOST_CHECK(as_array(concurrent_reader.event_at(4001).value()) ==
+		            as_array(db_reader.event_at(4001).value()));
+
+		std::vector<Event> prefetched;
+		for (const auto& event : flat_reader.query_events_prefetched(16)) {
+			prefetched.push_back(as_array(event));
+		}
+		BOOST_CHECK(prefetched == expected);
+	}
+
+	// a block whose instruction data or instruction offsets are out of their sections is rejected when it is read
+	const std::string corrupt_filename = flat_filename + ".corrupt";
+	for (std::uint64_t field : {8, 16}) {
+		{
+			std::ifstream source(flat_filename, std::ios::binary);
+			std::ofstream copy(corrupt_filename, std::ios::binary);
+			copy << source.rdbuf();
+		}
+		const auto handle = Reader(flat_filename.c_str()).event_at(0).value().block_handle;
+		{
+			std::fstream file(corrupt_filename, std::ios::binary | std::ios::in | std::ios::out);
+			// blocks_offset in the header, then data_offset or instruction_offsets_begin in the 40-byte entry
+			std::uint64_t blocks_offset;
+			file.seekg(72);
+			file.read(reinterpret_cast<char*>(&blocks_offset), sizeof(blocks_offset));
+			file.seekp(blocks_offset + 40 * handle.handle() + field);
+			const std::uint64_t offset = 1ull << 40;
+			file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+		}
+		Reader corrupt_reader(corrupt_filename.c_str());
+		BOOST_CHECK_THROW(corrupt_reader.block(handle), std::runtime_error);
+		BOOST_CHECK_THROW(corrupt_reader.block_with_instructions(handle, {}), std::runtime_error);
+	}
+	std::remove(corrupt_filename.c_str());
+
+	// a flat trace in another version is rejected
+	{
+		std::fstream file(flat_filename, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(8);
+		const std::uint32_t version = 2;
+		file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	}
+	BOOST_CHECK_THROW(Reader(flat_filename.c_str()), std::runtime_error);
+
+	for (const char* suffix : {"", "-journal", "-wal", "-shm"}) {
+		std::remove((filename + suffix).c_str());
+	}
+	std::remove(flat_filename.c_str());
+}